@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A copy of the Uris, Attributes, and Origins tables so that ids in query
+ * results can be turned into names, and names into the ids given to stored
+ * procedures, without asking the server. Search patterns are also matched
+ * against the cached names so that queries can name ids directly.
+ * The tables are loaded once and then kept current by adding values through
+ * the cache and by refreshing it with the rows that other writers add.
+ * Values missing from the cache are looked up on the given connection.
+ * Every operation is thread safe.
+ ******************************************************************************/
+
+#ifndef __ID_CACHE_HPP__
+#define __ID_CACHE_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <mysql/mysql.h>
+
+#include <regex_cache.hpp>
+
+class IdCache {
+  public:
+    enum Table {uri_table = 0, attribute_table = 1, origin_table = 2};
+
+  private:
+    struct Dictionary {
+      std::string table;
+      std::string id_column;
+      std::string name_column;
+      std::map<int64_t, std::u16string> names;
+      std::map<std::u16string, int64_t> ids;
+      //Every row with an id up to this one has been read by refresh. Single
+      //ids added by lookups and inserts do not move it.
+      int64_t loaded_through = 0;
+      //Held while a missing value is looked up so that it is only added once
+      std::mutex mutex;
+    };
+    Dictionary dictionaries[3];
+
+    //Names are stored and read as 8 bit strings, the same as the rest of
+    //the mysql world model
+    static std::string narrow(const std::u16string& str) {
+      return std::string(str.begin(), str.end());
+    }
+
+    ///Run a query and call f with the id and name of each row
+    static bool query(MYSQL* handle, const std::string& statement,
+        std::function<void(int64_t, const std::u16string&)> f) {
+      if (nullptr == handle) {
+        std::cerr<<"Error looking up ids -- connection is null\n";
+        return false;
+      }
+      if (mysql_query(handle, statement.c_str())) {
+        std::cerr<<"Error looking up ids: "<<mysql_error(handle)<<'\n';
+        return false;
+      }
+      MYSQL_RES* result = mysql_use_result(handle);
+      if (nullptr == result) {
+        std::cerr<<"Error looking up ids: "<<mysql_error(handle)<<'\n';
+        return false;
+      }
+      MYSQL_ROW row;
+      while (nullptr != (row = mysql_fetch_row(result))) {
+        unsigned long* lengths = mysql_fetch_lengths(result);
+        if (nullptr != row[0] and nullptr != row[1]) {
+          f(std::stoll(row[0]), std::u16string(row[1], row[1] + lengths[1]));
+        }
+      }
+      //Rows stop early if the connection fails while they are read
+      bool success = 0 == mysql_errno(handle);
+      if (not success) {
+        std::cerr<<"Error looking up ids: "<<mysql_error(handle)<<'\n';
+      }
+      mysql_free_result(result);
+      return success;
+    }
+
+    ///Quote a name for use in a statement
+    static std::string quote(MYSQL* handle, const std::u16string& name) {
+      std::string str = narrow(name);
+      std::string escaped(2*str.size() + 1, '\0');
+      escaped.resize(mysql_real_escape_string(handle, &escaped[0], str.data(), str.size()));
+      return "'" + escaped + "'";
+    }
+
+    ///Remember a value. The dictionary's mutex must be held.
+    static void add(Dictionary& dict, int64_t id, const std::u16string& name) {
+      dict.names[id] = name;
+      dict.ids[name] = id;
+    }
+
+  public:
+    IdCache() {
+      dictionaries[uri_table].table = "Uris";
+      dictionaries[uri_table].id_column = "idUri";
+      dictionaries[uri_table].name_column = "uriName";
+      dictionaries[attribute_table].table = "Attributes";
+      dictionaries[attribute_table].id_column = "idAttribute";
+      dictionaries[attribute_table].name_column = "attributeName";
+      dictionaries[origin_table].table = "Origins";
+      dictionaries[origin_table].id_column = "idOrigin";
+      dictionaries[origin_table].name_column = "originName";
+    }
+
+    IdCache& operator=(const IdCache&) = delete;
+    IdCache(const IdCache&) = delete;
+
+    ///Load every table. Returns false if any table could not be read.
+    bool load(MYSQL* handle) {
+      bool success = true;
+      for (Table table : {uri_table, attribute_table, origin_table}) {
+        success = refresh(table, handle) and success;
+      }
+      return success;
+    }
+
+    /**
+     * Read the rows of a table with ids after the last id read by a
+     * previous refresh. This finishes a load that failed and finds names
+     * added by other writers to the same database. Returns false if the
+     * table could not be read.
+     */
+    bool refresh(Table table, MYSQL* handle) {
+      Dictionary& dict = dictionaries[table];
+      std::unique_lock<std::mutex> lck(dict.mutex);
+      int64_t last = dict.loaded_through;
+      bool success = query(handle, "SELECT " + dict.id_column + ", " + dict.name_column + " FROM " + dict.table +
+          " WHERE " + dict.id_column + " > " + std::to_string(dict.loaded_through) + ";",
+          [&](int64_t id, const std::u16string& name) {
+            add(dict, id, name);
+            last = std::max(last, id);});
+      //Only move past the rows once all of them were read
+      if (success) {
+        dict.loaded_through = last;
+      }
+      return success;
+    }
+
+    ///Return the name with the given id, or an empty string if there is none
+    std::u16string name(Table table, int64_t id, MYSQL* handle) {
+      Dictionary& dict = dictionaries[table];
+      std::unique_lock<std::mutex> lck(dict.mutex);
+      auto found = dict.names.find(id);
+      if (found == dict.names.end()) {
+        query(handle, "SELECT " + dict.id_column + ", " + dict.name_column + " FROM " + dict.table +
+            " WHERE " + dict.id_column + " = " + std::to_string(id) + ";",
+            [&](int64_t id, const std::u16string& name) { add(dict, id, name);});
+        found = dict.names.find(id);
+        if (found == dict.names.end()) {
+          return u"";
+        }
+      }
+      return found->second;
+    }
+
+    ///Return the id of a name, adding the name to its table if needed.
+    ///Returns -1 if the name could not be found or added.
+    int64_t id(Table table, const std::u16string& name, MYSQL* handle) {
+      Dictionary& dict = dictionaries[table];
+      std::unique_lock<std::mutex> lck(dict.mutex);
+      auto found = dict.ids.find(name);
+      if (found != dict.ids.end()) {
+        return found->second;
+      }
+      if (nullptr == handle) {
+        std::cerr<<"Error looking up ids -- connection is null\n";
+        return -1;
+      }
+      //The table may have a name that only differs by case, which is kept
+      //as the name of the id
+      int64_t found_id = -1;
+      std::u16string stored = name;
+      query(handle, "SELECT " + dict.id_column + ", " + dict.name_column + " FROM " + dict.table +
+          " WHERE " + dict.name_column + " = " + quote(handle, name) + " LIMIT 1;",
+          [&](int64_t id, const std::u16string& db_name) { found_id = id; stored = db_name;});
+      if (-1 == found_id) {
+        std::string statement = "INSERT INTO " + dict.table + " (" + dict.name_column + ") VALUES (" +
+          quote(handle, name) + ");";
+        if (mysql_query(handle, statement.c_str())) {
+          std::cerr<<"Error adding to "<<dict.table<<": "<<mysql_error(handle)<<'\n';
+          return -1;
+        }
+        found_id = mysql_insert_id(handle);
+      }
+      add(dict, found_id, stored);
+      dict.ids[name] = found_id;
+      return found_id;
+    }
+
+    /**
+     * Find the ids of the names that fully match any of the given patterns.
+     * Sets all to true if every name in the table matched.
+     */
+    std::vector<int64_t> matching(Table table, const std::vector<std::u16string>& patterns, bool& all) {
+      std::vector<std::shared_ptr<const CompiledPattern>> expressions;
+      for (const std::u16string& pattern : patterns) {
+        expressions.push_back(RegexCache::get(pattern));
+      }
+      std::vector<int64_t> found;
+      Dictionary& dict = dictionaries[table];
+      std::unique_lock<std::mutex> lck(dict.mutex);
+      for (auto& entry : dict.names) {
+        for (std::shared_ptr<const CompiledPattern>& exp : expressions) {
+          if (exp->fullMatch(entry.second)) {
+            found.push_back(entry.first);
+            break;
+          }
+        }
+      }
+      all = found.size() == dict.names.size();
+      return found;
+    }
+
+    ///Forget a name after it is removed from its table
+    void forget(Table table, const std::u16string& name) {
+      Dictionary& dict = dictionaries[table];
+      std::unique_lock<std::mutex> lck(dict.mutex);
+      auto found = dict.ids.find(name);
+      if (found == dict.ids.end()) {
+        return;
+      }
+      int64_t id = found->second;
+      dict.names.erase(id);
+      //Remove every spelling of the name
+      for (auto I = dict.ids.begin(); I != dict.ids.end();) {
+        if (I->second == id) {
+          I = dict.ids.erase(I);
+        }
+        else {
+          ++I;
+        }
+      }
+    }
+};
+
+#endif //ifndef __ID_CACHE_HPP__
@@ -70,9 +70,6 @@ Debug& operator<<(Debug& dbg, T arg) {
   return dbg;
 }
 
-//Make sure that the compiler places this instantiation into the object file.
-template class QueryThread<WorldModel::world_state>;
-
 //Used to update the expiration_date field of uri attributes.
 WorldModel::world_state MysqlWorldModel::databaseUpdate(world_model::URI& uri,
     std::vector<world_model::Attribute>& to_update, MYSQL* handle) {
@@ -207,7 +204,9 @@ WorldModel::world_state MysqlWorldModel::databaseStore(world_model::URI& uri, st
 
   //Create a statement
   //std::string statement_str = "INSERT OR IGNORE INTO 'attributes' VALUES (?1, ?2, ?3, ?4, ?5, ?6);";
-  std::string statement_str = "CALL updateAttribute(?, ?, ?, ?, ?);";
+  //The names are given as ids from the id cache so that the procedure does
+  //not need to look them up
+  std::string statement_str = "CALL updateAttributeIds(?, ?, ?, ?, ?);";
   MYSQL_STMT* statement_p = mysql_stmt_init(handle);
   if (nullptr == statement_p) {
     //TODO This should be better at handling an error.
@@ -218,20 +217,22 @@ WorldModel::world_state MysqlWorldModel::databaseStore(world_model::URI& uri, st
     mysql_stmt_close(statement_p);
     return stored;
   }
+  int64_t uri_id = ids.id(IdCache::uri_table, uri, handle);
+  if (-1 == uri_id) {
+    mysql_stmt_close(statement_p);
+    return stored;
+  }
+  int64_t name_id, origin_id;
   MYSQL_BIND parameters[5];
   memset(parameters, 0, sizeof(parameters));
-  std::string char8_uri(uri.begin(), uri.end());
-  parameters[0].buffer_type = MYSQL_TYPE_STRING;
-  parameters[0].buffer = (void*)char8_uri.data();
-  unsigned long uri_len = char8_uri.size();
-  parameters[0].length = &uri_len;
-  parameters[0].is_unsigned = true;
+  parameters[0].buffer_type = MYSQL_TYPE_LONGLONG;
+  parameters[0].buffer = &uri_id;
 
   //These parameters will be set for each new data entry
-  parameters[1].buffer_type = MYSQL_TYPE_STRING;
-  parameters[1].is_unsigned = true;
-  parameters[2].buffer_type = MYSQL_TYPE_STRING;
-  parameters[2].is_unsigned = true;
+  parameters[1].buffer_type = MYSQL_TYPE_LONGLONG;
+  parameters[1].buffer = &name_id;
+  parameters[2].buffer_type = MYSQL_TYPE_LONGLONG;
+  parameters[2].buffer = &origin_id;
   parameters[3].buffer_type = MYSQL_TYPE_BLOB;
   parameters[3].is_unsigned = true;
   parameters[4].buffer_type = MYSQL_TYPE_LONGLONG;
@@ -239,16 +240,11 @@ WorldModel::world_state MysqlWorldModel::databaseStore(world_model::URI& uri, st
   //Set the parameter structure (uri, attribute, origin, data, timestamp)
   for (auto entry : entries) {
     //Bind this attribute's parameters
-    //Name
-    std::string char8_name(entry.name.begin(), entry.name.end());
-    parameters[1].buffer = (void*)char8_name.data();
-    unsigned long name_len = char8_name.size();
-    parameters[1].length = &name_len;
-    //Origin
-    std::string char8_origin(entry.origin.begin(), entry.origin.end());
-    parameters[2].buffer = (void*)char8_origin.data();
-    unsigned long origin_len = char8_origin.size();
-    parameters[2].length = &origin_len;
+    name_id = ids.id(IdCache::attribute_table, entry.name, handle);
+    origin_id = ids.id(IdCache::origin_table, entry.origin, handle);
+    if (-1 == name_id or -1 == origin_id) {
+      continue;
+    }
     //Data
     parameters[3].buffer = entry.data.data();
     unsigned long data_len = entry.data.size();
@@ -278,7 +274,134 @@ WorldModel::world_state MysqlWorldModel::databaseStore(world_model::URI& uri, st
   return stored;
 }
 
-void MysqlWorldModel::setupMySQL(std::string directory, MYSQL* db_handle) {
+//Run a statement that returns no rows, discarding any results of a
+//procedure call. Returns false after printing any error.
+static bool execute(MYSQL* handle, const std::string& statement) {
+  if (mysql_query(handle, statement.c_str())) {
+    std::cerr<<"Error executing "<<statement<<": "<<mysql_error(handle)<<'\n';
+    return false;
+  }
+  int status = 0;
+  do {
+    MYSQL_RES* result = mysql_store_result(handle);
+    if (nullptr != result) {
+      mysql_free_result(result);
+    }
+    status = mysql_next_result(handle);
+  } while (0 == status);
+  if (0 < status) {
+    std::cerr<<"Error executing "<<statement<<": "<<mysql_error(handle)<<'\n';
+    return false;
+  }
+  return true;
+}
+
+WorldModel::world_state MysqlWorldModel::databaseStoreBatch(
+    std::vector<std::pair<world_model::URI, std::vector<world_model::Attribute>>>& batch, MYSQL* handle) {
+  WorldModel::world_state stored;
+  //Return if we cannot get a connection
+  if (nullptr == handle) {
+    std::cerr<<"Cannot store a batch: given a null connection.\n";
+    return stored;
+  }
+  //The ids of each staged value, in the order of the batch
+  struct Staged {
+    int64_t uri_id;
+    int64_t name_id;
+    int64_t origin_id;
+    world_model::URI* uri;
+    world_model::Attribute* entry;
+  };
+  std::vector<Staged> staged;
+  for (auto I = batch.begin(); I != batch.end(); ++I) {
+    if (I->second.empty()) {
+      continue;
+    }
+    int64_t uri_id = ids.id(IdCache::uri_table, I->first, handle);
+    for (world_model::Attribute& entry : I->second) {
+      int64_t name_id = ids.id(IdCache::attribute_table, entry.name, handle);
+      int64_t origin_id = ids.id(IdCache::origin_table, entry.origin, handle);
+      if (-1 != uri_id and -1 != name_id and -1 != origin_id) {
+        staged.push_back(Staged{uri_id, name_id, origin_id, &I->first, &entry});
+      }
+    }
+  }
+  if (staged.empty()) {
+    return stored;
+  }
+
+  //Stage the values with multi-row INSERTs and then apply them together
+  bool success = execute(handle, "START TRANSACTION;") and
+    execute(handle, "DELETE FROM StagedValues WHERE idConnection = CONNECTION_ID();");
+  const std::string row = "(CONNECTION_ID(), ?, ?, ?, ?, ?)";
+  size_t first = 0;
+  while (success and first < staged.size()) {
+    //Take rows until the statement is full
+    size_t last = first;
+    size_t bytes = 0;
+    while (last < staged.size() and last - first < staged_rows_per_statement and
+        (last == first or bytes < staged_bytes_per_statement)) {
+      bytes += staged[last].entry->data.size();
+      ++last;
+    }
+    std::string statement_str = "INSERT IGNORE INTO StagedValues "
+      "(idConnection, idUri, idAttribute, idOrigin, data, createTimestamp) VALUES " + row;
+    for (size_t idx = first + 1; idx < last; ++idx) {
+      statement_str += ", " + row;
+    }
+    std::vector<MYSQL_BIND> parameters(5 * (last - first));
+    std::vector<unsigned long> data_lengths(last - first);
+    memset(parameters.data(), 0, sizeof(MYSQL_BIND) * parameters.size());
+    for (size_t idx = first; idx < last; ++idx) {
+      MYSQL_BIND* bind = &parameters[5 * (idx - first)];
+      for (int column = 0; column < 5; ++column) {
+        bind[column].buffer_type = MYSQL_TYPE_LONGLONG;
+      }
+      bind[0].buffer = &staged[idx].uri_id;
+      bind[1].buffer = &staged[idx].name_id;
+      bind[2].buffer = &staged[idx].origin_id;
+      bind[3].buffer_type = MYSQL_TYPE_BLOB;
+      bind[3].buffer = staged[idx].entry->data.data();
+      data_lengths[idx - first] = staged[idx].entry->data.size();
+      bind[3].length = &data_lengths[idx - first];
+      bind[4].buffer = &staged[idx].entry->creation_date;
+    }
+    MYSQL_STMT* statement_p = mysql_stmt_init(handle);
+    if (nullptr == statement_p or
+        mysql_stmt_prepare(statement_p, statement_str.c_str(), statement_str.size()) or
+        mysql_stmt_bind_param(statement_p, parameters.data()) or
+        mysql_stmt_execute(statement_p)) {
+      std::cerr<<"Error staging values for data insertion: "<<mysql_error(handle)<<"\n";
+      success = false;
+    }
+    if (nullptr != statement_p) {
+      mysql_stmt_close(statement_p);
+    }
+    first = last;
+  }
+  success = success and execute(handle, "CALL applyStagedValues();") and execute(handle, "COMMIT;");
+  if (not success) {
+    execute(handle, "ROLLBACK;");
+    //Store the values one URI at a time instead
+    for (auto I = batch.begin(); I != batch.end(); ++I) {
+      if (not I->second.empty()) {
+        WorldModel::world_state partial = databaseStore(I->first, I->second, handle);
+        stored.insert(partial.begin(), partial.end());
+      }
+    }
+    return stored;
+  }
+  for (Staged& value : staged) {
+    stored[*value.uri].push_back(*value.entry);
+  }
+  return stored;
+}
+
+//Run the commands in the given files of the table/ and proc/ subdirectories
+//of the directory. The connection is closed and an exception is thrown if a
+//file is missing or one of its commands fails.
+static void runSetupFiles(std::string directory, const std::vector<std::string>& tables,
+    const std::vector<std::string>& procs, MYSQL* db_handle) {
   if (directory.empty()) {
     directory = "./";
   }
@@ -286,76 +409,31 @@ void MysqlWorldModel::setupMySQL(std::string directory, MYSQL* db_handle) {
   if (directory.back() != '/') {
     directory.push_back('/');
   }
-  std::vector<std::string> tables{"AttributeValues.mysql", "Attributes.mysql",
-                             "CurrentAttributes.mysql", "Origins.mysql", "Uris.mysql"};
-  for (std::string& tname : tables) {
-    //TODO FIXME There should be a compile-time define specifying the root
-    //directory to search for the mysql proc files.
-    std::string fname = directory + "table/" + tname;
+  //Read and run one file, removing delimiter commands from proc files
+  auto run = [&](const std::string& fname, bool is_proc) {
     std::ifstream file(fname.c_str());
     std::string cmd;
     //Read the whole file into cmd
     std::getline(file, cmd, '\0');
     //Make sure the command isn't empty
     if (cmd.empty()) {
-      std::cerr<<"Database does not exist and no mysql command found in path "<<fname<<'\n';
+      std::cerr<<"No mysql command found in path "<<fname<<'\n';
       std::cerr<<"Manually create tables and stored proceudures or run this program with ./proc/\n";
       std::cerr<<"and ./table/ subdirectories with mysql commands in them.\n";
       mysql_close(db_handle);
       throw std::runtime_error("Unable to initialize tables and procs in mysql database");
     }
-    //std::cerr<<"Executing commands in file "<<fname<<'\n';
-    //Execute the commands in the file
-    if (mysql_real_query(db_handle, cmd.c_str(), cmd.size())) {
-      std::cerr<<"Error executing commands in file "<<fname<<": "<<mysql_error(db_handle)<<"\n";
-      mysql_close(db_handle);
-      throw std::runtime_error("Unable to initialize tables and procs in mysql database");
-    }
-    else {
-      int status = 0;
-      do {
-        MYSQL_RES* result = mysql_store_result(db_handle);
-        if (nullptr != result) {
-          mysql_free_result(result);
+    if (is_proc) {
+      //Now remove any of the delimiter command since they are not needed through the C API
+      std::vector<std::string> dels = {"DELIMITER //", "//", "DELIMITER ;"};
+      for (auto d : dels) {
+        auto del_pos = cmd.find(d);
+        if (del_pos != std::string::npos) {
+          cmd.erase(del_pos, d.size());
         }
-        status = mysql_next_result(db_handle);
-      } while (0 == status);
-      if (0 < status) {
-        std::cerr<<"Error executing commands in file "<<fname<<": "<<mysql_error(db_handle)<<"\n";
-        mysql_close(db_handle);
-        throw std::runtime_error("Unable to initialize tables and procs in mysql database");
       }
     }
-  }
-  std::vector<std::string> procs{"deleteAttribute.mysql", "deleteUri.mysql", "expireAttribute.mysql",
-    "expireUri.mysql", "getCurrentValue.mysql", "getCurrentValueId.mysql",
-    "getIdValueBefore.mysql", "getRangeValues.mysql", "getSnapshotValue.mysql", "getTimestampAfter.mysql",
-    "getURIAttributeOrigin.mysql",
-    "searchAttribute.mysql", "searchOrigin.mysql", "searchUri.mysql", "updateAttribute.mysql"};
-  for (std::string& pname : procs) {
-    if (nullptr == db_handle) { return; }
-    std::string fname = directory + "proc/" + pname;
     //std::cerr<<"Executing commands in file "<<fname<<'\n';
-    std::ifstream file(fname.c_str());
-    std::string cmd;
-    //Read the whole file into cmd
-    std::getline(file, cmd, '\0');
-    //Make sure the command isn't empty
-    if (cmd.empty()) {
-      std::cerr<<"Database does not exist and no mysql command found in path "<<fname<<'\n';
-      std::cerr<<"Manually create tables and stored proceudures or run this program with ./proc/\n";
-      std::cerr<<"and ./table/ subdirectories with mysql commands in them.\n";
-      mysql_close(db_handle);
-      throw std::runtime_error("Unable to initialize tables and procs in mysql database");
-    }
-    //Now remove any of the delimiter command since they are not needed through the C API
-    std::vector<std::string> dels = {"DELIMITER //", "//", "DELIMITER ;"};
-    for (auto d : dels) {
-      auto del_pos = cmd.find(d);
-      if (del_pos != std::string::npos) {
-        cmd.erase(del_pos, d.size());
-      }
-    }
     //Execute the commands in the file
     if (mysql_real_query(db_handle, cmd.c_str(), cmd.size())) {
       std::cerr<<"Error executing commands in file "<<fname<<": "<<mysql_error(db_handle)<<"\n";
@@ -377,11 +455,49 @@ void MysqlWorldModel::setupMySQL(std::string directory, MYSQL* db_handle) {
         throw std::runtime_error("Unable to initialize tables and procs in mysql database");
       }
     }
+  };
+  //TODO FIXME There should be a compile-time define specifying the root
+  //directory to search for the mysql proc files.
+  for (const std::string& tname : tables) {
+    run(directory + "table/" + tname, false);
+  }
+  for (const std::string& pname : procs) {
+    run(directory + "proc/" + pname, true);
   }
+}
+
+void MysqlWorldModel::setupMySQL(std::string directory, MYSQL* db_handle) {
+  std::vector<std::string> tables{"AttributeValues.mysql", "Attributes.mysql",
+                             "CurrentAttributes.mysql", "Origins.mysql", "Uris.mysql", "StagedValues.mysql"};
+  std::vector<std::string> procs{"applyStagedValues.mysql", "deleteAttribute.mysql", "deleteUri.mysql", "expireAttribute.mysql",
+    "expireUri.mysql", "getCurrentValue.mysql", "getCurrentValueId.mysql",
+    "getIdValueBefore.mysql", "getRangeValues.mysql", "getSnapshotValue.mysql", "getTimestampAfter.mysql",
+    "getURIAttributeOrigin.mysql",
+    "searchAttribute.mysql", "searchOrigin.mysql", "searchUri.mysql", "updateAttribute.mysql",
+    "updateAttributeIds.mysql"};
+  runSetupFiles(directory, tables, procs, db_handle);
   //std::cerr<<"Done setting up stored tables and procedures.\n";
 }
 
-MysqlWorldModel::MysqlWorldModel(std::string db_name, std::string user, std::string password) {
+void MysqlWorldModel::upgradeMySQL(std::string directory, MYSQL* db_handle) {
+  //The staging tables are only created if they are missing and the procs
+  //drop any older versions of themselves
+  std::vector<std::string> tables{"StagedValues.mysql"};
+  std::vector<std::string> procs{"applyStagedValues.mysql", "updateAttributeIds.mysql"};
+  runSetupFiles(directory, tables, procs, db_handle);
+}
+
+std::future<WorldModel::world_state> MysqlWorldModel::submit(std::function<world_state(MYSQL*)> task) {
+  if (not pool) {
+    std::promise<world_state> none;
+    none.set_value(world_state());
+    return none.get_future();
+  }
+  return pool->submit(task);
+}
+
+MysqlWorldModel::MysqlWorldModel(std::string db_name, std::string user, std::string password,
+    size_t connections, size_t query_shards) : query_shards(std::max<size_t>(1, query_shards)) {
   this->db_name = db_name;
   this->user = user;
   this->password = password;
@@ -481,6 +597,11 @@ MysqlWorldModel::MysqlWorldModel(std::string db_name, std::string user, std::str
             }
           }
         }
+        else if (nullptr != db_handle) {
+          //A database made by an older version may lack the tables and
+          //procedures that were added since, so add them now
+          upgradeMySQL("./", db_handle);
+        }
       }
     }
   }
@@ -490,8 +611,13 @@ MysqlWorldModel::MysqlWorldModel(std::string db_name, std::string user, std::str
       std::cerr<<"Error setting server options: "<<mysql_error(db_handle)<<'\n';
     }
 
-    //Set up the database settings for the query threads
-    QueryThread<WorldModel::world_state>::setDBInfo(db_name, user, password, db_handle);
+    //Open the connections for the database tasks
+    pool.reset(new ConnectionPool(db_name, user, password, connections));
+
+    //Remember the ids of every URI, attribute name, and origin
+    if (not ids.load(db_handle)) {
+      std::cerr<<"Error loading ids, they will be loaded again when they are needed.\n";
+    }
 
     //Load existing values using the current table.
     {
@@ -506,69 +632,14 @@ MysqlWorldModel::MysqlWorldModel(std::string db_name, std::string user, std::str
       //TODO FIXME Right now the current snapshot doesn't check the db so it
       //cannot be used to load the table. However, this call is faster than
       //the historic snapshot
-      //Return if we cannot get a connection
-      if (nullptr != db_handle) {
-        //CREATE PROCEDURE getCurrentValue(uri VARCHAR(170) CHARACTER SET utf16 COLLATE utf16_unicode_ci,
-        //attribute VARCHAR(170) CHARACTER SET utf16 COLLATE utf16_unicode_ci,
-        //origin VARCHAR(170) CHARACTER SET utf16 COLLATE utf16_unicode_ci)
-        std::string statement_str = "CALL getCurrentValue(?, ?, ?);";
-        MYSQL_STMT* statement_p = mysql_stmt_init(db_handle);
-        if (nullptr == statement_p) {
-          //TODO This should be better at handling an error.
-          std::cerr<<"Error creating statement for current snapshot.\n";
-        }
-        else {
-          if (mysql_stmt_prepare(statement_p, statement_str.c_str(), statement_str.size())) {
-            std::cerr<<"Failed to prepare statement: "<<statement_str<<": "<<mysql_error(db_handle)<<'\n';
-          }
-          else {
-            MYSQL_BIND parameters[3];
-            memset(parameters, 0, sizeof(parameters));
-            std::string char8_uri(uri.begin(), uri.end());
-            parameters[0].buffer_type = MYSQL_TYPE_STRING;
-            parameters[0].buffer = (void*)char8_uri.data();
-            unsigned long uri_len = char8_uri.size();
-            parameters[0].length = &uri_len;
-            parameters[0].is_unsigned = true;
-            parameters[1].buffer_type = MYSQL_TYPE_STRING;
-            unsigned long attr_len;
-            parameters[1].length = &attr_len;
-            parameters[1].is_unsigned = true;
-            //TODO FIXME Accepting any origin right now
-            std::string char8_origin = ".*";
-            parameters[2].buffer_type = MYSQL_TYPE_STRING;
-            parameters[2].buffer = (void*)char8_origin.data();
-            unsigned long origin_len = char8_origin.size();
-            parameters[2].length = &origin_len;
-
-            for (std::u16string attr : desired_attributes) {
-              //parameters[1].buffer = (void*)attr.data();
-              //attr_len = attr.size()*2;
-              std::string char8_name(attr.begin(), attr.end());
-              parameters[1].buffer = (void*)char8_name.data();
-              attr_len = char8_name.size();
-              if (0 != mysql_stmt_bind_param(statement_p, parameters)) {
-                parameters[1].buffer = (void*)uri.data();
-                //TODO This should be better at handling an error.
-                std::cerr<<"Error binding variables for getCurrentValue.\n";
-              }
-              else {
-                //Execute the statement
-                //std::cerr<<"Executing getCurrentValue for "+std::string(attr.begin(), attr.end())+"\n";
-                std::function<WorldModel::world_state(MYSQL*)> bound_fun = [&](MYSQL* myhandle){ return this->fetchWorldData(statement_p, myhandle);};
-                WorldModel::world_state partial = QueryThread<WorldModel::world_state>::assignTask(bound_fun);
-                for (auto I : partial) {
-                  //Insert new attributes into the world state
-                  cur_state[I.first].insert(cur_state[I.first].end(), I.second.begin(), I.second.end());
-                }
-              }
-              mysql_stmt_reset(statement_p);
-            }
-            //std::cerr<<"Finished fetching world data\n";
-
-            //Delete the statement
-            mysql_stmt_close(statement_p);
-          }
+      WorldModel::world_state loaded = fetchMatchingValues(uri, desired_attributes, "expireTimestamp = 0", {});
+      for (auto I : loaded) {
+        //Insert new attributes into the world state
+        SymbolTable::Symbol uri_id = SymbolTable::intern(I.first);
+        ShardLock lck(cur_state, uri_id);
+        std::vector<InternedAttribute>& attributes = (*lck)[uri_id];
+        for (const world_model::Attribute& attr : I.second) {
+          attributes.push_back(InternedAttribute(attr));
         }
       }
       std::cerr<<"World model loaded.\n";
@@ -577,8 +648,8 @@ MysqlWorldModel::MysqlWorldModel(std::string db_name, std::string user, std::str
 }
 
 MysqlWorldModel::~MysqlWorldModel() {
-  std::cerr<<"Destroying thread pool...\n";
-  QueryThread<WorldModel::world_state>::destroyThreads();
+  std::cerr<<"Closing the connection pool...\n";
+  pool.reset();
   if (nullptr != db_handle) {
     mysql_close(db_handle);
   }
@@ -626,6 +697,8 @@ WorldModel::world_state MysqlWorldModel::_deleteURI(world_model::URI& uri, MYSQL
     }
     else {
       deleted[uri].push_back(world_model::Attribute());
+      //The procedure also removes the URI's id
+      ids.forget(IdCache::uri_table, uri);
     }
   }
   //Delete the statement
@@ -699,21 +772,22 @@ bool MysqlWorldModel::createURI(world_model::URI uri,
   std::vector<world_model::Attribute> to_store{Attribute{u"creation", creation, 0, origin, {}}};
   //Lock the access control to get unique access to the world state.
   {
-    SemaphoreLock lck(access_control);
+    SymbolTable::Symbol uri_id = SymbolTable::intern(uri);
+    ShardLock lck(cur_state, uri_id);
 
     //The URI cannot be created twice - just return if this already exists.
-    if (cur_state.find(uri) != cur_state.end()) {
+    if (lck->find(uri_id) != lck->end()) {
       return false;
     }
 
     //Create this URI and push on a creation attribute
-    cur_state[uri].push_back(to_store[0]);
+    (*lck)[uri_id].push_back(InternedAttribute(to_store[0]));
   }
 
   //Put this URI into the database
   std::function<WorldModel::world_state(MYSQL*)> bound_fun = [&](MYSQL* handle){ return this->databaseStore(uri, to_store, handle);};
-  //Send this task to a query thread
-  WorldModel::world_state result = QueryThread<WorldModel::world_state>::assignTask(bound_fun);
+  //Send this task to a pooled connection
+  WorldModel::world_state result = submit(bound_fun).get();
   return not result.empty();
 }
 
@@ -725,7 +799,7 @@ bool MysqlWorldModel::insertData(std::vector<std::pair<world_model::URI, std::ve
   //auto time_start = world_model::getGRAILTime();
 
   //First check if there are any transient values here and process them separately
-  std::map<URI, std::vector<world_model::Attribute>> transients;
+  SharedState transients;
   {
     std::unique_lock<std::mutex> lck(transient_lock);
     //Loop through the new data and remove transient attributes from new_data.
@@ -740,10 +814,11 @@ bool MysqlWorldModel::insertData(std::vector<std::pair<world_model::URI, std::ve
       auto entry = entries.begin();
       while (entry != entries.end()) {
         //Do not process transient types normally.
-        bool is_transient = 0 != transient.count(make_pair(entry->name, entry->origin));
+        bool is_transient = 0 != transient.count(std::make_pair(
+              SymbolTable::intern(entry->name), SymbolTable::intern(entry->origin)));
         if (is_transient){
           //Store separately to send to standing queries
-          transients[uri].push_back(*entry);
+          transients[uri].push_back(InternedAttribute(*entry));
           entry = entries.erase(entry);
         }
         else {
@@ -761,14 +836,10 @@ bool MysqlWorldModel::insertData(std::vector<std::pair<world_model::URI, std::ve
     }
   }
 
-  //Remember any attributes that need to be expired
-  //and any updates to the current table caused by the
-  //new data in this insert command.
-  //Also set the expiration times of previously inserted
-  //data and automatically create new URIs if autocreate
-  //is specified.
-  std::map<URI, vector<world_model::Attribute>> to_expire;
-  std::map<URI, vector<world_model::Attribute>> current_update;
+  //Automatically create new URIs if autocreate is specified. The stored
+  //procedures set the expiration times of previously inserted data.
+  //Updates for the standing queries, sharing data with the current state
+  SharedState current_update;
   //Remember new URIs so that they can be stored after
   //the locks are released
   std::vector<world_model::Attribute> to_store;
@@ -777,20 +848,21 @@ bool MysqlWorldModel::insertData(std::vector<std::pair<world_model::URI, std::ve
     std::vector<world_model::Attribute>& entries = I->second;
 
     if (not entries.empty()) {
-      SemaphoreLock access_lock(access_control);
+      SymbolTable::Symbol uri_id = SymbolTable::intern(uri);
+      ShardLock access_lock(cur_state, uri_id);
 
       //The URI cannot be created through this message unless
       //autocreate was set to true.
-      if (cur_state.find(uri) == cur_state.end()) {
+      if (access_lock->find(uri_id) == access_lock->end()) {
         //Make the URI if it doesn't exist and autocreate is specified
         if (autocreate) {
           world_model::Attribute creation_attr{u"creation", entries.front().creation_date, 0, entries.front().origin, {}};
           //Create this URI and push on a creation attribute
-          cur_state[uri].push_back(creation_attr);
+          (*access_lock)[uri_id].push_back(InternedAttribute(creation_attr));
           //Remember this attribute and push it into the db once we have
           //released the locks so that we don't block other threads
           entries.push_back(creation_attr);
-          current_update[uri].push_back(creation_attr);
+          current_update[uri].push_back((*access_lock)[uri_id].back());
         }
         else {
           //Don't insert anything from this URI
@@ -800,41 +872,42 @@ bool MysqlWorldModel::insertData(std::vector<std::pair<world_model::URI, std::ve
 
       //Now update the in-memory storage for the current state of the world model
       //Get a reference to this URI's attributes for easy access
-      std::vector<world_model::Attribute>& attributes = cur_state[uri];
+      std::vector<InternedAttribute>& attributes = (*access_lock)[uri_id];
 
       //Update the world model with each entry
       for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
         //Check if there is already an entry with the same name and origin
-        auto same_attribute = [&](Attribute& attr) {
-          return (attr.name == entry->name) and (attr.origin == entry->origin);};
+        SymbolTable::Symbol name_id = SymbolTable::intern(entry->name);
+        SymbolTable::Symbol origin_id = SymbolTable::intern(entry->origin);
+        auto same_attribute = [&](InternedAttribute& attr) {
+          return (attr.name == name_id) and (attr.origin == origin_id);};
         auto slot = std::find_if(attributes.begin(), attributes.end(), same_attribute);
         //If no matching solution exists then just insert this new one.
         if (slot == attributes.end()) {
-          attributes.push_back(*entry);
+          attributes.push_back(InternedAttribute(*entry, name_id, origin_id));
+          current_update[uri].push_back(attributes.back());
         }
         //If this entry is newer than what is currently in the model update the model
         else if (slot->creation_date < entry->creation_date) {
-            //Remember the current slot and its expiration time
-            slot->expiration_date = entry->creation_date;
-            to_expire[uri].push_back(*slot);
-            //Now overwrite the slot's value with the new entry
-            *slot = *entry;
+            //Overwrite the slot's value with the new entry
+            *slot = InternedAttribute(*entry, name_id, origin_id);
+            current_update[uri].push_back(*slot);
+        }
+        //Older entries still go to the db and the standing queries
+        else {
+          current_update[uri].push_back(InternedAttribute(*entry, name_id, origin_id));
         }
-        //Always update the db
-        current_update[uri].push_back(*entry);
       }
     }
   }
 
 
   //Put these new attributes into the database
-  //Store all of the entries that were not transient types in the db
-  for (auto I = new_data.begin(); I != new_data.end(); ++I) {
-    if (not I->second.empty()) {
-      std::function<WorldModel::world_state(MYSQL*)> bound_fun = [&](MYSQL* handle){ return this->databaseStore(I->first, I->second, handle);};
-      //Send this task to a query thread
-      WorldModel::world_state result = QueryThread<WorldModel::world_state>::assignTask(bound_fun);
-    }
+  //Store all of the entries that were not transient types in the db.
+  //The whole batch is stored in one transaction and this waits for it so
+  //that a later insert cannot overtake this one.
+  if (not new_data.empty()) {
+    submit([&](MYSQL* handle){ return this->databaseStoreBatch(new_data, handle);}).wait();
   }
   //Expiration times are automatically updated by the stored procedure
 
@@ -842,27 +915,11 @@ bool MysqlWorldModel::insertData(std::vector<std::pair<world_model::URI, std::ve
   //std::cerr<<"DB insertion time was "<<time_diff<<'\n';
   //time_start = world_model::getGRAILTime();
 
-  auto push = [&](StandingQuery* sq) {
-    //First see what items are of interest. This also tells the standing
-    //query to remember partial matches so we do not need to keep feeding
-    //it the current state, only the updates.
-    auto ws = sq->showInterested(current_update);
-    //Insert the data.
-    if (not ws.empty()) {
-      std::cerr<<"Inserting "<<ws.size()<<" entries for the standing query.\n";
-      sq->insertData(ws);
-    }
-    //Insert transients separately from normal data to enforce exact string matching
-    ws = sq->showInterestedTransient(transients);
-    if (not ws.empty()) {
-      std::cerr<<"Inserting "<<ws.size()<<" transient entries for the standing query.\n";
-      sq->insertData(ws);
-    }
-  };
-  StandingQuery::for_each(push);
-  //TODO FIXME Shorter if StandingQuery::offerData handled transient data.
-  //Send data to the standing queries
-  //StandingQuery::offerData(current_update, false, false);
+  //Queue the new data and transients for the standing queries. Matching
+  //happens on the standing query threads so this does not wait on clients.
+  if (not current_update.empty() or not transients.empty()) {
+    StandingQuery::offerData(current_update, false, false, transients);
+  }
   //time_diff = world_model::getGRAILTime() - time_start;
   //std::cerr<<"Standing query insertion time was "<<time_diff<<'\n';
 
@@ -873,26 +930,31 @@ void MysqlWorldModel::expireURI(world_model::URI uri, world_model::grail_time ex
   //Remove the URI and its attributes from the current world model
   //Lock the access control to get unique access to the world state.
   {
-    SemaphoreLock lck(access_control);
+    SymbolTable::Symbol uri_id;
+    //A URI that was never interned cannot be in the world model
+    if (not SymbolTable::find(uri, uri_id)) {
+      return;
+    }
+    ShardLock lck(cur_state, uri_id);
     //The URI cannot be created through this message
-    if (cur_state.find(uri) == cur_state.end()) {
+    if (lck->find(uri_id) == lck->end()) {
       return;
     }
     //Remove this identifier from the current state
-    cur_state.erase(uri);
+    lck->erase(uri_id);
   }
   std::vector<world_model::Attribute> to_expire(1);
   to_expire[0].name = u"creation";
   to_expire[0].expiration_date = expires;
   std::function<WorldModel::world_state(MYSQL*)> bound_fun = [&](MYSQL* handle){ return this->databaseUpdate(uri, to_expire, handle);};
-  //Send this task to a query thread
-  WorldModel::world_state result = QueryThread<WorldModel::world_state>::assignTask(bound_fun);
+  //Send this task to a pooled connection
+  WorldModel::world_state result = submit(bound_fun).get();
 
   //Offer a world state with the expiration date set to indicate expiration.
   WorldState changed_entry;
   world_model::Attribute expiration{u"creation", -1, expires, u"", {}};
   changed_entry[uri].push_back(expiration);
-  StandingQuery::offerData(changed_entry, false, true);
+  StandingQuery::offerData(toSharedState(changed_entry), false, true);
 }
 
 void MysqlWorldModel::expireURIAttributes(world_model::URI uri, std::vector<world_model::Attribute>& entries, world_model::grail_time expires) {
@@ -902,69 +964,84 @@ void MysqlWorldModel::expireURIAttributes(world_model::URI uri, std::vector<worl
 
   //Lock the access control to get unique access to the world state.
   {
-    SemaphoreLock lck(access_control);
+    SymbolTable::Symbol uri_id;
+    //A URI that was never interned cannot be in the world model
+    if (not SymbolTable::find(uri, uri_id)) {
+      return;
+    }
+    ShardLock lck(cur_state, uri_id);
 
     //Nothing to do if there isn't a URI
-    if (cur_state.find(uri) == cur_state.end()) {
+    if (lck->find(uri_id) == lck->end()) {
       return;
     }
 
     //Get a reference to this URI's attributes for easy access
-    std::vector<world_model::Attribute>& attributes = cur_state[uri];
+    std::vector<InternedAttribute>& attributes = (*lck)[uri_id];
 
     //Update the world model with each entry
     for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
       //Check if there is an entry that matches this one
-      auto same_attribute = [&](Attribute& attr) {
-        return (attr.name == entry->name) and
-          (attr.origin == entry->origin) and
+      SymbolTable::Symbol name_id, origin_id;
+      if (not (SymbolTable::find(entry->name, name_id) and
+            SymbolTable::find(entry->origin, origin_id))) {
+        continue;
+      }
+      auto same_attribute = [&](InternedAttribute& attr) {
+        return (attr.name == name_id) and
+          (attr.origin == origin_id) and
           (attr.creation_date == entry->creation_date);};
       auto slot = std::find_if(attributes.begin(), attributes.end(), same_attribute);
       //If a matching solution exists then update the database and erase this
       //from the current model.
       if (slot != attributes.end()) {
         slot->expiration_date = expires;
-        to_update.push_back(*slot);
+        to_update.push_back(slot->toAttribute());
         attributes.erase(slot);
       }
     }
   }
   std::function<WorldModel::world_state(MYSQL*)> bound_fun = [&](MYSQL* handle){ return this->databaseUpdate(uri, to_update, handle);};
-  //Send this task to a query thread
-  WorldModel::world_state result = QueryThread<WorldModel::world_state>::assignTask(bound_fun);
+  //Send this task to a pooled connection
+  WorldModel::world_state result = submit(bound_fun).get();
 
   //Offer a world state with the expiration date of attributes set to indicate
   //their expiration.
   WorldState changed_entry;
   changed_entry[uri] = entries;
-  StandingQuery::offerData(changed_entry, true, false);
+  StandingQuery::offerData(toSharedState(changed_entry), true, false);
 }
 
 void MysqlWorldModel::deleteURI(world_model::URI uri) {
   //Remove the URI and its attributes from the current world model
   //Lock the access control to get unique access to the world state.
   {
-    SemaphoreLock lck(access_control);
+    SymbolTable::Symbol uri_id;
+    //A URI that was never interned cannot be in the world model
+    if (not SymbolTable::find(uri, uri_id)) {
+      return;
+    }
+    ShardLock lck(cur_state, uri_id);
     //The URI cannot be created through this message
-    if (cur_state.find(uri) == cur_state.end()) {
+    if (lck->find(uri_id) == lck->end()) {
       return;
     }
 
     //Remove this identifier from the current state
-    cur_state.erase(uri);
+    lck->erase(uri_id);
   }
   //Remove this URI from the database
 
   std::function<WorldModel::world_state(MYSQL*)> bound_fun = [&](MYSQL* handle){ return this->_deleteURI(uri, handle);};
-  //Send this task to a thread in the thread pool
-  WorldModel::world_state result = QueryThread<WorldModel::world_state>::assignTask(bound_fun);
+  //Send this task to a pooled connection
+  WorldModel::world_state result = submit(bound_fun).get();
   
   //Deletions are the same as expirations from the standing query's perspective
   //Offer a world state with the expiration date set to indicate expiration.
   WorldState changed_entry;
   world_model::Attribute expiration{u"creation", -1, -1, u"", {}};
   changed_entry[uri].push_back(expiration);
-  StandingQuery::offerData(changed_entry, false, true);
+  StandingQuery::offerData(toSharedState(changed_entry), false, true);
 }
 
 void MysqlWorldModel::deleteURIAttributes(world_model::URI uri, std::vector<world_model::Attribute> entries) {
@@ -983,21 +1060,31 @@ void MysqlWorldModel::deleteURIAttributes(world_model::URI uri, std::vector<worl
   //Lock the access control to get unique access to the world state.
   //After cleaning up the world state remove these attributes from the database as well
   {
-    SemaphoreLock lck(access_control);
+    SymbolTable::Symbol uri_id;
+    //A URI that was never interned cannot be in the world model
+    if (not SymbolTable::find(uri, uri_id)) {
+      return;
+    }
+    ShardLock lck(cur_state, uri_id);
 
     //Nothing to do if there isn't a matching URI
-    if (cur_state.find(uri) == cur_state.end()) {
+    if (lck->find(uri_id) == lck->end()) {
       return;
     }
 
     //Get a reference to this URI's attributes for easy access
-    std::vector<world_model::Attribute>& attributes = cur_state[uri];
+    std::vector<InternedAttribute>& attributes = (*lck)[uri_id];
 
     //Update the world model with each entry
     for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
       //Check if there is an entry that matches this one
-      auto same_attribute = [&](Attribute& attr) {
-        return (attr.name == entry->name) and (attr.origin == entry->origin);};
+      SymbolTable::Symbol name_id, origin_id;
+      if (not (SymbolTable::find(entry->name, name_id) and
+            SymbolTable::find(entry->origin, origin_id))) {
+        continue;
+      }
+      auto same_attribute = [&](InternedAttribute& attr) {
+        return (attr.name == name_id) and (attr.origin == origin_id);};
       auto slot = std::find_if(attributes.begin(), attributes.end(), same_attribute);
       if (slot != attributes.end()) {
         attributes.erase(slot);
@@ -1005,8 +1092,8 @@ void MysqlWorldModel::deleteURIAttributes(world_model::URI uri, std::vector<worl
     }
   }
   std::function<WorldModel::world_state(MYSQL*)> bound_fun = [&](MYSQL* handle){ return this->_deleteURIAttributes(uri, entries, handle);};
-  //Send this task to a thread in the thread pool
-  WorldModel::world_state result = QueryThread<WorldModel::world_state>::assignTask(bound_fun);
+  //Send this task to a pooled connection
+  WorldModel::world_state result = submit(bound_fun).get();
 
   
   //Deletions are the same as expirations from the standing query's perspective
@@ -1014,7 +1101,7 @@ void MysqlWorldModel::deleteURIAttributes(world_model::URI uri, std::vector<worl
   //their expiration.
   WorldState changed_entry;
   changed_entry[uri] = entries;
-  StandingQuery::offerData(changed_entry, true, false);
+  StandingQuery::offerData(toSharedState(changed_entry), true, false);
 }
 
 void bindSQL(MYSQL_BIND* bind, unsigned long* length, my_bool* error, my_bool* is_null, std::string& str) {
@@ -1066,132 +1153,9 @@ void bindSQL(MYSQL_BIND* bind, unsigned long* lengths, my_bool* errors, my_bool*
   bindSQL(next_bind, next_long, next_err, next_null, r...);
 }
 
-//Get the identifier for the given URI ID from the specified table
-std::u16string idToName(int64_t id, const std::string& table, MYSQL* db_handle) {
-  static std::map<std::pair<uint64_t, std::string>, std::u16string> idToIdentifier;
-  std::pair<uint64_t, std::string> id_table{id, table};
-
-  //Used a cached result if it exists
-  if (idToIdentifier.end() != idToIdentifier.find(id_table)) {
-    return idToIdentifier[id_table];
-  }
-
-  if (nullptr == db_handle) {
-    std::cerr<<"Error fetching data -- connection is null\n";
-    return u"";
-  }
-
-  std::u16string identifier = u"";
-  std::string statement_str;
-  if ("Uris" == table) {
-    statement_str = "select uriName from "+table+" WHERE idUri = "+std::to_string(id)+";";
-  }
-  else if ("Origins" == table) {
-    statement_str = "select originName from "+table+" WHERE idOrigin = "+std::to_string(id)+";";
-  }
-  else if ("Attributes" == table) {
-    statement_str = "select attributeName from "+table+" WHERE idAttribute = "+std::to_string(id)+";";
-  }
-  MYSQL_STMT* statement_p = mysql_stmt_init(db_handle);
-  if (nullptr == statement_p) {
-    //TODO This should be better at handling an error -- throw an exception
-    std::cerr<<"Error creating statement for current snapshot.\n";
-    return u"";
-  }
-  else {
-    if (mysql_stmt_prepare(statement_p, statement_str.c_str(), statement_str.size())) {
-      std::cerr<<"Failed to prepare statement: "<<statement_str<<": "<<mysql_error(db_handle)<<'\n';
-    }
-    else {
-      //Execute the statement
-      if (mysql_stmt_execute(statement_p)) {
-        std::cerr<<"SQL statement failed: "<<mysql_stmt_error(statement_p)<<'\n';
-        return u"";
-      }
-
-      //Get the parameter count from the statement
-      int param_count = mysql_stmt_param_count(statement_p);
-      // TODO This seems to be unfinished
-      (void)param_count;
-
-      //Fetch result set meta information */
-      MYSQL_RES* prepare_meta_result = mysql_stmt_result_metadata(statement_p);
-      if (!prepare_meta_result) {
-        std::cerr<<"Error fetching meta-information to get world data: "<<mysql_stmt_error(statement_p)<<'\n';
-        return u"";
-      }
-
-      //Get total columns in the query
-      int column_count = mysql_num_fields(prepare_meta_result);
-      //Check for the expected number of columns
-      if (column_count != 1) {
-        std::cerr<<"Bad column count while fetching world data -- expected 2 got "<<column_count<<'\n';
-        //Failed, free the result data
-        mysql_stmt_free_result(statement_p);
-
-        //Free the prepared result metadata
-        mysql_free_result(prepare_meta_result);
-
-        //Free the statement
-        mysql_stmt_close(statement_p);
-        return u"";
-      }
-
-      MYSQL_BIND bind[1];
-      my_bool error[1];
-      my_bool is_null[1];
-
-      memset(bind, 0, sizeof(bind));
-      //Expecting the string matching the ID
-      //Column 1: UTF16 string
-      unsigned long lengths[1];
-      std::string in_string(171, '\0');
-      bindSQL(bind, lengths, error, is_null, in_string);
-
-      //Bind the result buffers
-      if (mysql_stmt_bind_result(statement_p, bind)) {
-        std::cerr<<"Error binding to result buffers while fetching world data: "<<mysql_stmt_error(statement_p)<<'\n';
-        //TODO FIXME Should throw an exception here
-        return u"";
-      }
-
-      //mysql_stmt_fetch() returns zero if a row was fetched successfully,
-      //MYSQL_NO_DATA if there are no more rows to fetch, and 1 if an error occurred.
-      //After a successful fetch, the column values are available in the MYSQL_BIND
-      //structures bound to the result.
-      int num_rows = 0;
-      while (0 == (mysql_stmt_fetch(statement_p))) {
-        ++num_rows;
-        identifier = std::u16string(in_string.begin(), in_string.begin() + lengths[0]);
-      }
-      {
-        int status;
-        do {
-          status = mysql_next_result(db_handle);
-        } while (0 == status);
-        if (0 < status) {
-          std::cerr<<"Error fetching world data: "<<mysql_error(db_handle)<<"\n";
-        }
-      }
-      //mysql_stmt_fetch() to retrieve rows, and mysql_stmt_free_result() to free the result set.
-      mysql_stmt_free_result(statement_p);
-
-      //Free the prepared result metadata
-      mysql_free_result(prepare_meta_result);
-
-      //Free the statement
-      mysql_stmt_close(statement_p);
-    }
-  }
-  //Cache this result
-  idToIdentifier[id_table] = identifier;
-  //And return it
-  return identifier;
-}
-
 //Fetches the world data from a mysql_stmt_execute command (call after mysql_stmt_execute)
-WorldModel::world_state fetchIndexedWorldData(MYSQL_STMT* stmt, MYSQL* handle) {
-  //TODO FIXME Throw exceptions here when errors occur so that the task pool threads (QueryThread)
+WorldModel::world_state fetchIndexedWorldData(MYSQL_STMT* stmt, MYSQL* handle, IdCache& ids) {
+  //TODO FIXME Throw exceptions here when errors occur so that the pool threads (ConnectionPool)
   //can catch the exceptions and reset the database connection when errors occur
   WorldModel::world_state ws;
   //Expecting a set of these columns:
@@ -1283,16 +1247,8 @@ WorldModel::world_state fetchIndexedWorldData(MYSQL_STMT* stmt, MYSQL* handle) {
     //std::u16string uri(in_uri.begin(), in_uri.begin() + lengths[0]);
     //std::u16string attr(in_attr.begin(), in_attr.begin() + lengths[1]);
     //std::u16string origin(in_origin.begin(), in_origin.begin() + lengths[2]);
-    //Try to cache the conversion from Ids to strings from the different tables
-    //TODO FIXME HERE Cannot call more SQL statements in the middle of this one
-    //Need to call idToName after this
-    /*
-       std::u16string uri(idToName(in_uri_id, "Uris", handle));
-       std::u16string attr(idToName(in_attr_id, "Attributes", handle));
-       std::u16string origin(idToName(in_origin_id, "Origins", handle));
-       std::vector<unsigned char> data(in_data.begin(), in_data.begin() + lengths[3]);
-       ws[uri].push_back(world_model::Attribute{attr, creation, expiration, origin, data});
-       */
+    //Ids missing from the id cache cannot be looked up in the middle of
+    //this statement so the names are found after all rows are fetched
     temp_results.emplace_back(TempWorldData{in_uri_id, in_attr_id, in_origin_id,
         creation, expiration, std::vector<unsigned char>(in_data.begin(), in_data.begin() + lengths[3])});
   }
@@ -1319,9 +1275,9 @@ WorldModel::world_state fetchIndexedWorldData(MYSQL_STMT* stmt, MYSQL* handle) {
   //Now convert the temporary data into full world model data by expanding
   //the id numbers into their corresponding strings
   for (TempWorldData& twd : temp_results) {
-    std::u16string uri(idToName(twd.identifier_id, "Uris", handle));
-    std::u16string attr(idToName(twd.attribute_id, "Attributes", handle));
-    std::u16string origin(idToName(twd.origin_id, "Origins", handle));
+    std::u16string uri(ids.name(IdCache::uri_table, twd.identifier_id, handle));
+    std::u16string attr(ids.name(IdCache::attribute_table, twd.attribute_id, handle));
+    std::u16string origin(ids.name(IdCache::origin_table, twd.origin_id, handle));
     ws[uri].emplace_back(world_model::Attribute{attr, twd.creation, twd.expiration, origin, twd.data});
   }
 
@@ -1330,7 +1286,7 @@ WorldModel::world_state fetchIndexedWorldData(MYSQL_STMT* stmt, MYSQL* handle) {
 
 //Fetches the world data from a mysql_stmt_execute command (call after mysql_stmt_execute)
 WorldModel::world_state MysqlWorldModel::fetchWorldData(MYSQL_STMT* stmt, MYSQL* handle) {
-  //TODO FIXME Throw exceptions here when errors occur so that the task pool threads (QueryThread)
+  //TODO FIXME Throw exceptions here when errors occur so that the pool threads (ConnectionPool)
   //can catch the exceptions and reset the database connection when errors occur
   WorldModel::world_state ws;
   //Expecting a set of these columns:
@@ -1440,34 +1396,30 @@ WorldModel::world_state MysqlWorldModel::fetchWorldData(MYSQL_STMT* stmt, MYSQL*
   return ws;
 }
 
-/**
- * Get the state of the world model after the data from the given time range.
- * Any number of read requests can be simultaneously serviced.
- */
-WorldModel::world_state MysqlWorldModel::_historicSnapshot(const world_model::URI& uri,
-                                    std::vector<std::u16string>& desired_attributes,
-                                    world_model::grail_time start, world_model::grail_time stop,
-                                    MYSQL* handle) {
-  // TODO The start time is not currently used so this is technically non-compliant
-  (void)start;
-  //Return if nothing was requested
-  if (desired_attributes.empty()) {
-    return WorldModel::world_state();
+//Limit a column to the given ids
+static void restrictIds(const std::string& column, std::vector<int64_t>::const_iterator first,
+    std::vector<int64_t>::const_iterator last, std::string& where) {
+  where += column + " IN (";
+  for (auto I = first; I != last; ++I) {
+    if (I != first) {
+      where += ", ";
+    }
+    where += std::to_string(*I);
   }
-  //Return if we cannot get a connection
+  where += ") AND ";
+}
+
+WorldModel::world_state MysqlWorldModel::fetchValues(const std::string& condition,
+    std::vector<world_model::grail_time> times, MYSQL* handle) {
   if (nullptr == handle) {
-    std::cerr<<"Cannot call getSnapshotValue -- connection is null\n";
+    std::cerr<<"Cannot fetch values -- connection is null\n";
     return WorldModel::world_state();
   }
-  //CREATE PROCEDURE getSnapshotValue(uri VARCHAR(170) CHARACTER SET utf16 COLLATE utf16_unicode_ci,
-  //                                 attribute VARCHAR(170) CHARACTER SET utf16 COLLATE utf16_unicode_ci,
-  //                                 origin VARCHAR(170) CHARACTER SET utf16 COLLATE utf16_unicode_ci,
-  //                                 timestamp BIGINT)
-  std::string statement_str = "CALL getSnapshotValue(?, ?, ?, ?);";
+  std::string statement_str = "SELECT idUri, idAttribute, idOrigin, data, createTimestamp, expireTimestamp "
+    "FROM AttributeValues WHERE " + condition + ";";
   MYSQL_STMT* statement_p = mysql_stmt_init(handle);
   if (nullptr == statement_p) {
-    //TODO This should be better at handling an error.
-    std::cerr<<"Error creating statement for historic snapshot.\n";
+    std::cerr<<"Error creating statement to fetch values.\n";
     return WorldModel::world_state();
   }
   if (mysql_stmt_prepare(statement_p, statement_str.c_str(), statement_str.size())) {
@@ -1475,79 +1427,111 @@ WorldModel::world_state MysqlWorldModel::_historicSnapshot(const world_model::UR
     mysql_stmt_close(statement_p);
     return WorldModel::world_state();
   }
-  MYSQL_BIND parameters[4];
-  // TODO(only handling uint8 characters currently, should add support for other character sets
-  std::string char8_uri(uri.begin(), uri.end());
-  memset(parameters, 0, sizeof(parameters));
-  parameters[0].buffer_type = MYSQL_TYPE_STRING;
-  //parameters[0].buffer = (void*)uri.data();
-  parameters[0].buffer = (void*)char8_uri.data();
-  //unsigned long uri_len = uri.size()*2;
-  unsigned long uri_len = char8_uri.size();
-  parameters[0].length = &uri_len;
-  parameters[0].is_unsigned = true;
-  parameters[1].buffer_type = MYSQL_TYPE_STRING;
-  unsigned long attr_len;
-  parameters[1].length = &attr_len;
-  parameters[1].is_unsigned = true;
-  //TODO FIXME Accepting any origin right now
-  std::u16string char8_origin = u".*";
-  parameters[2].buffer_type = MYSQL_TYPE_STRING;
-  parameters[2].buffer = (void*)char8_origin.data();
-  unsigned long origin_len = char8_origin.size();
-  parameters[2].length = &origin_len;
-  parameters[3].buffer_type = MYSQL_TYPE_LONGLONG;
-  parameters[3].is_unsigned = false;
-  parameters[3].buffer = &(stop);
-  WorldModel::world_state result;
+  std::vector<MYSQL_BIND> parameters(times.size());
+  memset(parameters.data(), 0, sizeof(MYSQL_BIND) * parameters.size());
+  for (size_t idx = 0; idx < times.size(); ++idx) {
+    parameters[idx].buffer_type = MYSQL_TYPE_LONGLONG;
+    parameters[idx].buffer = &times[idx];
+  }
+  if (not times.empty() and 0 != mysql_stmt_bind_param(statement_p, parameters.data())) {
+    std::cerr<<"Error binding variables to fetch values.\n";
+    mysql_stmt_close(statement_p);
+    return WorldModel::world_state();
+  }
+  //This also closes the statement
+  return fetchIndexedWorldData(statement_p, handle, ids);
+}
 
-  //Assemble a different regex query depending upon having single or multiple attributes
-  if (1 == desired_attributes.size()) {
-    std::string char8_attr(desired_attributes[0].begin(), desired_attributes[0].end());
-    parameters[1].buffer = (void*)char8_attr.data();
-    attr_len = char8_attr.size();
-    if (0 != mysql_stmt_bind_param(statement_p, parameters)) {
-      //TODO This should be better at handling an error.
-      std::cerr<<"Error binding variables for getSnapshotValues.\n";
-    }
-    else {
-      //Execute the statement in a query thread
-      WorldModel::world_state partial = fetchIndexedWorldData(statement_p, handle);
-      for (auto I : partial) {
-        //Insert new attributes into the world state
-        result[I.first].insert(result[I.first].end(), I.second.begin(), I.second.end());
-      }
-    }
+WorldModel::world_state MysqlWorldModel::fetchMatchingValues(const world_model::URI& uri,
+    std::vector<std::u16string>& desired_attributes, const std::string& condition,
+    std::vector<world_model::grail_time> times, size_t max_rows) {
+  if (not pool) {
+    return WorldModel::world_state();
+  }
+  //Read any names added since the cache was loaded, or all of them if the
+  //load failed, so that no matching URI or attribute is left out
+  std::future<bool> refreshed = pool->submit<bool>([this](MYSQL* handle) {
+        return this->ids.refresh(IdCache::uri_table, handle) and
+               this->ids.refresh(IdCache::attribute_table, handle);});
+  if (not refreshed.get()) {
+    std::cerr<<"Error refreshing ids, new URIs and attributes may be missing from the results.\n";
+  }
+  //Evaluate the patterns against the cached names rather than with REGEXP
+  //on the server so that the values are found through their indexes
+  bool all_uris = false;
+  bool all_attributes = false;
+  std::vector<int64_t> uri_ids = ids.matching(IdCache::uri_table, std::vector<std::u16string>{uri}, all_uris);
+  std::vector<int64_t> attribute_ids = ids.matching(IdCache::attribute_table, desired_attributes, all_attributes);
+  if (uri_ids.empty() or attribute_ids.empty()) {
+    return WorldModel::world_state();
+  }
+  //Long id lists are split over several queries so that no statement nears
+  //the server's max_allowed_packet
+  std::vector<std::string> attribute_conditions;
+  if (all_attributes) {
+    attribute_conditions.push_back("");
   }
   else {
-    //Combine all of the requests into a single regular expression to speed up the search.
-    std::u16string single_expression = u"(" + desired_attributes[0];
-    for (auto I = desired_attributes.begin()+1; I != desired_attributes.end(); ++I) {
-      single_expression += u"|" + *I;
+    for (size_t first = 0; first < attribute_ids.size(); first += max_listed_ids) {
+      size_t last = std::min(first + max_listed_ids, attribute_ids.size());
+      std::string attribute_condition;
+      restrictIds("idAttribute", attribute_ids.begin() + first, attribute_ids.begin() + last, attribute_condition);
+      attribute_conditions.push_back(attribute_condition);
     }
-    single_expression += u")";
+  }
 
-    std::string char8_attr(single_expression.begin(), single_expression.end());
-    parameters[1].buffer = (void*)char8_attr.data();
-    attr_len = char8_attr.size();
-    if (0 != mysql_stmt_bind_param(statement_p, parameters)) {
-      //TODO This should be better at handling an error.
-      std::cerr<<"Error binding variables for getSnapshotValues.\n";
+  //Split the URIs into runs of ids that are queried on separate connections
+  size_t shards = std::min(query_shards, (uri_ids.size() + uris_per_shard - 1) / uris_per_shard);
+  shards = std::max<size_t>(1, std::min(shards, pool->size()));
+  size_t per_shard = (uri_ids.size() + shards - 1) / shards;
+  if (not all_uris) {
+    per_shard = std::min(per_shard, max_listed_ids);
+  }
+  std::vector<std::string> conditions;
+  for (size_t first = 0; first < uri_ids.size(); first += per_shard) {
+    size_t last = std::min(first + per_shard, uri_ids.size());
+    std::string uri_condition;
+    if (all_uris) {
+      //Bound the ids instead of listing them. The first and last shards are
+      //open ended so that they also cover URIs added since the ids were found.
+      if (0 < first) {
+        uri_condition += "idUri > " + std::to_string(uri_ids[first - 1]) + " AND ";
+      }
+      if (last < uri_ids.size()) {
+        uri_condition += "idUri <= " + std::to_string(uri_ids[last - 1]) + " AND ";
+      }
     }
     else {
-      //Execute the statement in a query thread
-      WorldModel::world_state partial = fetchIndexedWorldData(statement_p, handle);
-      for (auto I : partial) {
-        //Insert new attributes into the world state
-        result[I.first].insert(result[I.first].end(), I.second.begin(), I.second.end());
-      }
+      restrictIds("idUri", uri_ids.begin() + first, uri_ids.begin() + last, uri_condition);
+    }
+    for (const std::string& attribute_condition : attribute_conditions) {
+      conditions.push_back(uri_condition + attribute_condition + condition);
     }
   }
 
-  //Deleting the statement is done in the fetchIndexedWorldData funcion
-  //mysql_stmt_close(statement_p);
-
-  //Return all of the results
+  //Run one query per shard at a time. When only the earliest rows are
+  //wanted the result is trimmed after each round so that it stays small.
+  WorldModel::world_state result;
+  for (size_t first = 0; first < conditions.size(); first += shards) {
+    size_t last = std::min(first + shards, conditions.size());
+    std::vector<std::future<WorldModel::world_state>> partials;
+    for (size_t idx = first; idx < last; ++idx) {
+      std::string shard_condition = conditions[idx];
+      partials.push_back(submit([this, shard_condition, times](MYSQL* handle) {
+            return this->fetchValues(shard_condition, times, handle);}));
+    }
+    //A URI may be in several queries so merge their values
+    for (std::future<WorldModel::world_state>& partial : partials) {
+      WorldModel::world_state shard = partial.get();
+      for (auto& I : shard) {
+        std::vector<world_model::Attribute>& attributes = result[I.first];
+        attributes.insert(attributes.end(), I.second.begin(), I.second.end());
+      }
+    }
+    if (0 < max_rows) {
+      keepEarliest(result, max_rows);
+    }
+  }
   return result;
 }
 
@@ -1559,12 +1543,17 @@ WorldModel::world_state MysqlWorldModel::_historicSnapshot(const world_model::UR
 WorldModel::world_state MysqlWorldModel::historicSnapshot(const world_model::URI& uri,
                                     std::vector<std::u16string> desired_attributes,
                                     world_model::grail_time start, world_model::grail_time stop) {
-  std::function<WorldModel::world_state(MYSQL*)> bound_fun = [&](MYSQL* handle){ return this->_historicSnapshot(uri, desired_attributes, start, stop, handle);};
-
-  //Send this task to a query thread
-  WorldModel::world_state result = QueryThread<WorldModel::world_state>::assignTask(bound_fun);
-
-  return result;
+  (void)start;
+  //Return if nothing was requested
+  if (desired_attributes.empty()) {
+    return WorldModel::world_state();
+  }
+  //A stop time of 0 requests the current values
+  if (0 == stop) {
+    return fetchMatchingValues(uri, desired_attributes, "expireTimestamp = 0", {});
+  }
+  return fetchMatchingValues(uri, desired_attributes,
+      "createTimestamp <= ? AND (expireTimestamp = 0 OR expireTimestamp > ?)", {stop, stop});
 }
 
 /*
@@ -1619,102 +1608,15 @@ std::vector<std::vector<int>> _getURIAttributeOrigin(const world_model::URI& uri
  * Get stored data that occurs in a time range.
  * Any number of read requests can be simultaneously serviced.
  */
-WorldModel::world_state MysqlWorldModel::_historicDataInRange(const world_model::URI& uri,
+WorldModel::world_state MysqlWorldModel::historicDataInRange(const world_model::URI& uri,
                                     std::vector<std::u16string>& desired_attributes,
-                                    world_model::grail_time start, world_model::grail_time stop,
-                                    MYSQL* handle) {
-  //Return if we cannot get a connection
-  if (nullptr == handle) {
-    std::cerr<<"Cannot call getRangeValues -- connection is null\n";
-    return WorldModel::world_state();
-  }
-  //CREATE PROCEDURE getRangeValues(uri VARCHAR(170) CHARACTER SET utf16 COLLATE utf16_unicode_ci,
-                                   //attribute VARCHAR(170) CHARACTER SET utf16 COLLATE utf16_unicode_ci,
-                                   //origin VARCHAR(170) CHARACTER SET utf16 COLLATE utf16_unicode_ci,
-                                   //beginTs BIGINT,
-                                   //endTs BIGINT)
-  std::string statement_str = "CALL getRangeValues(?, ?, ?, ?, ?);";
-  MYSQL_STMT* statement_p = mysql_stmt_init(handle);
-  if (nullptr == statement_p) {
-    //TODO This should be better at handling an error.
-    std::cerr<<"Error creating statement for historic snapshot.\n";
-    return WorldModel::world_state();
-  }
-  if (mysql_stmt_prepare(statement_p, statement_str.c_str(), statement_str.size())) {
-    std::cerr<<"Failed to prepare statement: "<<statement_str<<": "<<mysql_error(handle)<<'\n';
+                                    world_model::grail_time start, world_model::grail_time stop) {
+  //Return if nothing was requested
+  if (desired_attributes.empty()) {
     return WorldModel::world_state();
   }
-  MYSQL_BIND parameters[5];
-  std::string char8_uri(uri.begin(), uri.end());
-  memset(parameters, 0, sizeof(parameters));
-  parameters[0].buffer_type = MYSQL_TYPE_STRING;
-  //parameters[0].buffer = (void*)uri.data();
-  parameters[0].buffer = (void*)char8_uri.data();
-  //unsigned long uri_len = uri.size()*2;
-  unsigned long uri_len = char8_uri.size();
-  parameters[0].length = &uri_len;
-  parameters[0].is_unsigned = true;
-  parameters[1].buffer_type = MYSQL_TYPE_STRING;
-  unsigned long attr_len;
-  parameters[1].length = &attr_len;
-  parameters[1].is_unsigned = true;
-  //TODO FIXME Accepting any origin right now
-  std::u16string char8_origin = u".*";
-  parameters[2].buffer_type = MYSQL_TYPE_STRING;
-  parameters[2].buffer = (void*)char8_origin.data();
-  unsigned long origin_len = char8_origin.size();
-  parameters[2].length = &origin_len;
-  parameters[3].buffer_type = MYSQL_TYPE_LONGLONG;
-  parameters[3].is_unsigned = false;
-  parameters[3].buffer = &(start);
-  parameters[4].buffer_type = MYSQL_TYPE_LONGLONG;
-  parameters[4].is_unsigned = false;
-  parameters[4].buffer = &(stop);
-  WorldModel::world_state result;
-  //Assemble a different regex query depending upon having single or multiple attributes
-  if (1 == desired_attributes.size()) {
-    std::string char8_attr(desired_attributes[0].begin(), desired_attributes[0].end());
-    parameters[1].buffer = (void*)char8_attr.data();
-    attr_len = char8_attr.size();
-    if (0 != mysql_stmt_bind_param(statement_p, parameters)) {
-      //TODO This should be better at handling an error.
-      std::cerr<<"Error binding variables for getRangeValues.\n";
-    }
-    else {
-      //Execute the statement in a query thread
-      WorldModel::world_state partial = fetchIndexedWorldData(statement_p, handle);
-      for (auto I : partial) {
-        //Insert new attributes into the world state
-        result[I.first].insert(result[I.first].end(), I.second.begin(), I.second.end());
-      }
-    }
-  }
-  else {
-    //Combine all of the requests into a single regular expression to speed up the search.
-    std::u16string single_expression = u"(" + desired_attributes[0];
-    for (auto I = desired_attributes.begin()+1; I != desired_attributes.end(); ++I) {
-      single_expression += u"|" + *I;
-    }
-    single_expression += u")";
-
-    std::string char8_attr(single_expression.begin(), single_expression.end());
-    parameters[1].buffer = (void*)char8_attr.data();
-    attr_len = char8_attr.size();
-    if (0 != mysql_stmt_bind_param(statement_p, parameters)) {
-      //TODO This should be better at handling an error.
-      std::cerr<<"Error binding variables for getRangeValues.\n";
-    }
-    else {
-      //Execute the statement in a query thread
-      WorldModel::world_state partial = fetchIndexedWorldData(statement_p, handle);
-      for (auto I : partial) {
-        //Insert new attributes into the world state
-        result[I.first].insert(result[I.first].end(), I.second.begin(), I.second.end());
-      }
-    }
-  }
-  //Delete the statement
-  //mysql_stmt_close(statement_p);
+  WorldModel::world_state result = fetchMatchingValues(uri, desired_attributes,
+      "createTimestamp >= ? AND createTimestamp <= ?", {start, stop});
 
   //Sort the returned attributes
   //TODO FIXME Is sorting here faster than in mysql?
@@ -1729,19 +1631,22 @@ WorldModel::world_state MysqlWorldModel::_historicDataInRange(const world_model:
   return result;
 }
 
-WorldModel::world_state MysqlWorldModel::historicDataInRange(const world_model::URI& uri,
+WorldModel::world_state MysqlWorldModel::historicDataPage(const world_model::URI& uri,
                                     std::vector<std::u16string>& desired_attributes,
-                                    world_model::grail_time start, world_model::grail_time stop) {
-  //Return if nothing was requested
+                                    world_model::grail_time start, world_model::grail_time stop,
+                                    size_t max_rows) {
   if (desired_attributes.empty()) {
     return WorldModel::world_state();
   }
-
-  std::function<WorldModel::world_state(MYSQL*)> bound_fun = [&](MYSQL* handle){ return this->_historicDataInRange(uri, desired_attributes, start, stop, handle);};
-
-  //Send this task to a query thread
-  WorldModel::world_state result = QueryThread<WorldModel::world_state>::assignTask(bound_fun);
-
+  //Each query returns its earliest rows and the earliest of those are kept
+  WorldModel::world_state result = fetchMatchingValues(uri, desired_attributes,
+      "createTimestamp >= ? AND createTimestamp <= ? ORDER BY createTimestamp LIMIT " +
+      std::to_string(max_rows), {start, stop}, max_rows);
+  for (std::pair<const world_model::URI, std::vector<world_model::Attribute>>& I : result) {
+    std::sort(I.second.begin(), I.second.end(),
+        [](const world_model::Attribute& a, const world_model::Attribute& b) {
+          return a.creation_date < b.creation_date;});
+  }
   return result;
 }
 
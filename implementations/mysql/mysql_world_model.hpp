@@ -9,12 +9,15 @@
 #ifndef __MYSQL_WORLD_MODEL_HPP__
 #define __MYSQL_WORLD_MODEL_HPP__
 
+#include <future>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <string>
 #include <vector>
 
+#include "id_cache.hpp"
 #include "task_pool.hpp"
 
 #include <mysql/mysql.h>
@@ -35,6 +38,16 @@ class MysqlWorldModel : public WorldModel {
     std::string user;
     std::string password;
 
+    //Connections used by the database tasks
+    std::unique_ptr<ConnectionPool> pool;
+
+    //Names and ids of the Uris, Attributes, and Origins tables
+    IdCache ids;
+
+    ///Queue a database task on the connection pool. With no database the
+    ///task is not run and its result is empty.
+    std::future<world_state> submit(std::function<world_state(MYSQL*)> task);
+
     //Update expiration dates in the database.
     WorldModel::world_state databaseUpdate(world_model::URI& uri,
         std::vector<world_model::Attribute>& to_update, MYSQL* handle);
@@ -43,9 +56,52 @@ class MysqlWorldModel : public WorldModel {
     WorldModel::world_state databaseStore(world_model::URI& uri,
         std::vector<world_model::Attribute>& entries, MYSQL* handle);
 
+    ///Most values staged by one INSERT statement in databaseStoreBatch
+    static constexpr size_t staged_rows_per_statement = 256;
+    ///Bytes of data after which a staging INSERT statement is sent early
+    static constexpr size_t staged_bytes_per_statement = 1 << 20;
+
+    /**
+     * Store the attributes of many URIs in one transaction. The values are
+     * staged with multi-row INSERTs and then stored together by the
+     * applyStagedValues procedure. Falls back to databaseStore for each URI
+     * if the batch cannot be stored.
+     */
+    WorldModel::world_state databaseStoreBatch(
+        std::vector<std::pair<world_model::URI, std::vector<world_model::Attribute>>>& batch, MYSQL* handle);
+
     //Issue a select request to the database
     world_state fetchWorldData(MYSQL_STMT* stmt, MYSQL* handle);
 
+    //Most queries that one historic request is split into
+    size_t query_shards;
+
+    ///Fewest URIs given to each query when a request is split
+    static constexpr size_t uris_per_shard = 64;
+
+    ///Most ids listed in one query so that statements stay small
+    static constexpr size_t max_listed_ids = 1000;
+
+    ///Fetch the values that satisfy the given SQL condition, whose
+    ///parameters are bound to the given times
+    world_state fetchValues(const std::string& condition,
+        std::vector<world_model::grail_time> times, MYSQL* handle);
+
+    /**
+     * Fetch the values of the URIs and attributes that match the given
+     * patterns and the given SQL condition, whose parameters are bound to
+     * the given times. The patterns are matched against the id cache so
+     * that the query names ids instead of matching every name on the server.
+     * The matching URIs are split by id into queries that run on as many
+     * as query_shards connections at a time, and no query lists more than
+     * max_listed_ids ids. The condition ends each query so it may finish
+     * with ORDER BY and LIMIT clauses. If max_rows is not zero then only
+     * the max_rows values with the earliest creation dates are kept.
+     */
+    world_state fetchMatchingValues(const world_model::URI& uri,
+        std::vector<std::u16string>& desired_attributes, const std::string& condition,
+        std::vector<world_model::grail_time> times, size_t max_rows = 0);
+
     MysqlWorldModel& operator=(const MysqlWorldModel&) = delete;
     MysqlWorldModel(const MysqlWorldModel&) = delete;
 
@@ -64,24 +120,26 @@ class MysqlWorldModel : public WorldModel {
     WorldModel::world_state _deleteURIAttributes(world_model::URI& uri,
         std::vector<world_model::Attribute>& entries, MYSQL* handle);
 
-    WorldModel::world_state _historicSnapshot(const world_model::URI& uri,
-        std::vector<std::u16string>& desired_attributes,
-        world_model::grail_time start, world_model::grail_time stop, MYSQL* handle);
-
-    WorldModel::world_state _historicDataInRange(const world_model::URI& uri,
-        std::vector<std::u16string>& desired_attributes,
-        world_model::grail_time start, world_model::grail_time stop, MYSQL* handle);
-
   public:
+    ///Queries a historic request is split into if the configuration does not give a number
+    static constexpr size_t default_query_shards = 4;
 
     static void setupMySQL(std::string directory, MYSQL* db_handle);
 
+    ///Add the tables and procedures that a database created by an older
+    ///version of the world model is missing
+    static void upgradeMySQL(std::string directory, MYSQL* db_handle);
+
     /*
      * Create an instance of the world model and open the database
      * with the given database name logging in with the given user
-     * name and password.
+     * name and password. Database tasks share the given number of
+     * connections and historic requests are split into at most
+     * query_shards queries.
      */
-    MysqlWorldModel(std::string db_name, std::string user, std::string password);
+    MysqlWorldModel(std::string db_name, std::string user, std::string password,
+        size_t connections = ConnectionPool::default_connections,
+        size_t query_shards = default_query_shards);
     ~MysqlWorldModel();
 
     /*
@@ -138,6 +196,15 @@ class MysqlWorldModel : public WorldModel {
                                     std::vector<std::u16string>& desired_attributes,
                                     world_model::grail_time start, world_model::grail_time stop);
 
+    /**
+     * Get the earliest data in a time range, at most max_rows attributes.
+     * Each query only returns the rows that could be kept.
+     */
+    world_state historicDataPage(const world_model::URI& uri,
+                                 std::vector<std::u16string>& desired_attributes,
+                                 world_model::grail_time start, world_model::grail_time stop,
+                                 size_t max_rows);
+
 };
 
 #endif
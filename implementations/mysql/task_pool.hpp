@@ -19,269 +19,182 @@
  */
 
 /*******************************************************************************
- * A thread pool for packaged tasks.
+ * A fixed size pool of threads, each with its own connection to the mysql
+ * server, that run tasks from a shared queue.
+ * Submitting a task returns a future for its result so that callers can
+ * queue several tasks before waiting for any of them. The queue is bounded
+ * so that a burst of requests waits for a connection rather than opening
+ * more of them.
  ******************************************************************************/
 
 #ifndef __TASK_POOL__
 #define __TASK_POOL__
 
-#include <algorithm>
-#include <atomic>
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <mutex>
-#include <vector>
-#include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <mysql/mysql.h>
-//#include "mysql_world_model.hpp"
 
-template<typename T>
-class QueryThread {
-  private:
-    //Memory for the threads
-    static std::vector<QueryThread*> memory_pool;
-    //The threads themselves
-    static std::vector<std::thread> thread_pool;
-    static std::mutex vector_mutex;
-    static std::mutex mysql_mutex;
-    static std::string db_name;
-    static std::string user;
-    static std::string password;
-    static MYSQL* mysql;
-    //TODO FIXME Think I am overdoing synchronization
-    std::mutex read_mutex;
-    std::mutex write_mutex;
-    std::mutex exec_mutex;
-    std::mutex delete_mutex;
-    std::function<T(MYSQL*)> task;
-    T data;
-    //Used to indicate when a new task is assigned to this thread
-    std::condition_variable exec_cond;
-    std::condition_variable write_cond;
-    std::condition_variable del_cond;
-    std::atomic_bool cancelled;
-    std::atomic_bool running;
-    std::atomic_bool complete;
-    MYSQL* handle;
+class ConnectionPool {
   public:
+    ///Connections used if the configuration does not give a number
+    static constexpr size_t default_connections = 8;
+    ///Tasks that may wait in the queue for each connection before submit blocks
+    static constexpr size_t queued_per_connection = 16;
+    ///Connections idle for this many seconds are checked before their next task
+    static constexpr int ping_seconds = 30;
 
-    QueryThread(std::function<T(MYSQL*)>& task) : task(task) {
-      cancelled = false;
-      running = false;
-      complete = false;
-    };
-
-    static void setDBInfo(std::string& db_name, std::string& user, std::string& password, MYSQL* mysql) {
-      QueryThread::db_name = db_name;
-      QueryThread::user = user;
-      QueryThread::password = password;
-      QueryThread::mysql = mysql;
-    }
-
-    /**
-     * Factory to make a QueryThread and return it.
-     * The query thread will create its own connection to the mysql server,
-     * using the mysql_mutex to lock this action, and will initialize
-     * itself to handle the given task.
-     */
-    static QueryThread* genQueryThread(std::function<T(MYSQL*)>& task) {
-      std::unique_lock<std::mutex> lck(vector_mutex);
-      memory_pool.push_back(new QueryThread(task));
-      //Lock the read mutex so that the caller can immediately execute the task
-      //The lock protects the data variable until the task completes and the data is read.
-      //std::cerr<<"Locking read mutex!\n";
-      memory_pool.back()->read_mutex.lock();
-      //std::cerr<<"Making thread!\n";
-      thread_pool.emplace_back(std::thread(std::mem_fun(&QueryThread<T>::run), memory_pool.back()));
-      thread_pool.back().detach();
-      std::cerr<<"There are now "<<thread_pool.size()<<" threads.\n";
-      return memory_pool.back();
-    }
-
-    //Clean up all threads and objects
-    static void destroyThreads() {
-      //std::cerr<<"Trying to destroy threads!\n";
-      //To do away with all threads, cancel, then join the threads,
-      //then delete the QueryThread objects
-      for (QueryThread* mem : memory_pool) {
-        mem->cancel();
-        //Wait for the thread to die (they were detached and thus cannot be joined)
-        std::unique_lock<std::mutex> lck(mem->delete_mutex);
-        while (not mem->complete) {
-          mem->del_cond.wait(lck);
-        }
+  private:
+    std::string db_name;
+    std::string user;
+    std::string password;
+
+    //Tasks waiting for a connection
+    std::deque<std::function<void(MYSQL*)>> tasks;
+    size_t max_queued;
+    std::mutex queue_mutex;
+    //Signalled when a task is queued or the pool is stopping
+    std::condition_variable task_ready;
+    //Signalled when a queued task is taken
+    std::condition_variable space_ready;
+    bool stopping;
+
+    std::vector<std::thread> workers;
+
+    ///Open a connection to the world model's database, or return nullptr
+    MYSQL* connect() {
+      MYSQL* handle = mysql_init(NULL);
+      if (nullptr == handle) {
+        std::cerr<<"Error connecting to mysql.\n";
+        return nullptr;
+      }
+      //Multiple statements also allow the multiple results of stored procedures
+      if (NULL == mysql_real_connect(handle, "localhost", user.c_str(), password.c_str(),
+            NULL, 0, NULL, CLIENT_MULTI_STATEMENTS)) {
+        std::cerr<<"Error connecting to database: "<<mysql_error(handle)<<'\n';
+        mysql_close(handle);
+        return nullptr;
       }
-      for (QueryThread* mem : memory_pool) {
-        delete mem;
+      //Set the character collation and switch to the database
+      if (mysql_query(handle, "set collation_connection = utf16_unicode_ci;")) {
+        std::cerr<<"Error setting collate to utf16.\n";
+        mysql_close(handle);
+        return nullptr;
+      }
+      if (mysql_select_db(handle, db_name.c_str())) {
+        std::cerr<<"Error switching to database for world model: "<<mysql_error(handle)<<"\n";
+        mysql_close(handle);
+        return nullptr;
       }
-      memory_pool.clear();
-      thread_pool.clear();
+      return handle;
     }
 
-    static size_t num_threads() {
-      return memory_pool.size();
+    ///Check a connection, replacing it if it has failed
+    void checkConnection(MYSQL*& handle) {
+      if (nullptr != handle and 0 == mysql_ping(handle)) {
+        return;
+      }
+      if (nullptr != handle) {
+        std::cerr<<"Lost connection to mysql: "<<mysql_error(handle)<<". Reconnecting.\n";
+        mysql_close(handle);
+      }
+      handle = connect();
     }
 
-    static T assignTask(std::function<T(MYSQL*)>& task) {
-      //Find the first available thread and assign this task to it
-      typename std::vector<QueryThread*>::iterator available = memory_pool.end();
-      QueryThread* available_p = nullptr;
-      {
-        std::unique_lock<std::mutex> lck(vector_mutex);
-        available = std::find_if(memory_pool.begin(), memory_pool.end(),
-            [&](QueryThread* qt) { return qt->read_mutex.try_lock();});
-        if (memory_pool.end() != available) {
-          available_p = *available;
+    void run() {
+      mysql_thread_init();
+      MYSQL* handle = connect();
+      auto last_used = std::chrono::steady_clock::now();
+      while (true) {
+        std::function<void(MYSQL*)> task;
+        {
+          std::unique_lock<std::mutex> lck(queue_mutex);
+          task_ready.wait(lck, [&]() { return stopping or not tasks.empty();});
+          //Finish queued tasks before stopping
+          if (tasks.empty()) {
+            break;
+          }
+          task = std::move(tasks.front());
+          tasks.pop_front();
         }
-      }
-      //If no thread was available create a new one
-      if (nullptr == available_p) {
-        //std::cerr<<"Creating new thread!\n";
-        //The read mutex starts off locked
-        QueryThread* qt(genQueryThread(task));
-        if (nullptr == qt) {
-          //TODO FIXME Probably throw an error here
-          return T();
+        space_ready.notify_one();
+        //Check the connection if it has been idle or the last task failed.
+        //Tasks report an error if the connection could not be restored.
+        auto now = std::chrono::steady_clock::now();
+        if (nullptr == handle or now - last_used > std::chrono::seconds(ping_seconds) or 0 != mysql_errno(handle)) {
+          checkConnection(handle);
         }
-        //std::cerr<<"Query object created!\n";
-        T result = qt->execute(task);
-        //std::cerr<<"Result obtained!\n";
-        qt->read_mutex.unlock();
-        return result;
+        task(handle);
+        last_used = std::chrono::steady_clock::now();
       }
-      else {
-        //std::cerr<<"Using existing thread!\n";
-        T result = available_p->execute(task);
-        available_p->read_mutex.unlock();
-        return result;
+      if (nullptr != handle) {
+        mysql_close(handle);
       }
+      //Release mysql resources bound to this thread
+      mysql_thread_end();
     }
 
-    ~QueryThread() {
-    }
-
-
-    //To do away with all threads, cancel, then join the threads,
-    //then delete the QueryThread objects
-    void cancel() {
-      cancelled = true;
-      //Wake up the thread so that it will exit
-      exec_cond.notify_one();
+  public:
+    ConnectionPool(const std::string& db_name, const std::string& user, const std::string& password,
+        size_t connections = default_connections) :
+      db_name(db_name), user(user), password(password), stopping(false) {
+      if (0 == connections) {
+        connections = 1;
+      }
+      max_queued = connections * queued_per_connection;
+      for (size_t i = 0; i < connections; ++i) {
+        workers.push_back(std::thread(&ConnectionPool::run, this));
+      }
+      std::cerr<<"Using "<<connections<<" connections to mysql.\n";
     }
 
-    //Add a new task to execute
-    T execute(std::function<T(MYSQL*)>& task) {
-      //std::cerr<<"Copying task!\n";
-      //The read_mutex should be locked to make sure that only one thread
-      //enters this function at a time.
-      this->task = task;
-      //std::cerr<<"Notifying!\n";
-      //Notify the thread that we are running and wake it
-      running = true;
+    ///Finish any queued tasks and close the connections
+    ~ConnectionPool() {
       {
-        std::unique_lock<std::mutex> lck(exec_mutex);
-        exec_cond.notify_one();
+        std::unique_lock<std::mutex> lck(queue_mutex);
+        stopping = true;
       }
-      //std::this_thread::yield();
-      //If we obtain this lock then the thread has completed execution
-      //std::cerr<<"Locking write mutex!\n";
-      std::unique_lock<std::mutex> lck(write_mutex);
-      //std::cerr<<"Waiting for write cond!\n";
-      //Notify the thread to execute and then wait for a result
-      while (running) {
-        write_cond.wait(lck);
-        //write_cond.wait_for(lck, std::chrono::milliseconds(50));
+      task_ready.notify_all();
+      for (std::thread& worker : workers) {
+        worker.join();
       }
-      return data;
     }
 
-    void run() {
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+    ConnectionPool(const ConnectionPool&) = delete;
+
+    size_t size() const {
+      return workers.size();
+    }
+
+    /**
+     * Queue a task to run on the next free connection and return a future
+     * for its result. Blocks while the queue is full. The connection given
+     * to the task is nullptr if the server cannot be reached.
+     */
+    template<typename T>
+    std::future<T> submit(std::function<T(MYSQL*)> task) {
+      //Packaged tasks cannot be copied so the queue holds a shared one
+      std::shared_ptr<std::packaged_task<T(MYSQL*)>> packaged =
+        std::make_shared<std::packaged_task<T(MYSQL*)>>(task);
+      std::future<T> result = packaged->get_future();
       {
-        std::unique_lock<std::mutex> lck(mysql_mutex);
-        //mysql_thread_init();
-        //Need to make a new connection.
-        handle = mysql_init(NULL);
-        if (NULL == handle) {
-          std::cerr<<"Error connecting to mysql: "<<mysql_error(handle)<<'\n';
-        }
-        else {
-          //Enable multiple statement in a single string sent to mysql
-          if (NULL == mysql_real_connect(handle,"localhost", user.c_str(), password.c_str(),
-                NULL, 0, NULL,CLIENT_MULTI_STATEMENTS)) {
-            std::cerr<<"Error connecting to database: "<<mysql_error(handle)<<'\n';
-            mysql_close(handle);
-            handle = nullptr;
-          }
-          else {
-            //Set the character collation
-            {
-              std::string statement_str = "set collation_connection = utf16_unicode_ci;";
-              if (mysql_query(handle, statement_str.c_str())) {
-                std::cerr<<"Error setting collate to utf16.\n";
-                mysql_close(handle);
-                handle = nullptr;
-              }
-            }
-            //Now try to switch to the database
-            if (mysql_select_db(handle, db_name.c_str())) {
-              std::cerr<<"Error switching to database for world model: "<<mysql_error(handle)<<"\n";
-              mysql_close(handle);
-              handle = nullptr;
-            }
-          }
-        }
-      }
-      while (handle != nullptr and not cancelled) {
-        //std::cerr<<"Thread waiting for task!\n";
-        //Wait for a new task
-        {
-          //std::cerr<<"Locking exec mutex!\n";
-          std::unique_lock<std::mutex> lck(exec_mutex);
-          //std::cerr<<"Waiting on exec cond!\n";
-          //Waiting until a task is running
-          while (not (running or cancelled)) {
-            exec_cond.wait(lck);
-            //exec_cond.wait_for(lck, std::chrono::milliseconds(50));
-          }
-        }
-        if (not cancelled) {
-          //std::cerr<<"Running task!\n";
-          //Execute the new task
-          data = task(handle);
-        }
-        running = false;
-        std::unique_lock<std::mutex> lck(write_mutex);
-        write_cond.notify_one();
-        //std::this_thread::yield();
-        //std::cerr<<"Looping!\n";
+        std::unique_lock<std::mutex> lck(queue_mutex);
+        space_ready.wait(lck, [&]() { return tasks.size() < max_queued;});
+        tasks.push_back([packaged](MYSQL* handle) { (*packaged)(handle);});
       }
-      std::unique_lock<std::mutex> lck(delete_mutex);
-      //Release mysql resources bound to this thread
-      mysql_thread_end();
-      if (handle != nullptr) {
-        mysql_close(handle);
-      }
-      complete = true;
-      del_cond.notify_one();
-      //std::notify_all_at_thread_exit(del_cond, std::move(lck));
+      task_ready.notify_one();
+      return result;
     }
 };
 
-//Memory for the threads
-template<typename T> std::vector<QueryThread<T>*> QueryThread<T>::memory_pool;
-//The threads themselves
-template<typename T> std::vector<std::thread> QueryThread<T>::thread_pool;
-template<typename T> std::mutex QueryThread<T>::vector_mutex;
-template<typename T> std::mutex QueryThread<T>::mysql_mutex;
-template<typename T> std::string QueryThread<T>::db_name;
-template<typename T> std::string QueryThread<T>::user;
-template<typename T> std::string QueryThread<T>::password;
-template<typename T> MYSQL* QueryThread<T>::mysql;
-
 #endif
-
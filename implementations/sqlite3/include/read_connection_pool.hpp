@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A pool of read only sqlite3 connections for historic queries.
+ * In WAL mode readers on their own connections do not wait for the writer or
+ * for each other. Each connection has its own REGEXP function and statement
+ * cache and is lent to a single thread at a time. Connections are opened as
+ * they are needed, up to a maximum.
+ ******************************************************************************/
+
+#ifndef __READ_CONNECTION_POOL_HPP__
+#define __READ_CONNECTION_POOL_HPP__
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+#include <statement_cache.hpp>
+
+class ReadConnectionPool {
+  private:
+    struct ReadConnection {
+      sqlite3* db_handle;
+      std::unique_ptr<StatementCache> statements;
+      ReadConnection(sqlite3* db_handle);
+      ~ReadConnection();
+    };
+
+  public:
+    /**
+     * A connection borrowed from the pool. It returns to the pool when this
+     * object is destroyed. If no connection could be opened the
+     * connection is invalid and the caller should use another.
+     */
+    class Connection {
+      private:
+        ReadConnectionPool* pool;
+        ReadConnection* conn;
+
+        Connection& operator=(const Connection&) = delete;
+        Connection(const Connection&) = delete;
+
+      public:
+        Connection(ReadConnectionPool* pool, ReadConnection* conn);
+        Connection(Connection&& other);
+        ~Connection();
+
+        bool valid() const { return NULL != conn; }
+        sqlite3* handle() { return conn->db_handle; }
+        StatementCache& statements() { return *conn->statements; }
+    };
+
+  private:
+    std::string db_name;
+    size_t max_connections;
+
+    //Every open connection and the ones that are not lent out
+    std::vector<std::unique_ptr<ReadConnection>> connections;
+    std::vector<ReadConnection*> idle;
+    std::mutex pool_mutex;
+    std::condition_variable returned;
+
+    friend class Connection;
+    void release(ReadConnection* conn);
+
+    ///Open a new read only connection, or return NULL on failure
+    ReadConnection* open();
+
+    ReadConnectionPool& operator=(const ReadConnectionPool&) = delete;
+    ReadConnectionPool(const ReadConnectionPool&) = delete;
+
+  public:
+    /**
+     * Open read connections to the given database file. By default up to one
+     * connection is opened for each core, with a minimum of two.
+     */
+    ReadConnectionPool(const std::string& db_name, size_t max_connections = 0);
+
+    ///Closes every connection. No connection may still be borrowed.
+    ~ReadConnectionPool();
+
+    ///Borrow a connection, waiting for one to return if all are in use
+    Connection get();
+
+    ///Number of open connections
+    size_t size();
+};
+
+#endif //ifndef __READ_CONNECTION_POOL_HPP__
+
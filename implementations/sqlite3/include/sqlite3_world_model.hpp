@@ -9,7 +9,9 @@
 #ifndef __SQLITE3_WORLD_MODEL_HPP__
 #define __SQLITE3_WORLD_MODEL_HPP__
 
+#include <atomic>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <string>
@@ -18,7 +20,10 @@
 
 #include <sqlite3.h>
 
+#include <read_connection_pool.hpp>
 #include <semaphore.hpp>
+#include <statement_cache.hpp>
+#include <write_journal.hpp>
 #include <world_model.hpp>
 #include <standing_query.hpp>
 
@@ -35,6 +40,117 @@ class SQLite3WorldModel : public WorldModel {
     //Semaphore db_access_control;
     sqlite3 *db_handle;
 
+    //Prepared statements for db_handle, reused across calls
+    std::unique_ptr<StatementCache> statements;
+
+    //Database writes are applied in batches by the journal's writer thread
+    //so the database trails the current state by a bounded amount.
+    std::unique_ptr<WriteJournal> journal;
+
+    //Read only connections for historic queries. db_handle is kept for the
+    //journal's writes and the lookups made while inserting.
+    std::unique_ptr<ReadConnectionPool> readers;
+
+    /*
+     * URIs, attribute names, and origins are stored once in the uris, names,
+     * and origins tables and the attributes and current tables refer to
+     * them by id.
+     */
+    enum Dictionary {uri_dictionary = 0, name_dictionary = 1, origin_dictionary = 2};
+
+    //Ids of values already in the dictionary tables
+    std::map<std::u16string, sqlite3_int64> dictionary_ids[3];
+    std::mutex dictionary_mutex;
+
+    ///Return the id of a value in a dictionary table, adding the value if needed
+    sqlite3_int64 dictionaryID(Dictionary dict, const std::u16string& value);
+
+    ///Find the id of a value already in a dictionary table without adding it
+    bool findDictionaryID(Dictionary dict, const std::u16string& value, sqlite3_int64& id);
+
+    /*
+     * Checkpoints record the current version of every attribute at regular
+     * times so that historic snapshots only replay the history since the
+     * nearest checkpoint instead of the entire history.
+     */
+    std::atomic<world_model::grail_time> checkpoint_interval;
+    std::atomic<size_t> checkpoint_retention;
+    //Time to take the next periodic checkpoint
+    std::atomic<world_model::grail_time> next_checkpoint;
+    //Time of the latest checkpoint, only used on the journal's writer thread
+    world_model::grail_time latest_checkpoint;
+
+    ///Time of the latest checkpoint before the given time
+    world_model::grail_time latestCheckpoint(world_model::grail_time before);
+
+    ///Record the state at the given time. Called on the journal's writer thread.
+    void createCheckpoint(world_model::grail_time time);
+
+    ///Remove checkpoints at or after a changed time. Called on the journal's writer thread.
+    void invalidateCheckpoints(world_model::grail_time time);
+
+    //Tables of each partition of the history by partition number, only used
+    //on the journal's writer thread
+    std::map<int64_t, std::string> partitions;
+
+    ///Return the table for values created at the given time, creating it if needed
+    const std::string& partitionFor(world_model::grail_time creation);
+
+    ///Every table holding history. Called on the journal's writer thread.
+    std::vector<std::string> historyTables();
+
+    /*
+     * Retention rules limit how long the history of matching attributes is
+     * kept and thin out their older history.
+     */
+    struct RetentionRule {
+      std::u16string name_pattern;
+      world_model::grail_time keep_for;
+      world_model::grail_time downsample_after;
+      world_model::grail_time downsample_interval;
+    };
+    std::vector<RetentionRule> retention_rules;
+    std::mutex retention_mutex;
+    std::atomic<bool> has_retention;
+    //Time to apply the retention rules next
+    std::atomic<world_model::grail_time> next_retention;
+    //Time that the rules were last applied to each partition, only used on
+    //the journal's writer thread
+    std::map<int64_t, world_model::grail_time> retained_at;
+
+    ///Apply the retention rules at the given time. Called on the journal's writer thread.
+    void retainHistory(world_model::grail_time now);
+
+    ///Remove the history of the given names from a partition, dropping it if nothing else is left
+    void dropHistory(int64_t partition, const std::string& name_ids);
+
+    ///Keep the first value of the given names in each interval of a partition
+    void downsampleHistory(const std::string& table, const std::string& name_ids,
+        world_model::grail_time interval);
+
+    /*
+     * An image of the current state is saved next to the database. The
+     * state_image table holds the watermark of the image while nothing has
+     * been written since it was saved, so a start with a matching image can
+     * load it instead of the current table.
+     */
+    std::string image_name;
+    //Watermark of the last image, so that each image has a new watermark
+    std::atomic<int64_t> last_watermark;
+    //True while the state_image table has a row, only used on the journal's writer thread
+    bool image_recorded;
+
+    ///Mark the image as out of date. Called on the journal's writer thread.
+    void forgetImage();
+
+    ///Mark the image with this watermark as current. Called on the journal's writer thread.
+    void recordImage(int64_t watermark);
+
+    ///Create the tables and indexes of the current schema in a new database
+    bool createSchema();
+
+    ///Move the data of a database from the layout without id tables
+    bool migrateSchema();
 
     //Update expiration dates in the database.
     void databaseUpdate(world_model::URI uri, std::vector<world_model::Attribute>& entries);
@@ -45,13 +161,151 @@ class SQLite3WorldModel : public WorldModel {
     //Store attributes in the database.
     void databaseStore(world_model::URI uri, std::vector<world_model::Attribute>& entries);
 
-    //Issue a select request to the database
+    /**
+     * Find the neighbors of an entry older than the recent history in the
+     * database, setting the entry's expiration date and adding the entry
+     * that it expires to to_expire. This is only called by the journal so
+     * that it cannot race with other writes of the same attribute.
+     */
+    void spliceFromDatabase(const world_model::URI& uri, world_model::Attribute& entry,
+        std::vector<world_model::Attribute>& to_expire);
+
+    //Issue a select request to the database. The caller keeps ownership of the statement.
     world_state fetchWorldData(sqlite3_stmt* statement_p);
 
+    ///Read the values in a time range, at most limit per batch of partitions
+    ///or every value if the limit is negative
+    world_state rangeData(const world_model::URI& uri, std::vector<std::u16string>& desired_attributes,
+        world_model::grail_time start, world_model::grail_time stop, sqlite3_int64 limit);
+
     SQLite3WorldModel& operator=(const SQLite3WorldModel&) = delete;
     SQLite3WorldModel(const SQLite3WorldModel&) = delete;
 
   public:
+    ///Version of the database layout, stored in the database's user_version
+    static const int schema_version = 3;
+
+    /**
+     * History is stored in one table for each partition_span of creation
+     * dates so that queries only read the tables of their time range and
+     * old history can be dropped a table at a time. The attributes table
+     * holds history from before partitioning and current values kept when
+     * their partition is dropped, so it is part of every time range.
+     */
+    struct Partition {
+      std::string table;
+      ///The table holds values created in [start, end)
+      world_model::grail_time start;
+      world_model::grail_time end;
+    };
+    ///Each partition holds a day of history
+    static const world_model::grail_time partition_span = 86400000;
+
+    ///Name of the table of a partition
+    static std::string partitionTable(int64_t partition);
+
+    /*
+     * SQL used by historic queries and out of order inserts. These are public
+     * so that their query plans can be checked.
+     */
+    /**
+     * Latest values up to a time, ?1 time of the checkpoint to start from,
+     * ?2 stop, ?3 URI pattern, ?4 name pattern, then the lower and upper
+     * bounds of the URIs (?5, ?6) and names (?7, ?8) that can match the
+     * patterns. The checkpoint's versions are read from the checkpointed
+     * partitions and the history since then from the recent ones.
+     */
+    static std::string snapshotQuery(const std::vector<Partition>& checkpointed,
+        const std::vector<Partition>& recent);
+    /**
+     * Values in a time range, ?1 URI pattern, ?2 start, ?3 stop, then name
+     * patterns, the bounds of the URIs, the bounds of each name pattern,
+     * and the most rows to return
+     */
+    static std::string rangeQuery(size_t num_attributes, const std::vector<Partition>& partitions);
+    /**
+     * The value of an attribute in a table created just before (or just
+     * after) a time, ?1 time, ?2 URI id, ?3 name id, ?4 origin id
+     */
+    static std::string neighborQuery(bool before, const std::string& table);
+    /**
+     * Set an expiration date in a table, ?1 expiration, ?2 URI id,
+     * ?3 name id, ?4 origin id, ?5 creation
+     */
+    static std::string expirationQuery(const std::string& table);
+    ///Record the versions current at ?1 starting from the checkpoint at ?2
+    static std::string checkpointQuery(const std::vector<Partition>& checkpointed,
+        const std::vector<Partition>& recent);
+
+    ///Checkpoint every hour and keep a day of checkpoints by default
+    static const world_model::grail_time default_checkpoint_interval = 3600000;
+    static const size_t default_checkpoint_retention = 24;
+    /**
+     * Periodic checkpoints record the state this long before the current
+     * time so that slightly late data does not invalidate them.
+     */
+    static const world_model::grail_time checkpoint_lag = 60000;
+
+    /**
+     * Set the time between periodic checkpoints, in milliseconds, and the
+     * number of checkpoints to keep. An interval of 0 disables periodic
+     * checkpoints.
+     */
+    void setCheckpointPolicy(world_model::grail_time interval, size_t retention);
+
+    /**
+     * Keep the history of attributes whose names match the pattern for
+     * keep_for milliseconds and keep only the first value in each
+     * downsample_interval of their history once it is older than
+     * downsample_after. A keep_for or downsample_interval of 0 turns that
+     * part of the rule off. The first rule set for a matching pattern
+     * applies to each name and setting a pattern again replaces its rule.
+     * History is removed by creation date, except that current values are
+     * always kept.
+     */
+    void setRetentionPolicy(const std::u16string& name_pattern, world_model::grail_time keep_for,
+        world_model::grail_time downsample_after = 0, world_model::grail_time downsample_interval = 0);
+
+    ///Retention rules are applied hourly as data arrives
+    static const world_model::grail_time retention_interval = 3600000;
+
+    /**
+     * Apply the retention rules as of the given time. This is done by the
+     * journal after earlier writes.
+     */
+    void applyRetention(world_model::grail_time now);
+
+    /**
+     * Record the state of the world model at the given time in a checkpoint.
+     * The checkpoint is written by the journal after earlier writes.
+     * Checkpoints are discarded if data before their time is stored later.
+     */
+    void checkpoint(world_model::grail_time time);
+
+    /**
+     * Save an image of the current state to the database's name with a
+     * .state suffix. The image is only used if nothing is written to the
+     * database after it.
+     */
+    bool saveStateImage();
+
+    ///Return the detail lines of EXPLAIN QUERY PLAN for a statement
+    std::vector<std::string> queryPlan(const std::string& statement);
+
+    ///Hits and misses of the prepared statement cache
+    StatementCache::Statistics statementStatistics();
+
+    /**
+     * Wait until every write made before this call has been committed to
+     * the database. Historic queries do this automatically.
+     */
+    void sync();
+
+    ///Number of writes committed and the transactions used to commit them
+    WriteJournal::Statistics journalStatistics();
+
+    ///Number of read connections opened for historic queries
+    size_t readConnections();
 
     /*
      * Create an instance of the world model and open the database
@@ -115,6 +369,15 @@ class SQLite3WorldModel : public WorldModel {
                                     std::vector<std::u16string>& desired_attributes,
                                     world_model::grail_time start, world_model::grail_time stop);
 
+    /**
+     * Get the earliest data in a time range, at most max_rows attributes.
+     * Only the returned rows are read from each batch of partitions.
+     */
+    world_state historicDataPage(const world_model::URI& uri,
+                                 std::vector<std::u16string>& desired_attributes,
+                                 world_model::grail_time start, world_model::grail_time stop,
+                                 size_t max_rows);
+
 };
 
 #endif
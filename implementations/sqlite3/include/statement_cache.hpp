@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A cache of prepared statements for a single sqlite3 connection.
+ * Statements are keyed by their SQL text, so statements with different
+ * numbers of parameters (such as a range query over a different number of
+ * attributes) are cached separately. A statement is lent to one caller at a
+ * time and is reset and has its bindings cleared when it is returned.
+ ******************************************************************************/
+
+#ifndef __STATEMENT_CACHE_HPP__
+#define __STATEMENT_CACHE_HPP__
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <sqlite3.h>
+
+class StatementCache {
+  public:
+    struct Statistics {
+      ///Statements taken from the cache
+      uint64_t hits;
+      ///Statements that had to be prepared
+      uint64_t misses;
+      ///Idle statements finalized because the cache was full
+      uint64_t evictions;
+      ///Statements currently waiting in the cache
+      size_t cached;
+    };
+
+    /**
+     * A statement borrowed from the cache. The statement returns to the cache
+     * when this object is destroyed so it must not outlive the cache.
+     */
+    class Statement {
+      private:
+        StatementCache* cache;
+        std::string sql;
+        sqlite3_stmt* statement_p;
+
+        Statement& operator=(const Statement&) = delete;
+        Statement(const Statement&) = delete;
+
+      public:
+        Statement(StatementCache* cache, const std::string& sql, sqlite3_stmt* statement_p);
+        Statement(Statement&& other);
+        ~Statement();
+
+        ///The prepared statement, or NULL if the SQL could not be prepared
+        sqlite3_stmt* get() { return statement_p; }
+        operator sqlite3_stmt*() { return statement_p; }
+    };
+
+  private:
+    sqlite3* db_handle;
+    //Most statements that will be kept. When a returned statement would
+    //pass this the least recently returned idle statement is finalized.
+    size_t capacity;
+
+    //Idle statements, most recently returned first
+    typedef std::list<std::pair<std::string, sqlite3_stmt*>> IdleList;
+    IdleList recent;
+    //Idle statements for each SQL string. A statement with the same SQL is
+    //prepared again when every cached copy is already lent out.
+    std::multimap<std::string, IdleList::iterator> idle;
+    Statistics stats;
+    std::mutex cache_mutex;
+
+    friend class Statement;
+    void release(const std::string& sql, sqlite3_stmt* statement_p);
+
+    StatementCache& operator=(const StatementCache&) = delete;
+    StatementCache(const StatementCache&) = delete;
+
+  public:
+    ///Cache statements for the given connection
+    StatementCache(sqlite3* db_handle, size_t capacity = 128);
+
+    ///Finalizes the cached statements. Destroy this before closing the connection.
+    ~StatementCache();
+
+    ///Borrow a statement for the given SQL, preparing it if needed
+    Statement get(const std::string& sql);
+
+    Statistics statistics();
+};
+
+#endif //ifndef __STATEMENT_CACHE_HPP__
+
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A write-behind journal for an sqlite3 connection. Database writes are
+ * queued and a single writer thread applies them in order, grouping every
+ * write that is waiting into one transaction. A transaction is committed
+ * once enough writes are waiting or the oldest write has waited long enough.
+ * Callers that need their writes on disk can wait for them with sync.
+ ******************************************************************************/
+
+#ifndef __WRITE_JOURNAL_HPP__
+#define __WRITE_JOURNAL_HPP__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sqlite3.h>
+
+class WriteJournal {
+  public:
+    ///A database write. Runs on the writer thread inside a transaction.
+    typedef std::function<void()> Operation;
+
+    struct Statistics {
+      ///Operations that have been committed
+      uint64_t operations;
+      ///Transactions used to commit them
+      uint64_t transactions;
+      ///Operations waiting to be written
+      size_t pending;
+    };
+
+  private:
+    sqlite3* db_handle;
+    //Commit once this many operations are waiting
+    size_t batch_size;
+    //Commit once the oldest waiting operation is this old
+    std::chrono::milliseconds max_delay;
+    //Calls to append block while this many operations are waiting
+    size_t max_pending;
+
+    std::vector<Operation> pending;
+    //Arrival time of the oldest pending operation
+    std::chrono::steady_clock::time_point oldest;
+    //Sequence numbers of the last appended, last committed, and last
+    //operation that a caller of sync is waiting for
+    uint64_t appended;
+    uint64_t committed;
+    uint64_t sync_target;
+    Statistics stats;
+    bool stopping;
+
+    std::mutex journal_mutex;
+    //Signalled when there is work for the writer
+    std::condition_variable work_ready;
+    //Signalled when operations leave the queue or are committed
+    std::condition_variable progress;
+
+    std::thread writer;
+
+    void writerLoop();
+
+    WriteJournal& operator=(const WriteJournal&) = delete;
+    WriteJournal(const WriteJournal&) = delete;
+
+  public:
+    ///Start a writer thread for the given connection
+    WriteJournal(sqlite3* db_handle, size_t batch_size = 2000,
+        std::chrono::milliseconds max_delay = std::chrono::milliseconds(50),
+        size_t max_pending = 20000);
+
+    ///Commits every waiting operation and stops the writer thread
+    ~WriteJournal();
+
+    /**
+     * Queue an operation. Blocks if too many operations are already waiting.
+     * Returns the operation's sequence number. Operations are numbered from
+     * 1 in the order that they are appended and committed.
+     */
+    uint64_t append(Operation op);
+
+    ///Sequence number of the last appended operation
+    uint64_t lastAppended();
+
+    ///Wait until every operation appended before this call is committed
+    void sync();
+
+    Statistics statistics();
+};
+
+#endif //ifndef __WRITE_JOURNAL_HPP__
+
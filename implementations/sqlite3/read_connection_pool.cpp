@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A pool of read only sqlite3 connections for historic queries.
+ ******************************************************************************/
+
+#include "read_connection_pool.hpp"
+#include "sqlite_regexp_module.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sqlite3.h>
+#include <statement_cache.hpp>
+
+ReadConnectionPool::ReadConnection::ReadConnection(sqlite3* db_handle) :
+  db_handle(db_handle), statements(new StatementCache(db_handle)) {
+}
+
+ReadConnectionPool::ReadConnection::~ReadConnection() {
+  //Statements must be finalized before the connection closes
+  statements.reset();
+  sqlite3_close(db_handle);
+}
+
+ReadConnectionPool::Connection::Connection(ReadConnectionPool* pool, ReadConnection* conn) :
+  pool(pool), conn(conn) {
+}
+
+ReadConnectionPool::Connection::Connection(Connection&& other) :
+  pool(other.pool), conn(other.conn) {
+  other.conn = NULL;
+}
+
+ReadConnectionPool::Connection::~Connection() {
+  if (NULL != conn) {
+    pool->release(conn);
+  }
+}
+
+ReadConnectionPool::ReadConnectionPool(const std::string& db_name, size_t max_connections) :
+  db_name(db_name), max_connections(max_connections) {
+  if (0 == this->max_connections) {
+    this->max_connections = std::max(2u, std::thread::hardware_concurrency());
+  }
+}
+
+ReadConnectionPool::~ReadConnectionPool() {
+}
+
+ReadConnectionPool::ReadConnection* ReadConnectionPool::open() {
+  sqlite3* db_handle = NULL;
+  //Each connection is only used by one thread at a time so sqlite's
+  //connection mutex is not needed. The connection must have its own cache
+  //(no SHAREDCACHE) so that readers do not lock each other out.
+  int sql_succ = sqlite3_open_v2(db_name.c_str(), &db_handle,
+      SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_READONLY, NULL);
+  if (SQLITE_OK == sql_succ) {
+    sql_succ = initializeRegex(db_handle);
+  }
+  if (SQLITE_OK != sql_succ) {
+    std::cerr<<"Error opening sqlite3 read connection: "<<sqlite3_errmsg(db_handle)<<'\n';
+    sqlite3_close(db_handle);
+    return NULL;
+  }
+  sqlite3_exec(db_handle, "PRAGMA cache_size = 10000", NULL, 0, NULL);
+  //Time out after 30,000 ms (30 seconds), the same as the writer
+  sqlite3_busy_timeout(db_handle, 30000);
+  return new ReadConnection(db_handle);
+}
+
+ReadConnectionPool::Connection ReadConnectionPool::get() {
+  std::unique_lock<std::mutex> lck(pool_mutex);
+  //Open another connection if every open connection is busy
+  if (idle.empty() and connections.size() < max_connections) {
+    //Count the connection before opening it so that other threads do not
+    //open more than the maximum while the lock is released
+    connections.push_back(nullptr);
+    lck.unlock();
+    ReadConnection* conn = open();
+    lck.lock();
+    if (NULL == conn) {
+      connections.erase(std::find(connections.begin(), connections.end(), nullptr));
+      return Connection(this, NULL);
+    }
+    std::find(connections.begin(), connections.end(), nullptr)->reset(conn);
+    return Connection(this, conn);
+  }
+  returned.wait(lck, [&]() { return not idle.empty();});
+  ReadConnection* conn = idle.back();
+  idle.pop_back();
+  return Connection(this, conn);
+}
+
+void ReadConnectionPool::release(ReadConnection* conn) {
+  {
+    std::unique_lock<std::mutex> lck(pool_mutex);
+    idle.push_back(conn);
+  }
+  returned.notify_one();
+}
+
+size_t ReadConnectionPool::size() {
+  std::unique_lock<std::mutex> lck(pool_mutex);
+  return connections.size();
+}
+
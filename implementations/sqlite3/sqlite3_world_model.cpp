@@ -8,24 +8,24 @@
 
 #include <algorithm>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
-#include <sstream>
 #include <string>
 #include <vector>
 
+#include <read_connection_pool.hpp>
+#include <regex_cache.hpp>
 #include <semaphore.hpp>
+#include <state_image.hpp>
+#include <write_journal.hpp>
 #include "sqlite3_world_model.hpp"
 #include "sqlite_regexp_module.hpp"
 
 #include <owl/world_model_protocol.hpp>
 
-//TODO In the future C++11 support for regex should be used over these POSIX
-//regex c headers.
-#include <sys/types.h>
-#include <regex.h>
-
 using namespace world_model;
 using std::vector;
 using std::u16string;
@@ -47,36 +47,754 @@ Debug& operator<<(Debug& dbg, T arg) {
 
 Debug debug;
 
+//Tables of the current schema. The indexes are created separately so that a
+//migration can fill the tables before indexing them.
+static const std::string schema_tables =
+  "CREATE TABLE uris (id INTEGER PRIMARY KEY, value TEXT UNIQUE NOT NULL);"
+  "CREATE TABLE names (id INTEGER PRIMARY KEY, value TEXT UNIQUE NOT NULL);"
+  "CREATE TABLE origins (id INTEGER PRIMARY KEY, value TEXT UNIQUE NOT NULL);"
+  "CREATE TABLE attributes (uri_id INTEGER, name_id INTEGER, creation_date INTEGER, "
+    "expiration_date INTEGER, origin_id INTEGER, data BLOB);"
+  //Use uri, name, and origin as primary key. Don't store data in this table.
+  "CREATE TABLE current (uri_id INTEGER NOT NULL, name_id INTEGER NOT NULL, creation_date INTEGER, "
+    "expiration_date INTEGER, origin_id INTEGER NOT NULL, PRIMARY KEY (uri_id, name_id, origin_id));";
+static const std::string schema_indexes =
+  "CREATE INDEX attributes_uri_name_origin_creation ON attributes (uri_id, name_id, origin_id, creation_date);"
+  "CREATE INDEX attributes_creation ON attributes (creation_date);";
+
+//Columns in the order that fetchWorldData expects and the joins that
+//supply the text of their ids. Any history table is named attributes.
+static const std::string attribute_columns =
+  "uris.value, names.value, attributes.creation_date, attributes.expiration_date, origins.value, attributes.data ";
+static std::string attributeJoins(const std::string& table) {
+  return "FROM " + table + " AS attributes JOIN uris ON uris.id = attributes.uri_id "
+    "JOIN names ON names.id = attributes.name_id "
+    "JOIN origins ON origins.id = attributes.origin_id ";
+}
+
+static const std::string dictionary_tables[] = {"uris", "names", "origins"};
+
+//Checkpoints record the version of every attribute that was current at their
+//time. The data stays in the attributes table. These are added to databases
+//of any schema version since they can always be rebuilt from the history.
+static const std::string checkpoint_tables =
+  "CREATE TABLE IF NOT EXISTS checkpoints (time INTEGER PRIMARY KEY);"
+  "CREATE TABLE IF NOT EXISTS checkpoint_values (checkpoint_time INTEGER NOT NULL, "
+    "uri_id INTEGER NOT NULL, name_id INTEGER NOT NULL, origin_id INTEGER NOT NULL, creation_date INTEGER, "
+    "PRIMARY KEY (checkpoint_time, uri_id, name_id, origin_id)) WITHOUT ROWID;"
+  //Finds the versions of a checkpoint that are in one partition
+  "CREATE INDEX IF NOT EXISTS checkpoint_values_creation ON checkpoint_values (checkpoint_time, creation_date);";
+
+//The checkpoint tables and their time columns, for removing checkpoints
+static const std::string checkpoint_times[] = {
+  "checkpoint_values WHERE checkpoint_time", "checkpoints WHERE time"};
+
+//Watermark of the state image, present only while the image is current
+static const std::string image_table =
+  "CREATE TABLE IF NOT EXISTS state_image (id INTEGER PRIMARY KEY CHECK (id = 0), watermark INTEGER);";
+
+//Partition numbers are listed in the partitions table. The partitions of the
+//current values are found through the creation index of the current table.
+static const std::string partition_tables =
+  "CREATE TABLE IF NOT EXISTS partitions (id INTEGER PRIMARY KEY);"
+  "CREATE INDEX IF NOT EXISTS current_creation ON current (creation_date);";
+
+//Used in place of a checkpoint time when there is no earlier checkpoint
+static const grail_time no_checkpoint = std::numeric_limits<grail_time>::min() + 1;
+
+typedef SQLite3WorldModel::Partition Partition;
+
+//The attributes table holds history of any age
+static const Partition unpartitioned{"attributes", no_checkpoint, std::numeric_limits<grail_time>::max()};
+
+//Most partitions read by one statement, well under SQLite's limit on the
+//terms of a compound SELECT
+static const size_t max_query_partitions = 100;
+
+//Number of the partition holding values created at a time. Values from
+//before 1970 are kept in the attributes table.
+static int64_t partitionOf(grail_time time) {
+  return time < 0 ? -1 : time / SQLite3WorldModel::partition_span;
+}
+
+//Restrict a creation date column to the dates of a partition
+static std::string partitionRange(const std::string& column, const Partition& partition) {
+  return column + " BETWEEN " + std::to_string(partition.start) + " AND " + std::to_string(partition.end - 1) + " ";
+}
+
+//Create the table and indexes of a partition, the same as those of the attributes table
+static std::string partitionSchema(const std::string& table) {
+  return "CREATE TABLE IF NOT EXISTS " + table + " (uri_id INTEGER, name_id INTEGER, creation_date INTEGER, "
+    "expiration_date INTEGER, origin_id INTEGER, data BLOB);"
+    "CREATE INDEX IF NOT EXISTS " + table + "_uri_name_origin_creation ON " + table +
+    " (uri_id, name_id, origin_id, creation_date);"
+    "CREATE INDEX IF NOT EXISTS " + table + "_creation ON " + table + " (creation_date);";
+}
+
+//The versions recorded by the checkpoint at time ?N joined to their
+//attributes in one partition
+static std::string checkpointVersions(const std::string& time, const Partition& partition) {
+  return "FROM checkpoint_values CROSS JOIN " + partition.table + " AS attributes ON ("
+    "attributes.uri_id = checkpoint_values.uri_id AND "
+    "attributes.name_id = checkpoint_values.name_id AND attributes.origin_id = checkpoint_values.origin_id AND "
+    "attributes.creation_date = checkpoint_values.creation_date) "
+    "WHERE checkpoint_values.checkpoint_time = " + time + " AND " +
+    partitionRange("checkpoint_values.creation_date", partition);
+}
+
+//Join the SELECT statements of a compound SELECT
+static std::string unionAll(const std::vector<std::string>& selects) {
+  std::string joined;
+  for (const std::string& select : selects) {
+    joined += (joined.empty() ? "" : "UNION ALL ") + select;
+  }
+  return joined;
+}
+
+//The tables holding history created between start and stop, starting with
+//the attributes table and then the partitions in order. These are read
+//through the given statements so that they match what their connection sees.
+static std::vector<Partition> partitionsBetween(StatementCache& statements, grail_time start, grail_time stop) {
+  std::vector<Partition> found{unpartitioned};
+  if (stop < 0) {
+    return found;
+  }
+  StatementCache::Statement statement_p = statements.get(
+      "SELECT id FROM partitions WHERE id BETWEEN ?1 AND ?2 ORDER BY id;");
+  sqlite3_bind_int64(statement_p, 1, partitionOf(std::max<grail_time>(start, 0)));
+  sqlite3_bind_int64(statement_p, 2, partitionOf(stop));
+  while (SQLITE_ROW == sqlite3_step(statement_p)) {
+    int64_t number = sqlite3_column_int64(statement_p, 0);
+    found.push_back(Partition{SQLite3WorldModel::partitionTable(number),
+        number * SQLite3WorldModel::partition_span, (number + 1) * SQLite3WorldModel::partition_span});
+  }
+  return found;
+}
+
+//Call f with batches of the checkpointed and recent partitions of a query
+//that are small enough for a single statement
+static void forEachBatch(const std::vector<Partition>& checkpointed, const std::vector<Partition>& recent,
+    std::function<void(const std::vector<Partition>&, const std::vector<Partition>&)> f) {
+  size_t total = checkpointed.size() + recent.size();
+  for (size_t first = 0; first < total; first += max_query_partitions) {
+    size_t last = std::min(total, first + max_query_partitions);
+    std::vector<Partition> batch_checkpointed, batch_recent;
+    for (size_t idx = first; idx < last; ++idx) {
+      if (idx < checkpointed.size()) {
+        batch_checkpointed.push_back(checkpointed[idx]);
+      }
+      else {
+        batch_recent.push_back(recent[idx - checkpointed.size()]);
+      }
+    }
+    f(batch_checkpointed, batch_recent);
+  }
+}
+
+//Keep the statements on a read connection in one transaction so that they
+//see the same partitions and checkpoints
+class ReadTransaction {
+  private:
+    sqlite3* db_handle;
+  public:
+    ReadTransaction(sqlite3* db_handle) : db_handle(db_handle) {
+      if (NULL != db_handle) {
+        sqlite3_exec(db_handle, "BEGIN TRANSACTION;", NULL, NULL, NULL);
+      }
+    }
+    ~ReadTransaction() {
+      if (NULL != db_handle) {
+        sqlite3_exec(db_handle, "COMMIT TRANSACTION;", NULL, NULL, NULL);
+      }
+    }
+};
+
+//Add the attributes of one snapshot to another, keeping the latest version of each
+static void mergeLatest(WorldModel::world_state& into, WorldModel::world_state& from) {
+  for (auto I = from.begin(); I != from.end(); ++I) {
+    std::vector<world_model::Attribute>& attributes = into[I->first];
+    for (world_model::Attribute& attr : I->second) {
+      auto same = std::find_if(attributes.begin(), attributes.end(), [&](const world_model::Attribute& other) {
+          return other.name == attr.name and other.origin == attr.origin;});
+      if (same == attributes.end()) {
+        attributes.push_back(attr);
+      }
+      else if (same->creation_date < attr.creation_date) {
+        *same = attr;
+      }
+    }
+  }
+}
+
+//Ids of the dictionary values that fully match the pattern in ?pattern. The
+//values are first limited to the range [?lower, ?lower+1) bound by
+//bindPatternRange so that the dictionary's index skips values that cannot
+//match and REGEXP is only called for the rest.
+static std::string dictionaryMatch(const std::string& table, size_t pattern, size_t lower) {
+  return "SELECT id FROM " + table + " WHERE value >= ?" + std::to_string(lower) +
+    " AND value < ?" + std::to_string(lower + 1) + " AND value REGEXP ?" + std::to_string(pattern);
+}
+
+//Bind the range of values that can match a pattern to ?lower and ?lower+1.
+//The range holds the values that begin with the pattern's literal prefix.
+static void bindPatternRange(sqlite3_stmt* statement_p, int lower, const std::u16string& pattern) {
+  std::u16string prefix = RegexCache::get(pattern)->literalPrefix();
+  //Stop before the surrogates so that UTF-8 and UTF-16 sort the prefix the
+  //same way and the last character can be incremented for the upper bound
+  auto high = std::find_if(prefix.begin(), prefix.end(), [](char16_t c) { return c >= 0xD7FF;});
+  prefix.erase(high, prefix.end());
+  sqlite3_bind_text16(statement_p, lower, prefix.data(), 2*prefix.size(), SQLITE_TRANSIENT);
+  if (prefix.empty()) {
+    //Every text value sorts before a blob so this leaves the range open
+    sqlite3_bind_zeroblob(statement_p, lower + 1, 0);
+  }
+  else {
+    ++prefix.back();
+    sqlite3_bind_text16(statement_p, lower + 1, prefix.data(), 2*prefix.size(), SQLITE_TRANSIENT);
+  }
+}
+
+//Execute statements that do not return rows. Returns false after printing
+//any error.
+static bool execute(sqlite3* db_handle, const std::string& sql) {
+  char* err = NULL;
+  sqlite3_exec(db_handle, sql.c_str(), NULL, NULL, &err);
+  if (NULL != err) {
+    std::cerr<<"Error updating database: "<<err<<'\n';
+    sqlite3_free(err);
+    return false;
+  }
+  return true;
+}
+
+std::string SQLite3WorldModel::partitionTable(int64_t partition) {
+  return "attributes_" + std::to_string(partition);
+}
+
+std::string SQLite3WorldModel::snapshotQuery(const std::vector<Partition>& checkpointed,
+    const std::vector<Partition>& recent) {
+  //The bare columns come from the row with the MAX creation date. This is
+  //safe to use if we expire all of a URI's attributes when the URI is expired.
+  //The patterns are matched once per dictionary entry rather than once per
+  //row and the id lists are searched with the uri/name/origin index.
+  //Only the versions in the latest checkpoint at or before the stop time and
+  //the history created since that checkpoint are considered. Older versions
+  //were already expired at the time of the checkpoint. The history since the
+  //checkpoint is grouped on its own so that it is read in index order.
+  std::string uri_match = "IN (" + dictionaryMatch("uris", 3, 5) + ") ";
+  std::string name_match = "IN (" + dictionaryMatch("names", 4, 7) + ") ";
+  std::vector<std::string> selects;
+  for (const Partition& partition : checkpointed) {
+    selects.push_back("SELECT attributes.uri_id, attributes.name_id, attributes.origin_id, attributes.creation_date, "
+        "attributes.expiration_date, attributes.data " + checkpointVersions("?1", partition) +
+        "AND checkpoint_values.uri_id " + uri_match + "AND checkpoint_values.name_id " + name_match);
+  }
+  for (const Partition& partition : recent) {
+    selects.push_back("SELECT uri_id, name_id, origin_id, MAX(creation_date) AS creation_date, expiration_date, data FROM " +
+        partition.table + " WHERE uri_id " + uri_match + "AND name_id " + name_match +
+        "AND creation_date > ?1 AND creation_date <= ?2 "
+        "AND NOT (expiration_date BETWEEN 1 AND ?2) "
+        "GROUP BY uri_id, name_id, origin_id ");
+  }
+  return "SELECT uris.value, names.value, MAX(a.creation_date), a.expiration_date, origins.value, a.data FROM (" +
+    unionAll(selects) + ") AS a "
+    "JOIN uris ON uris.id = a.uri_id JOIN names ON names.id = a.name_id JOIN origins ON origins.id = a.origin_id "
+    "WHERE NOT (a.expiration_date BETWEEN 1 AND ?2) "
+    "GROUP BY a.uri_id, a.name_id, a.origin_id;";
+}
+
+std::string SQLite3WorldModel::checkpointQuery(const std::vector<Partition>& checkpointed,
+    const std::vector<Partition>& recent) {
+  //The same as a snapshot of every attribute, starting from the checkpoint at ?2.
+  //A checkpoint read in several statements keeps the latest version of each attribute.
+  std::vector<std::string> selects;
+  for (const Partition& partition : checkpointed) {
+    selects.push_back("SELECT attributes.uri_id, attributes.name_id, attributes.origin_id, attributes.creation_date, "
+        "attributes.expiration_date " + checkpointVersions("?2", partition));
+  }
+  for (const Partition& partition : recent) {
+    selects.push_back("SELECT uri_id, name_id, origin_id, creation_date, expiration_date FROM " + partition.table +
+        " WHERE creation_date > ?2 AND creation_date <= ?1 ");
+  }
+  return "INSERT INTO checkpoint_values (checkpoint_time, uri_id, name_id, origin_id, creation_date) "
+    "SELECT ?1, uri_id, name_id, origin_id, MAX(creation_date) FROM (" + unionAll(selects) + ") "
+    "WHERE NOT (expiration_date BETWEEN 1 AND ?1) "
+    "GROUP BY uri_id, name_id, origin_id "
+    "ON CONFLICT (checkpoint_time, uri_id, name_id, origin_id) DO UPDATE SET creation_date = excluded.creation_date "
+    "WHERE excluded.creation_date > checkpoint_values.creation_date;";
+}
+
+std::string SQLite3WorldModel::rangeQuery(size_t num_attributes, const std::vector<Partition>& partitions) {
+  std::string att_request = "";
+  if (num_attributes > 0) {
+    att_request += "AND attributes.name_id IN (";
+    for (size_t idx = 0; idx < num_attributes; ++idx) {
+      if (idx != 0) {
+        att_request += " UNION ALL ";
+      }
+      att_request += dictionaryMatch("names", idx+4, 2*idx + num_attributes+6);
+    }
+    att_request += ") ";
+  }
+  std::vector<std::string> selects;
+  for (const Partition& partition : partitions) {
+    selects.push_back("SELECT " + attribute_columns + attributeJoins(partition.table) +
+        "WHERE attributes.uri_id IN (" + dictionaryMatch("uris", 1, num_attributes+4) + ") " + att_request +
+        "AND attributes.creation_date BETWEEN ?2 AND ?3 ");
+  }
+  //Sort by the creation date column
+  return unionAll(selects) + "ORDER BY 3 ASC LIMIT ?" + std::to_string(3*num_attributes + 6) + ";";
+}
+
+std::string SQLite3WorldModel::neighborQuery(bool before, const std::string& table) {
+  return "SELECT " + attribute_columns + attributeJoins(table) +
+    "WHERE attributes.uri_id = ?2 AND attributes.name_id = ?3 AND attributes.origin_id = ?4 AND " +
+    (before ? "attributes.creation_date <= ?1 ORDER BY attributes.creation_date DESC LIMIT 1;" :
+              "attributes.creation_date >= ?1 ORDER BY attributes.creation_date ASC LIMIT 1;");
+}
+
+std::string SQLite3WorldModel::expirationQuery(const std::string& table) {
+  return "UPDATE " + table + " SET expiration_date = ?1 WHERE "
+    "uri_id = ?2 AND name_id = ?3 AND origin_id = ?4 AND creation_date = ?5;";
+}
+
+//The current version of each attribute, from the partitions of the given tables
+static std::string currentQuery(const std::vector<Partition>& partitions) {
+  std::vector<std::string> selects;
+  for (const Partition& partition : partitions) {
+    selects.push_back("SELECT " + attribute_columns + "FROM current "
+        "INNER JOIN " + partition.table + " AS attributes ON ("
+        "attributes.uri_id = current.uri_id AND attributes.name_id = current.name_id AND "
+        "attributes.origin_id = current.origin_id AND attributes.creation_date = current.creation_date AND "
+        "attributes.expiration_date = current.expiration_date) "
+        "JOIN uris ON uris.id = attributes.uri_id JOIN names ON names.id = attributes.name_id "
+        "JOIN origins ON origins.id = attributes.origin_id WHERE " +
+        partitionRange("current.creation_date", partition));
+  }
+  return unionAll(selects) + ";";
+}
+
+std::vector<std::string> SQLite3WorldModel::queryPlan(const std::string& statement) {
+  std::vector<std::string> plan;
+  if (NULL == db_handle) {
+    return plan;
+  }
+  std::string explain = "EXPLAIN QUERY PLAN " + statement;
+  sqlite3_stmt* statement_p;
+  if (SQLITE_OK == sqlite3_prepare_v2(db_handle, explain.c_str(), -1, &statement_p, NULL)) {
+    //The last column holds the description of each step
+    int detail = sqlite3_column_count(statement_p) - 1;
+    while (SQLITE_ROW == sqlite3_step(statement_p)) {
+      plan.push_back((const char*)sqlite3_column_text(statement_p, detail));
+    }
+  }
+  sqlite3_finalize(statement_p);
+  return plan;
+}
+
+void SQLite3WorldModel::sync() {
+  if (journal) {
+    journal->sync();
+  }
+}
+
+WriteJournal::Statistics SQLite3WorldModel::journalStatistics() {
+  if (journal) {
+    return journal->statistics();
+  }
+  return WriteJournal::Statistics{0, 0, 0};
+}
+
+size_t SQLite3WorldModel::readConnections() {
+  if (readers) {
+    return readers->size();
+  }
+  return 0;
+}
+
+StatementCache::Statistics SQLite3WorldModel::statementStatistics() {
+  if (statements) {
+    return statements->statistics();
+  }
+  return StatementCache::Statistics{0, 0, 0, 0};
+}
+
+void SQLite3WorldModel::setCheckpointPolicy(grail_time interval, size_t retention) {
+  checkpoint_interval = interval;
+  checkpoint_retention = std::max<size_t>(1, retention);
+  next_checkpoint = world_model::getGRAILTime() + interval;
+}
+
+void SQLite3WorldModel::checkpoint(grail_time time) {
+  if (journal) {
+    journal->append([this, time]() { createCheckpoint(time);});
+  }
+}
+
+grail_time SQLite3WorldModel::latestCheckpoint(grail_time before) {
+  grail_time latest = no_checkpoint;
+  StatementCache::Statement statement_p = statements->get("SELECT MAX(time) FROM checkpoints WHERE time < ?1;");
+  sqlite3_bind_int64(statement_p, 1, before);
+  if (SQLITE_ROW == sqlite3_step(statement_p) and SQLITE_NULL != sqlite3_column_type(statement_p, 0)) {
+    latest = sqlite3_column_int64(statement_p, 0);
+  }
+  return latest;
+}
+
+void SQLite3WorldModel::createCheckpoint(grail_time time) {
+  {
+    StatementCache::Statement statement_p = statements->get("SELECT 1 FROM checkpoints WHERE time = ?1;");
+    sqlite3_bind_int64(statement_p, 1, time);
+    if (SQLITE_ROW == sqlite3_step(statement_p)) {
+      return;
+    }
+  }
+  //Start from the nearest earlier checkpoint rather than the whole history
+  grail_time previous = latestCheckpoint(time);
+  std::vector<Partition> checkpointed;
+  if (no_checkpoint != previous) {
+    checkpointed = partitionsBetween(*statements, no_checkpoint, previous);
+  }
+  std::vector<Partition> recent = partitionsBetween(*statements, previous + 1, time);
+  bool success = true;
+  forEachBatch(checkpointed, recent, [&](const std::vector<Partition>& c, const std::vector<Partition>& r) {
+      StatementCache::Statement statement_p = statements->get(checkpointQuery(c, r));
+      sqlite3_bind_int64(statement_p, 1, time);
+      sqlite3_bind_int64(statement_p, 2, previous);
+      success = success and SQLITE_DONE == sqlite3_step(statement_p);});
+  if (not success) {
+    std::cerr<<"Error creating a checkpoint: "<<sqlite3_errmsg(db_handle)<<'\n';
+    StatementCache::Statement statement_p = statements->get("DELETE FROM checkpoint_values WHERE checkpoint_time = ?1;");
+    sqlite3_bind_int64(statement_p, 1, time);
+    sqlite3_step(statement_p);
+    return;
+  }
+  {
+    StatementCache::Statement statement_p = statements->get("INSERT INTO checkpoints (time) VALUES (?1);");
+    sqlite3_bind_int64(statement_p, 1, time);
+    sqlite3_step(statement_p);
+  }
+  //Only keep the most recent checkpoints
+  for (const std::string& table : checkpoint_times) {
+    StatementCache::Statement statement_p = statements->get("DELETE FROM " + table +
+        " <= (SELECT time FROM checkpoints ORDER BY time DESC LIMIT 1 OFFSET ?1);");
+    sqlite3_bind_int64(statement_p, 1, checkpoint_retention);
+    sqlite3_step(statement_p);
+  }
+  latest_checkpoint = std::max(latest_checkpoint, time);
+}
+
+void SQLite3WorldModel::invalidateCheckpoints(grail_time time) {
+  if (time > latest_checkpoint) {
+    return;
+  }
+  for (const std::string& table : checkpoint_times) {
+    StatementCache::Statement statement_p = statements->get("DELETE FROM " + table + " >= ?1;");
+    sqlite3_bind_int64(statement_p, 1, time);
+    sqlite3_step(statement_p);
+  }
+  latest_checkpoint = latestCheckpoint(time);
+}
+
+const std::string& SQLite3WorldModel::partitionFor(grail_time creation) {
+  int64_t number = partitionOf(creation);
+  if (number < 0) {
+    return unpartitioned.table;
+  }
+  auto P = partitions.find(number);
+  if (P == partitions.end()) {
+    std::string table = partitionTable(number);
+    if (not execute(db_handle, partitionSchema(table) +
+          "INSERT OR IGNORE INTO partitions (id) VALUES (" + std::to_string(number) + ");")) {
+      return unpartitioned.table;
+    }
+    P = partitions.insert(std::make_pair(number, table)).first;
+  }
+  return P->second;
+}
+
+std::vector<std::string> SQLite3WorldModel::historyTables() {
+  std::vector<std::string> tables{unpartitioned.table};
+  for (auto P = partitions.begin(); P != partitions.end(); ++P) {
+    tables.push_back(P->second);
+  }
+  return tables;
+}
+
+void SQLite3WorldModel::setRetentionPolicy(const std::u16string& name_pattern, grail_time keep_for,
+    grail_time downsample_after, grail_time downsample_interval) {
+  {
+    std::unique_lock<std::mutex> lck(retention_mutex);
+    RetentionRule rule{name_pattern, keep_for, downsample_after, downsample_interval};
+    auto same = std::find_if(retention_rules.begin(), retention_rules.end(),
+        [&](const RetentionRule& other) { return other.name_pattern == name_pattern;});
+    if (same == retention_rules.end()) {
+      retention_rules.push_back(rule);
+    }
+    else {
+      *same = rule;
+    }
+    has_retention = true;
+  }
+  //Every partition needs to be checked against the new rule
+  if (journal) {
+    journal->append([this]() { retained_at.clear();});
+  }
+}
+
+void SQLite3WorldModel::applyRetention(grail_time now) {
+  if (journal) {
+    journal->append([this, now]() { retainHistory(now);});
+  }
+}
+
+//Ids in a list for an IN clause
+static std::string idList(const std::vector<sqlite3_int64>& ids) {
+  std::string list;
+  for (sqlite3_int64 id : ids) {
+    list += (list.empty() ? "" : ",") + std::to_string(id);
+  }
+  return list;
+}
+
+//Condition that a row of the given table is the current version of its attribute
+static std::string isCurrent(const std::string& table) {
+  return "EXISTS (SELECT 1 FROM current WHERE current.uri_id = " + table + ".uri_id AND "
+    "current.name_id = " + table + ".name_id AND current.origin_id = " + table + ".origin_id AND "
+    "current.creation_date = " + table + ".creation_date) ";
+}
+
+void SQLite3WorldModel::retainHistory(grail_time now) {
+  std::vector<RetentionRule> rules;
+  {
+    std::unique_lock<std::mutex> lck(retention_mutex);
+    rules = retention_rules;
+  }
+  //Find the names that each rule applies to
+  std::vector<std::vector<sqlite3_int64>> rule_names(rules.size());
+  {
+    StatementCache::Statement statement_p = statements->get("SELECT id, value FROM names;");
+    while (SQLITE_ROW == sqlite3_step(statement_p)) {
+      std::u16string name((const char16_t*)sqlite3_column_text16(statement_p, 1));
+      for (size_t rule = 0; rule < rules.size(); ++rule) {
+        if (RegexCache::get(rules[rule].name_pattern)->fullMatch(name)) {
+          rule_names[rule].push_back(sqlite3_column_int64(statement_p, 0));
+          break;
+        }
+      }
+    }
+  }
+  //The attributes table is not partitioned so its old rows are deleted
+  for (size_t rule = 0; rule < rules.size(); ++rule) {
+    if (0 < rules[rule].keep_for and not rule_names[rule].empty()) {
+      execute(db_handle, "DELETE FROM attributes WHERE creation_date < " +
+          std::to_string(now - rules[rule].keep_for) + " AND name_id IN (" + idList(rule_names[rule]) +
+          ") AND NOT " + isCurrent("attributes") + ";");
+    }
+  }
+  //Each partition is handled once a rule's limit has passed its end
+  std::vector<int64_t> numbers;
+  for (auto P = partitions.begin(); P != partitions.end(); ++P) {
+    numbers.push_back(P->first);
+  }
+  for (int64_t number : numbers) {
+    grail_time end = (number + 1) * partition_span;
+    auto last = retained_at.find(number);
+    bool checked = last != retained_at.end();
+    grail_time checked_at = checked ? last->second : now;
+    retained_at[number] = now;
+    //True if the limit has passed the end of the partition since it was last checked
+    auto passed = [&](grail_time limit) {
+      return end <= now - limit and (not checked or end > checked_at - limit);
+    };
+    std::vector<sqlite3_int64> expired;
+    bool drop = false;
+    for (size_t rule = 0; rule < rules.size(); ++rule) {
+      if (0 < rules[rule].keep_for and end <= now - rules[rule].keep_for) {
+        expired.insert(expired.end(), rule_names[rule].begin(), rule_names[rule].end());
+        drop = drop or passed(rules[rule].keep_for);
+      }
+    }
+    if (drop and not expired.empty()) {
+      dropHistory(number, idList(expired));
+      if (partitions.end() == partitions.find(number)) {
+        continue;
+      }
+    }
+    for (size_t rule = 0; rule < rules.size(); ++rule) {
+      const RetentionRule& r = rules[rule];
+      bool is_expired = 0 < r.keep_for and end <= now - r.keep_for;
+      if (0 < r.downsample_interval and not is_expired and passed(r.downsample_after) and
+          not rule_names[rule].empty()) {
+        downsampleHistory(partitions[number], idList(rule_names[rule]), r.downsample_interval);
+      }
+    }
+  }
+}
+
+void SQLite3WorldModel::dropHistory(int64_t partition, const std::string& name_ids) {
+  const std::string table = partitionTable(partition);
+  bool others = false;
+  {
+    StatementCache::Statement statement_p = statements->get(
+        "SELECT 1 FROM " + table + " WHERE name_id NOT IN (" + name_ids + ") LIMIT 1;");
+    others = SQLITE_ROW == sqlite3_step(statement_p);
+  }
+  //Current values are kept, in the attributes table if their partition is dropped
+  if (others) {
+    execute(db_handle, "DELETE FROM " + table + " WHERE name_id IN (" + name_ids + ") AND NOT " +
+        isCurrent(table) + ";");
+  }
+  else if (execute(db_handle, "INSERT INTO attributes (uri_id, name_id, creation_date, expiration_date, origin_id, data) "
+        "SELECT uri_id, name_id, creation_date, expiration_date, origin_id, data FROM " + table +
+        " WHERE " + isCurrent(table) + ";"
+        "DROP TABLE " + table + ";"
+        "DELETE FROM partitions WHERE id = " + std::to_string(partition) + ";")) {
+    partitions.erase(partition);
+    retained_at.erase(partition);
+  }
+}
+
+void SQLite3WorldModel::downsampleHistory(const std::string& table, const std::string& name_ids,
+    grail_time interval) {
+  //Find the first and last values of each interval with more than one value.
+  //Current values are not removed.
+  std::string same_attribute = "d.uri_id = " + table + ".uri_id AND d.name_id = " + table + ".name_id AND "
+    "d.origin_id = " + table + ".origin_id ";
+  std::string same_checkpointed = "d.uri_id = checkpoint_values.uri_id AND d.name_id = checkpoint_values.name_id AND "
+    "d.origin_id = checkpoint_values.origin_id AND checkpoint_values.creation_date > d.first AND "
+    "checkpoint_values.creation_date <= d.last ";
+  execute(db_handle, "CREATE TEMP TABLE IF NOT EXISTS downsampled (uri_id INTEGER, name_id INTEGER, "
+      "origin_id INTEGER, first INTEGER, last INTEGER, PRIMARY KEY (uri_id, name_id, origin_id, first)) WITHOUT ROWID;"
+      "DELETE FROM temp.downsampled;"
+      "INSERT INTO temp.downsampled SELECT uri_id, name_id, origin_id, MIN(creation_date), MAX(creation_date) FROM " +
+      table + " WHERE name_id IN (" + name_ids + ") AND NOT " + isCurrent(table) +
+      "GROUP BY uri_id, name_id, origin_id, creation_date / " + std::to_string(interval) + " HAVING COUNT(*) > 1;"
+      //The first value of each interval lasts until the last one expired
+      "UPDATE " + table + " SET expiration_date = (SELECT later.expiration_date FROM temp.downsampled AS d "
+      "JOIN " + table + " AS later ON (later.uri_id = d.uri_id AND later.name_id = d.name_id AND "
+      "later.origin_id = d.origin_id AND later.creation_date = d.last) "
+      "WHERE " + same_attribute + "AND d.first = " + table + ".creation_date) "
+      "WHERE EXISTS (SELECT 1 FROM temp.downsampled AS d WHERE " + same_attribute +
+      "AND d.first = " + table + ".creation_date);"
+      //Checkpoints of removed values refer to the first value instead
+      "UPDATE checkpoint_values SET creation_date = (SELECT d.first FROM temp.downsampled AS d WHERE " +
+      same_checkpointed + ") WHERE EXISTS (SELECT 1 FROM temp.downsampled AS d WHERE " + same_checkpointed + ");"
+      "DELETE FROM " + table + " WHERE EXISTS (SELECT 1 FROM temp.downsampled AS d WHERE " + same_attribute +
+      "AND " + table + ".creation_date > d.first AND " + table + ".creation_date <= d.last);");
+}
+
+void SQLite3WorldModel::forgetImage() {
+  if (image_recorded) {
+    StatementCache::Statement statement_p = statements->get("DELETE FROM state_image;");
+    sqlite3_step(statement_p);
+    image_recorded = false;
+  }
+}
+
+void SQLite3WorldModel::recordImage(int64_t watermark) {
+  StatementCache::Statement statement_p = statements->get(
+      "INSERT OR REPLACE INTO state_image (id, watermark) VALUES (0, ?1);");
+  sqlite3_bind_int64(statement_p, 1, watermark);
+  image_recorded = SQLITE_DONE == sqlite3_step(statement_p);
+}
+
+bool SQLite3WorldModel::saveStateImage() {
+  if (not journal) {
+    return false;
+  }
+  //Every change to the current state is appended to the journal after it is
+  //made, so the state copied now includes every write appended before this.
+  uint64_t before = journal->lastAppended();
+  //Each image gets a new watermark so that an old image is never mistaken
+  //for the one recorded in the database
+  int64_t watermark = world_model::getGRAILTime();
+  int64_t last = last_watermark;
+  do {
+    watermark = std::max(watermark, last + 1);
+  } while (not last_watermark.compare_exchange_weak(last, watermark));
+  StateImage::TransientTypes transient_copy;
+  {
+    std::unique_lock<std::mutex> lck(transient_lock);
+    transient_copy = transient;
+  }
+  if (not StateImage::save(image_name, watermark, cur_state, transient_copy)) {
+    return false;
+  }
+  //The image is only current if no write was appended while it was saved
+  if (before + 1 != journal->append([this, watermark]() { recordImage(watermark);})) {
+    journal->append([this]() { forgetImage();});
+    return false;
+  }
+  return true;
+}
+
+sqlite3_int64 SQLite3WorldModel::dictionaryID(Dictionary dict, const std::u16string& value) {
+  std::unique_lock<std::mutex> lck(dictionary_mutex);
+  auto I = dictionary_ids[dict].find(value);
+  if (I != dictionary_ids[dict].end()) {
+    return I->second;
+  }
+  const std::string& table = dictionary_tables[dict];
+  sqlite3_int64 id = -1;
+  {
+    StatementCache::Statement statement_p = statements->get(
+        "INSERT OR IGNORE INTO " + table + " (value) VALUES (?1);");
+    sqlite3_bind_text16(statement_p, 1, value.data(), 2*value.size(), SQLITE_STATIC);
+    if (SQLITE_DONE != sqlite3_step(statement_p)) {
+      std::cerr<<"Error inserting into the "<<table<<" table.\n";
+    }
+  }
+  StatementCache::Statement statement_p = statements->get(
+      "SELECT id FROM " + table + " WHERE value = ?1;");
+  sqlite3_bind_text16(statement_p, 1, value.data(), 2*value.size(), SQLITE_STATIC);
+  if (SQLITE_ROW == sqlite3_step(statement_p)) {
+    id = sqlite3_column_int64(statement_p, 0);
+    dictionary_ids[dict][value] = id;
+  }
+  return id;
+}
+
+bool SQLite3WorldModel::findDictionaryID(Dictionary dict, const std::u16string& value, sqlite3_int64& id) {
+  std::unique_lock<std::mutex> lck(dictionary_mutex);
+  auto I = dictionary_ids[dict].find(value);
+  if (I != dictionary_ids[dict].end()) {
+    id = I->second;
+    return true;
+  }
+  StatementCache::Statement statement_p = statements->get(
+      "SELECT id FROM " + dictionary_tables[dict] + " WHERE value = ?1;");
+  sqlite3_bind_text16(statement_p, 1, value.data(), 2*value.size(), SQLITE_STATIC);
+  if (SQLITE_ROW != sqlite3_step(statement_p)) {
+    return false;
+  }
+  id = sqlite3_column_int64(statement_p, 0);
+  dictionary_ids[dict][value] = id;
+  return true;
+}
+
 //Used to update the creation_date and expiration_date fields of uri attributes in the current db
 void SQLite3WorldModel::currentUpdate(world_model::URI uri, std::vector<world_model::Attribute>& entries) {
   if (db_handle != NULL) {
     //SemaphoreLock lck(db_access_control);
+    sqlite3_int64 uri_id = dictionaryID(uri_dictionary, uri);
+    static const std::string insert_string = "INSERT or REPLACE into 'current' "
+      "(creation_date, expiration_date, uri_id, name_id, origin_id) values (?1, ?2, ?3, ?4, ?5);";
     for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
-      std::string name(entry->name.begin(), entry->name.end());
-      std::string origin(entry->origin.begin(), entry->origin.end());
-      std::ostringstream insert_stream;
-
-      insert_stream << "INSERT or REPLACE into 'current' "<<
-        "(creation_date, expiration_date, uri, name, origin) values (?1, ?2, ?3, ?4, ?5);";
-      sqlite3_stmt* statement_p;
-      //Prepare the statement
-      std::string insert_string = insert_stream.str();
-      sqlite3_prepare_v2(db_handle, insert_string.c_str(), -1, &statement_p, NULL);
+      //Get a prepared statement
+      StatementCache::Statement statement_p = statements->get(insert_string);
       //Bind this attribute's parameters.
       sqlite3_bind_int64(statement_p, 1, entry->creation_date);
       sqlite3_bind_int64(statement_p, 2, entry->expiration_date);
-      sqlite3_bind_text16(statement_p, 3, uri.data(), 2*uri.size(), SQLITE_STATIC);
-      sqlite3_bind_text16(statement_p, 4, entry->name.data(), 2*entry->name.size(), SQLITE_STATIC);
-      sqlite3_bind_text16(statement_p, 5, entry->origin.data(), 2*entry->origin.size(), SQLITE_STATIC);
+      sqlite3_bind_int64(statement_p, 3, uri_id);
+      sqlite3_bind_int64(statement_p, 4, dictionaryID(name_dictionary, entry->name));
+      sqlite3_bind_int64(statement_p, 5, dictionaryID(origin_dictionary, entry->origin));
 
       //Call sqlite with the statement
       if (SQLITE_DONE != sqlite3_step(statement_p)) {
         //TODO This should be better at handling an error.
         std::cerr<<"Error updating field in database.\n";
       }
-
-      //Delete the statement
-      sqlite3_finalize(statement_p);
     }
   }
 }
@@ -85,33 +803,42 @@ void SQLite3WorldModel::currentUpdate(world_model::URI uri, std::vector<world_mo
 void SQLite3WorldModel::databaseUpdate(world_model::URI uri, std::vector<world_model::Attribute>& entries) {
   if (db_handle != NULL) {
     //SemaphoreLock lck(db_access_control);
+    sqlite3_int64 uri_id = dictionaryID(uri_dictionary, uri);
+    //Expiring a version before a checkpoint changes what the checkpoint recorded
+    grail_time oldest = std::numeric_limits<grail_time>::max();
     for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
-      std::string name(entry->name.begin(), entry->name.end());
-      std::string origin(entry->origin.begin(), entry->origin.end());
-      std::ostringstream insert_stream;
-
-      insert_stream << "UPDATE 'attributes' SET expiration_date = ?1 WHERE "<<
-       "uri = ?2 AND name = ?3 AND creation_date = ?4 AND origin = ?5;";
-      sqlite3_stmt* statement_p;
-      //Prepare the statement
-      std::string insert_string = insert_stream.str();
-      sqlite3_prepare_v2(db_handle, insert_string.c_str(), -1, &statement_p, NULL);
-      //Bind this attribute's parameters.
-      sqlite3_bind_int64(statement_p, 1, entry->expiration_date);
-      sqlite3_bind_text16(statement_p, 2, uri.data(), 2*uri.size(), SQLITE_STATIC);
-      sqlite3_bind_text16(statement_p, 3, entry->name.data(), 2*entry->name.size(), SQLITE_STATIC);
-      sqlite3_bind_int64(statement_p, 4, entry->creation_date);
-      sqlite3_bind_text16(statement_p, 5, entry->origin.data(), 2*entry->origin.size(), SQLITE_STATIC);
-
-      //Call sqlite with the statement
-      if (SQLITE_DONE != sqlite3_step(statement_p)) {
-        //TODO This should be better at handling an error.
-        std::cerr<<"Error updating field in database.\n";
+      if (0 != entry->expiration_date) {
+        oldest = std::min(oldest, entry->expiration_date);
+      }
+      //The version is in the partition of its creation date unless it was
+      //kept in the attributes table when that partition was dropped
+      std::vector<std::string> tables;
+      auto P = partitions.find(partitionOf(entry->creation_date));
+      if (P != partitions.end()) {
+        tables.push_back(P->second);
+      }
+      tables.push_back(unpartitioned.table);
+      for (const std::string& table : tables) {
+        //Get a prepared statement
+        StatementCache::Statement statement_p = statements->get(expirationQuery(table));
+        //Bind this attribute's parameters.
+        sqlite3_bind_int64(statement_p, 1, entry->expiration_date);
+        sqlite3_bind_int64(statement_p, 2, uri_id);
+        sqlite3_bind_int64(statement_p, 3, dictionaryID(name_dictionary, entry->name));
+        sqlite3_bind_int64(statement_p, 4, dictionaryID(origin_dictionary, entry->origin));
+        sqlite3_bind_int64(statement_p, 5, entry->creation_date);
+
+        //Call sqlite with the statement
+        if (SQLITE_DONE != sqlite3_step(statement_p)) {
+          //TODO This should be better at handling an error.
+          std::cerr<<"Error updating field in database.\n";
+        }
+        else if (0 < sqlite3_changes(db_handle)) {
+          break;
+        }
       }
-
-      //Delete the statement
-      sqlite3_finalize(statement_p);
     }
+    invalidateCheckpoints(oldest);
   }
 }
 
@@ -119,21 +846,23 @@ void SQLite3WorldModel::databaseStore(world_model::URI uri, std::vector<world_mo
   if (db_handle != NULL) {
     //SemaphoreLock lck(db_access_control);
 
-    //Create a statement
-    std::string statement_str = "INSERT OR IGNORE INTO 'attributes' VALUES (?1, ?2, ?3, ?4, ?5, ?6);";
-    sqlite3_stmt* statement_p;
-    //Prepare the statement
-    sqlite3_prepare_v2(db_handle, statement_str.c_str(), -1, &statement_p, NULL);
-
+    sqlite3_int64 uri_id = dictionaryID(uri_dictionary, uri);
+    //Storing a version before a checkpoint changes what the checkpoint recorded
+    grail_time oldest = std::numeric_limits<grail_time>::max();
     for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+      oldest = std::min(oldest, entry->creation_date);
       //Increment the insertion count.
       ++inserts_since_analyze;
+      //Get a prepared statement for the partition of this entry
+      StatementCache::Statement statement_p = statements->get("INSERT OR IGNORE INTO " +
+          partitionFor(entry->creation_date) + " (uri_id, name_id, creation_date, expiration_date, origin_id, data) "
+          "VALUES (?1, ?2, ?3, ?4, ?5, ?6);");
       //Bind this attribute's parameters
-      sqlite3_bind_text16(statement_p, 1, uri.data(), 2*uri.size(), SQLITE_STATIC);
-      sqlite3_bind_text16(statement_p, 2, entry->name.data(), 2*entry->name.size(), SQLITE_STATIC);
+      sqlite3_bind_int64(statement_p, 1, uri_id);
+      sqlite3_bind_int64(statement_p, 2, dictionaryID(name_dictionary, entry->name));
       sqlite3_bind_int64(statement_p, 3, entry->creation_date);
       sqlite3_bind_int64(statement_p, 4, entry->expiration_date);
-      sqlite3_bind_text16(statement_p, 5, entry->origin.data(), 2*entry->origin.size(), SQLITE_STATIC);
+      sqlite3_bind_int64(statement_p, 5, dictionaryID(origin_dictionary, entry->origin));
       //The blob's memory is static during this transaction.
       //Otherwise it would be proper to use SQLITE_TRANSIENT to force sqlite to make a copy.
       sqlite3_bind_blob(statement_p, 6, entry->data.data(), entry->data.size(), SQLITE_STATIC);
@@ -143,12 +872,8 @@ void SQLite3WorldModel::databaseStore(world_model::URI uri, std::vector<world_mo
         //TODO This should be better at handling an error.
         std::cerr<<"Error inserting field into database.\n";
       }
-      //Ready the statement for its next use.
-      sqlite3_clear_bindings(statement_p);
-      sqlite3_reset(statement_p);
     }
-    //Delete the statement
-    sqlite3_finalize(statement_p);
+    invalidateCheckpoints(oldest);
 
     //If the number of inserts since the last analyze command is over 9000 then
     //reanalyze the attributes table to possibly reduce SELECT times.
@@ -165,7 +890,10 @@ int existCallback(void* found, int /*n_col*/, char** /*entries*/, char** /*col_n
   return 0;
 }
 
-SQLite3WorldModel::SQLite3WorldModel(std::string db_name) {
+SQLite3WorldModel::SQLite3WorldModel(std::string db_name) :
+  checkpoint_interval(default_checkpoint_interval), checkpoint_retention(default_checkpoint_retention),
+  latest_checkpoint(no_checkpoint), has_retention(false), next_retention(0),
+  last_watermark(0), image_recorded(false) {
   if ("" == db_name) {
     db_handle = NULL;
     std::cerr<<"World model will operate without persistent storage.\n";
@@ -201,96 +929,54 @@ SQLite3WorldModel::SQLite3WorldModel(std::string db_name) {
     //sqlite3_exec(db_handle, "PRAGMA journal_mode = TRUNCATE", NULL, 0, NULL);
 
     //Check to see if the attributes table exists and create it if it does not.
-    bool fresh_db = false;
-    {
+    //Databases from before the uris, names, and origins tables were added
+    //are migrated to the current schema.
+    if (NULL != db_handle) {
       //Check if the 'attributes' table exists.
       bool found = false;
       char* err;
       sqlite3_exec(db_handle, "SELECT name FROM sqlite_master WHERE type='table' AND name='attributes';",
           existCallback, &found, &err);
-      if (NULL != err) {
-        std::cerr<<"Error querying database: "<<err<<'\n';
-        sqlite3_free(err);
-        sqlite3_close(db_handle);
-        db_handle = NULL;
-        std::cerr<<"World model will operate without persistent storage.\n";
-      }
-      //Create an attributes table if one didn't exist
-      if (not found) {
-        fresh_db = true;
-        sqlite3_exec(db_handle, "CREATE TABLE 'attributes' ('uri' TEXT, 'name' TEXT, creation_date INTEGER, expiration_date INTEGER, 'origin' TEXT, 'data' BLOB);",
-            NULL, NULL, &err);
-        if (NULL != err) {
-          std::cerr<<"Error creating URIs table: "<<err<<'\n';
-          sqlite3_free(err);
-          sqlite3_close(db_handle);
-          db_handle = NULL;
-          std::cerr<<"World model will operate without persistent storage.\n";
-        }
-        else {
-          //Create an index on times to make this table faster
-          sqlite3_exec(db_handle, "create index create_expire ON attributes (creation_date, expiration_date);", NULL, NULL, &err);
-          if (NULL != err) {
-            std::cerr<<"Error creating index: "<<err<<'\n';
-            sqlite3_free(err);
-            sqlite3_close(db_handle);
-            db_handle = NULL;
-            std::cerr<<"World model will operate without persistent storage.\n";
-          }
-          //Create another index on the uri, name, and origin to speed up GROUP by requests
-          else {
-            sqlite3_exec(db_handle, "create index uri_name_orig_index ON attributes (uri, name, origin);", NULL, NULL, &err);
-            if (NULL != err) {
-              std::cerr<<"Error creating index: "<<err<<'\n';
-              sqlite3_free(err);
-              sqlite3_close(db_handle);
-              db_handle = NULL;
-              std::cerr<<"World model will operate without persistent storage.\n";
-            }
-          }
+      int version = 0;
+      if (NULL == err) {
+        sqlite3_stmt* statement_p;
+        sqlite3_prepare_v2(db_handle, "PRAGMA user_version;", -1, &statement_p, NULL);
+        if (SQLITE_ROW == sqlite3_step(statement_p)) {
+          version = sqlite3_column_int(statement_p, 0);
         }
+        sqlite3_finalize(statement_p);
       }
-    }
-    //Check to see if the current table exists and create it if it does not.
-    {
-      //Check if the 'current' table exists.
-      bool found = false;
-      char* err;
-      sqlite3_exec(db_handle, "SELECT name FROM sqlite_master WHERE type='table' AND name='current';",
-          existCallback, &found, &err);
+      bool success = true;
       if (NULL != err) {
         std::cerr<<"Error querying database: "<<err<<'\n';
         sqlite3_free(err);
+        success = false;
+      }
+      else if (not found) {
+        success = createSchema();
+      }
+      else if (version < 2) {
+        success = migrateSchema();
+      }
+      //Partitions were added in version 3. Earlier history stays in the attributes table.
+      success = success and execute(db_handle, checkpoint_tables + image_table + partition_tables +
+          "PRAGMA user_version = " + std::to_string(schema_version) + ";");
+      if (not success) {
         sqlite3_close(db_handle);
         db_handle = NULL;
         std::cerr<<"World model will operate without persistent storage.\n";
       }
-      //Create an attributes table if one didn't exist
-      if (not found) {
-        //Use uri, name, and origin as primary key. Don't store data in this table.
-        sqlite3_exec(db_handle, "CREATE TABLE 'current' ('uri' TEXT not null, 'name' TEXT not null, creation_date INTEGER, expiration_date INTEGER, 'origin' TEXT not null, PRIMARY KEY('uri', 'name', 'origin'));",
-            NULL, NULL, &err);
-        if (NULL != err) {
-          std::cerr<<"Error creating current table: "<<err<<'\n';
-          sqlite3_free(err);
-          sqlite3_close(db_handle);
-          db_handle = NULL;
-          std::cerr<<"World model will operate without persistent storage.\n";
-        }
-        //Check if we are updating from an old database. If so then we need to populate this
-        //table.
-        if (not fresh_db) {
-          std::string request = std::string("INSERT INTO current (uri, name, creation_date, expiration_date, origin) ") +
-            "SELECT uri, name, MAX(creation_date), expiration_date, origin FROM attributes GROUP BY uri, name, origin;";
-
-          //Prepare the statement
-          sqlite3_stmt* statement_p;
-          sqlite3_prepare_v2(db_handle, request.c_str(), -1, &statement_p, NULL);
-          while (SQLITE_ROW == sqlite3_step(statement_p)) {
+      else {
+        statements.reset(new StatementCache(db_handle));
+        for (const Partition& partition : partitionsBetween(*statements, 0, std::numeric_limits<grail_time>::max())) {
+          if (partition.table != unpartitioned.table) {
+            partitions[partitionOf(partition.start)] = partition.table;
           }
-          //Delete the statement
-          sqlite3_finalize(statement_p);
         }
+        latest_checkpoint = latestCheckpoint(std::numeric_limits<grail_time>::max());
+        journal.reset(new WriteJournal(db_handle));
+        readers.reset(new ReadConnectionPool(db_name));
+        image_name = db_name + ".state";
       }
     }
   }
@@ -299,31 +985,111 @@ SQLite3WorldModel::SQLite3WorldModel(std::string db_name) {
     sqlite3_exec(db_handle, "ANALYZE attributes;", NULL, NULL, NULL);
     inserts_since_analyze = 0;
   }
-  //Load existing values using the current table.
-  //Load existing values using the current table.
-  {
+  //Load existing values from the state image if nothing was written after it
+  //was saved, otherwise using the current table.
+  bool loaded_image = false;
+  if (statements) {
+    StatementCache::Statement statement_p = statements->get("SELECT watermark FROM state_image;");
+    if (SQLITE_ROW == sqlite3_step(statement_p)) {
+      image_recorded = true;
+      loaded_image = StateImage::load(image_name, sqlite3_column_int64(statement_p, 0), cur_state, transient);
+    }
+  }
+  if (loaded_image) {
+    std::cerr<<"Loaded the current state from "<<image_name<<".\n";
+  }
+  else if (statements) {
     //Current request is around 1 million, the group by gets around 24000, the single request is around 4000
     //select uri, name, MAX(creation_date), expiration_date, origin, HEX(data)  from attributes where uri = "winlab.anchor.pipsqueak.receiver.161" GROUP BY name, origin;
     //select uri, name, MAX(creation_date), expiration_date, origin, HEX(data)  from attributes where uri = "winlab.anchor.pipsqueak.receiver.161" and name = "percent packets received.double";
 
-    //First find all of the URIs and names we need to load
-    std::string request = "select attributes.uri, attributes.name, attributes.creation_date, attributes.expiration_date, attributes.origin, attributes.data from current inner join attributes on (attributes.uri = current.uri and attributes.origin = current.origin and attributes.name = current.name and attributes.creation_date = current.creation_date and attributes.expiration_date = current.expiration_date);";
-    //Prepare the statement
-    sqlite3_stmt* statement_p;
-    sqlite3_prepare_v2(db_handle, request.c_str(), -1, &statement_p, NULL);
-    cur_state = fetchWorldData(statement_p);
+    //Find the current values in each partition
+    world_state loaded;
+    std::vector<Partition> all = partitionsBetween(*statements, no_checkpoint, std::numeric_limits<grail_time>::max());
+    forEachBatch({}, all, [&](const std::vector<Partition>&, const std::vector<Partition>& batch) {
+        StatementCache::Statement statement_p = statements->get(currentQuery(batch));
+        world_state found = fetchWorldData(statement_p);
+        for (auto I = found.begin(); I != found.end(); ++I) {
+          std::vector<world_model::Attribute>& attributes = loaded[I->first];
+          attributes.insert(attributes.end(), I->second.begin(), I->second.end());
+        }});
+    cur_state.assign(loaded);
   }
   //Set a timeout for slow operations
   if (db_handle != NULL) {
     //Time out after 30,000 ms (30 seconds)
     sqlite3_busy_timeout(db_handle, 30000);
   }
+  //The latest checkpoint was taken checkpoint_lag after its time so take the
+  //next one an interval after that, or an interval from now if there are none
+  if (no_checkpoint == latest_checkpoint) {
+    next_checkpoint = world_model::getGRAILTime() + checkpoint_interval;
+  }
+  else {
+    next_checkpoint = latest_checkpoint + checkpoint_lag + checkpoint_interval;
+  }
   //std::vector<std::u16string> all_attribs{u".*"};
   //cur_state = historicSnapshot(u".*", all_attribs, 0, MAX_GRAIL_TIME);
   std::cerr<<"World model loaded.\n";
 }
 
+bool SQLite3WorldModel::createSchema() {
+  return execute(db_handle, "BEGIN TRANSACTION;" + schema_tables + schema_indexes +
+      "PRAGMA user_version = " + std::to_string(schema_version) + "; COMMIT TRANSACTION;");
+}
+
+bool SQLite3WorldModel::migrateSchema() {
+  std::cerr<<"Migrating the database to schema version "<<schema_version<<". This may take a while.\n";
+  bool has_current = false;
+  sqlite3_exec(db_handle, "SELECT name FROM sqlite_master WHERE type='table' AND name='current';",
+      existCallback, &has_current, NULL);
+
+  //Keep the old tables until their data has been copied into the new ones
+  std::string migration = "BEGIN TRANSACTION;"
+    "ALTER TABLE attributes RENAME TO old_attributes;";
+  if (has_current) {
+    migration += "ALTER TABLE current RENAME TO old_current;";
+  }
+  migration += schema_tables +
+    "INSERT OR IGNORE INTO uris (value) SELECT DISTINCT uri FROM old_attributes;"
+    "INSERT OR IGNORE INTO names (value) SELECT DISTINCT name FROM old_attributes;"
+    "INSERT OR IGNORE INTO origins (value) SELECT DISTINCT origin FROM old_attributes;"
+    "INSERT INTO attributes (uri_id, name_id, creation_date, expiration_date, origin_id, data) "
+      "SELECT uris.id, names.id, creation_date, expiration_date, origins.id, data FROM old_attributes "
+      "JOIN uris ON uris.value = old_attributes.uri JOIN names ON names.value = old_attributes.name "
+      "JOIN origins ON origins.value = old_attributes.origin;";
+  //Index after copying since that is faster than updating the index for each row
+  migration += schema_indexes;
+  //Databases from before the current table was added need to populate it
+  if (has_current) {
+    migration += "INSERT INTO current (uri_id, name_id, creation_date, expiration_date, origin_id) "
+      "SELECT uris.id, names.id, creation_date, expiration_date, origins.id FROM old_current "
+      "JOIN uris ON uris.value = old_current.uri JOIN names ON names.value = old_current.name "
+      "JOIN origins ON origins.value = old_current.origin;"
+      "DROP TABLE old_current;";
+  }
+  else {
+    migration += "INSERT INTO current (uri_id, name_id, creation_date, expiration_date, origin_id) "
+      "SELECT uri_id, name_id, MAX(creation_date), expiration_date, origin_id FROM attributes "
+      "GROUP BY uri_id, name_id, origin_id;";
+  }
+  migration += "DROP TABLE old_attributes;"
+    "PRAGMA user_version = " + std::to_string(schema_version) + ";"
+    "COMMIT TRANSACTION;";
+  if (not execute(db_handle, migration)) {
+    sqlite3_exec(db_handle, "ROLLBACK TRANSACTION;", NULL, NULL, NULL);
+    return false;
+  }
+  std::cerr<<"Migration complete.\n";
+  return true;
+}
+
 SQLite3WorldModel::~SQLite3WorldModel() {
+  //Commit any waiting writes, then finalize the cached statements
+  //before the connection is closed
+  readers.reset();
+  journal.reset();
+  statements.reset();
   if (NULL != db_handle) {
     sqlite3_close(db_handle);
   }
@@ -337,24 +1103,112 @@ bool SQLite3WorldModel::createURI(world_model::URI uri,
   std::vector<world_model::Attribute> to_store{Attribute{u"creation", creation, 0, origin, {}}};
   //Lock the access control to get unique access to the world state.
   {
-    SemaphoreLock lck(access_control);
+    SymbolTable::Symbol uri_id = SymbolTable::intern(uri);
+    ShardLock lck(cur_state, uri_id);
 
     //The URI cannot be created twice - just return if this already exists.
-    if (cur_state.find(uri) != cur_state.end()) {
+    if (lck->find(uri_id) != lck->end()) {
       return false;
     }
 
     //Create this URI and push on a creation attribute
-    cur_state[uri].push_back(to_store[0]);
+    (*lck)[uri_id].push_back(InternedAttribute(to_store[0]));
   }
 
-  //Put this URI into the database
-  databaseStore(uri, to_store);
-  //Also update the current table
-  currentUpdate(uri, to_store);
+  //Put this URI into the database and also update the current table
+  if (journal) {
+    journal->append([this, uri, to_store]() mutable {
+        forgetImage();
+        databaseStore(uri, to_store);
+        currentUpdate(uri, to_store);});
+  }
   return true;
 }
 
+//Find the neighbors of an out of order entry in the database
+void SQLite3WorldModel::spliceFromDatabase(const world_model::URI& uri, world_model::Attribute& entry,
+    std::vector<world_model::Attribute>& to_expire) {
+  //Check the database for the previous entry by creation date
+  //Update that entry's expiration date to the new entry's creation date
+  //and set the new entry's expiration to the other entry's expiration
+  //Only look up ids here since inserts belong in the journal. If a value is
+  //not in the dictionary then nothing stored can be a neighbor.
+  sqlite3_int64 db_uri, db_name, db_origin;
+  if (not (findDictionaryID(uri_dictionary, uri, db_uri) and
+           findDictionaryID(name_dictionary, entry.name, db_name) and
+           findDictionaryID(origin_dictionary, entry.origin, db_origin))) {
+    return;
+  }
+  //Find the nearest neighbor in a table, returning false if there is none
+  auto neighbor = [&](bool before, const std::string& table, world_model::Attribute& found) {
+    StatementCache::Statement statement_p = statements->get(neighborQuery(before, table));
+    //Bind this attribute's parameters.
+    sqlite3_bind_int64(statement_p, 1, entry.creation_date);
+    sqlite3_bind_int64(statement_p, 2, db_uri);
+    sqlite3_bind_int64(statement_p, 3, db_name);
+    sqlite3_bind_int64(statement_p, 4, db_origin);
+    world_state result = fetchWorldData(statement_p);
+    if (result[uri].size() != 1) {
+      return false;
+    }
+    found = result[uri].front();
+    return true;
+  };
+  //Search the attributes table and then the partitions outward from the
+  //entry's creation date, stopping at the first partition with a neighbor
+  std::vector<Partition> tables = partitionsBetween(*statements, 0, std::numeric_limits<grail_time>::max());
+  auto nearest = [&](bool before, world_model::Attribute& found) {
+    bool has_found = neighbor(before, unpartitioned.table, found);
+    auto closer = [&](const world_model::Attribute& attr) {
+      return not has_found or (before ? attr.creation_date > found.creation_date :
+                                        attr.creation_date < found.creation_date);
+    };
+    world_model::Attribute candidate;
+    auto check = [&](const Partition& partition) {
+      if (neighbor(before, partition.table, candidate)) {
+        if (closer(candidate)) {
+          found = candidate;
+        }
+        has_found = true;
+        return true;
+      }
+      return false;
+    };
+    if (before) {
+      for (auto P = tables.rbegin(); P != tables.rend() and P->table != unpartitioned.table; ++P) {
+        if (P->start <= entry.creation_date and check(*P)) {
+          break;
+        }
+      }
+    }
+    else {
+      for (const Partition& partition : tables) {
+        if (partition.table != unpartitioned.table and partition.end > entry.creation_date and check(partition)) {
+          break;
+        }
+      }
+    }
+    return has_found;
+  };
+
+  world_model::Attribute previous;
+  //No result? then the expiration is equal to the earliest creation date of this attribute
+  if (not nearest(true, previous)) {
+    world_model::Attribute next;
+    if (nearest(false, next)) {
+      entry.expiration_date = next.creation_date;
+    }
+    //Shouldn't ever hit the else case (would imply the attribute
+    //exists but isn't in the database)
+  }
+  else {
+    //Update the entry and the attribute from the database
+    entry.expiration_date = previous.expiration_date;
+    previous.expiration_date = entry.creation_date;
+    to_expire.push_back(previous);
+  }
+}
+
 //Block access to the world model until this new information is added to it
 bool SQLite3WorldModel::insertData(std::vector<std::pair<world_model::URI, std::vector<world_model::Attribute>>> new_data, bool autocreate) {
   //Handle the map first, then push data to the database.
@@ -363,7 +1217,7 @@ bool SQLite3WorldModel::insertData(std::vector<std::pair<world_model::URI, std::
   //auto time_start = world_model::getGRAILTime();
 
   //First check if there are any transient values here and process them separately
-  std::map<URI, std::vector<world_model::Attribute>> transients;
+  SharedState transients;
   {
     std::unique_lock<std::mutex> lck(transient_lock);
     //Loop through the new data and remove transient attributes from new_data.
@@ -378,9 +1232,10 @@ bool SQLite3WorldModel::insertData(std::vector<std::pair<world_model::URI, std::
       auto entry = entries.begin();
       while (entry != entries.end()) {
         //Do not process transient types normally.
-        bool is_transient = 0 != transient.count(make_pair(entry->name, entry->origin));
+        bool is_transient = 0 != transient.count(std::make_pair(
+              SymbolTable::intern(entry->name), SymbolTable::intern(entry->origin)));
         if (is_transient){
-          transients[uri].push_back(*entry);
+          transients[uri].push_back(InternedAttribute(*entry));
           entry = entries.erase(entry);
         }
         else {
@@ -405,29 +1260,34 @@ bool SQLite3WorldModel::insertData(std::vector<std::pair<world_model::URI, std::
   //data and automatically create new URIs if autocreate
   //is specified.
   std::map<URI, vector<world_model::Attribute>> to_expire;
-  std::map<URI, vector<world_model::Attribute>> current_update;
+  //The current updates share their data with the current state so that
+  //they can be passed to the standing queries without copying it.
+  SharedState current_update;
   //Remember new URIs so that they can be stored after
   //the locks are released
   std::vector<world_model::Attribute> to_store;
+  //Positions in new_data of entries too old for the recent history
+  std::vector<std::pair<size_t, size_t>> unresolved;
   for (auto I = new_data.begin(); I != new_data.end(); ++I) {
     world_model::URI& uri = I->first;
     std::vector<world_model::Attribute>& entries = I->second;
 
     if (not entries.empty()) {
-      SemaphoreLock access_lock(access_control);
+      SymbolTable::Symbol uri_id = SymbolTable::intern(uri);
+      ShardLock access_lock(cur_state, uri_id);
 
       //The URI cannot be created through this message unless
       //autocreate was set to true.
-      if (cur_state.find(uri) == cur_state.end()) {
+      if (access_lock->find(uri_id) == access_lock->end()) {
         //Make the URI if it doesn't exist and autocreate is specified
         if (autocreate) {
           world_model::Attribute creation_attr{u"creation", entries.front().creation_date, 0, entries.front().origin, {}};
           //Create this URI and push on a creation attribute
-          cur_state[uri].push_back(creation_attr);
+          (*access_lock)[uri_id].push_back(InternedAttribute(creation_attr));
           //Remember this attribute and push it into the db once we have
           //released the locks so that we don't block other threads
           entries.push_back(creation_attr);
-          current_update[uri].push_back(creation_attr);
+          current_update[uri].push_back((*access_lock)[uri_id].back());
         }
         else {
           //Don't insert anything from this URI
@@ -436,70 +1296,59 @@ bool SQLite3WorldModel::insertData(std::vector<std::pair<world_model::URI, std::
       }
 
       //Get a reference to this URI's attributes for easy access
-      std::vector<world_model::Attribute>& attributes = cur_state[uri];
+      std::vector<InternedAttribute>& attributes = (*access_lock)[uri_id];
 
       //Update the world model with each entry
       for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
         //Check if there is already an entry with the same name and origin
-        auto same_attribute = [&](Attribute& attr) {
-          return (attr.name == entry->name) and (attr.origin == entry->origin);};
+        SymbolTable::Symbol name_id = SymbolTable::intern(entry->name);
+        SymbolTable::Symbol origin_id = SymbolTable::intern(entry->origin);
+        auto same_attribute = [&](InternedAttribute& attr) {
+          return (attr.name == name_id) and (attr.origin == origin_id);};
         auto slot = std::find_if(attributes.begin(), attributes.end(), same_attribute);
         //If no matching solution exists then just insert this new one.
         if (slot == attributes.end()) {
-          attributes.push_back(*entry);
+          recent_history.start(RecentHistory::Key(uri_id, name_id, origin_id), entry->creation_date);
+          attributes.push_back(InternedAttribute(*entry, name_id, origin_id));
           //And update the current db as well
-          current_update[uri].push_back(*entry);
+          current_update[uri].push_back(attributes.back());
         }
         else {
           //If this entry is newer than what is currently in the model update the model
           if (slot->creation_date < entry->creation_date) {
+            recent_history.advance(RecentHistory::Key(uri_id, name_id, origin_id),
+                slot->creation_date, entry->creation_date);
             //Remember the current slot and its expiration time
             slot->expiration_date = entry->creation_date;
-            to_expire[uri].push_back(*slot);
+            to_expire[uri].push_back(slot->toAttribute(false));
             //Now overwrite the slot's value with the new entry
-            *slot = *entry;
+            *slot = InternedAttribute(*entry, name_id, origin_id);
             //And update the current db as well
             current_update[uri].push_back(*slot);
           }
+          //An entry with the current value's creation date (such as the
+          //creation attribute of an autocreated URI) has nothing to expire
+          else if (slot->creation_date == entry->creation_date) {
+            ;
+          }
           else {
-            //Check the database for the previous entry by creation date
-            //Update that entry's expiration date to the new entry's creation date
-            //and set the new entry's expiration to the other entry's expiration
-            //Prepare the statement
-            sqlite3_stmt* statement_p;
-            std::string statement_str = std::string("SELECT uri, name, creation_date, ")+
-              "expiration_date, origin, data FROM attributes WHERE creation_date <= ?1 "+
-              "AND uri = ?2 AND name = ?3 AND origin = ?4 ORDER BY creation_date DESC limit 1;";
-            sqlite3_prepare_v2(db_handle, statement_str.c_str(), -1, &statement_p, NULL);
-            //Bind this attribute's parameters.
-            sqlite3_bind_int64(statement_p, 1, entry->creation_date);
-            sqlite3_bind_text16(statement_p, 2, uri.data(), 2*uri.size(), SQLITE_STATIC);
-            sqlite3_bind_text16(statement_p, 3, entry->name.data(), 2*entry->name.size(), SQLITE_STATIC);
-            sqlite3_bind_text16(statement_p, 4, entry->origin.data(), 2*entry->origin.size(), SQLITE_STATIC);
-            world_state result = fetchWorldData(statement_p);
-
-            //No result? then the expiration is equal to the earliest creation date of this attribute
-            if (result.size() == 0) {
-              std::string statement_str2 = std::string("SELECT uri, name, creation_date, ")+
-                "expiration_date, origin, data FROM attributes WHERE creation_date >= ?1 "+
-                "AND uri = ?2 AND name = ?3 AND origin = ?4 ORDER BY creation_date ASC limit 1;";
-              sqlite3_prepare_v2(db_handle, statement_str2.c_str(), -1, &statement_p, NULL);
-              sqlite3_bind_int64(statement_p, 1, entry->creation_date);
-              sqlite3_bind_text16(statement_p, 2, uri.data(), 2*uri.size(), SQLITE_STATIC);
-              sqlite3_bind_text16(statement_p, 3, entry->name.data(), 2*entry->name.size(), SQLITE_STATIC);
-              sqlite3_bind_text16(statement_p, 4, entry->origin.data(), 2*entry->origin.size(), SQLITE_STATIC);
-              world_state result = fetchWorldData(statement_p);
-              if (result[uri].size() == 1) {
-                entry->expiration_date = result[uri].front().creation_date;
+            //Place this older entry into the attribute's recent history to
+            //find its expiration and the entry that it expires
+            world_model::grail_time expiration;
+            bool has_before;
+            RecentHistory::Version before;
+            if (recent_history.splice(RecentHistory::Key(uri_id, name_id, origin_id),
+                  slot->creation_date, entry->creation_date, expiration, has_before, before)) {
+              entry->expiration_date = expiration;
+              if (has_before) {
+                to_expire[uri].push_back(world_model::Attribute{entry->name,
+                    before.creation_date, before.expiration_date, entry->origin, {}});
               }
-              //Shouldn't ever hit the else case (would imply the attribute
-              //exists but isn't in the database)
             }
+            //Entries older than the history are placed using the database
+            //by the journal, where writes are serialized
             else {
-              //Update the entry and the attribute from the database
-              entry->expiration_date = result[uri].front().expiration_date;
-              result[uri].front().expiration_date = entry->creation_date;
-              to_expire[uri].push_back(result[uri].front());
+              unresolved.push_back(std::make_pair(I - new_data.begin(), entry - entries.begin()));
             }
           }
         }
@@ -510,54 +1359,85 @@ bool SQLite3WorldModel::insertData(std::vector<std::pair<world_model::URI, std::
   //std::cerr<<"Memory insertion time was "<<time_diff<<'\n';
   //time_start = world_model::getGRAILTime();
 
-  //Store all of the entries that were not transient types
-  sqlite3_exec(db_handle, "BEGIN TRANSACTION;", NULL, 0, NULL);
-
-  for (auto I = new_data.begin(); I != new_data.end(); ++I) {
-    if (not I->second.empty()) {
-      databaseStore(I->first, I->second);
+  //Store all of the entries that were not transient types. The journal's
+  //writer thread commits these together with other waiting writes.
+  if (journal) {
+    typedef std::map<URI, vector<world_model::Attribute>> AttributeMap;
+    auto stored = std::make_shared<decltype(new_data)>(std::move(new_data));
+    auto expired = std::make_shared<AttributeMap>(std::move(to_expire));
+    auto old_entries = std::make_shared<decltype(unresolved)>(std::move(unresolved));
+    //The current table does not store data
+    auto current = std::make_shared<AttributeMap>();
+    for (auto I = current_update.begin(); I != current_update.end(); ++I) {
+      if (not I->first.empty()) {
+        std::vector<world_model::Attribute>& current_entries = (*current)[I->first];
+        for (const InternedAttribute& attr : I->second) {
+          current_entries.push_back(attr.toAttribute(false));
+        }
+      }
     }
+    journal->append([this, stored, expired, current, old_entries]() {
+        forgetImage();
+        //Splice and store entries older than the recent history one at a
+        //time so that each sees every earlier write of its attribute
+        for (auto I = old_entries->begin(); I != old_entries->end(); ++I) {
+          world_model::URI& uri = (*stored)[I->first].first;
+          std::vector<world_model::Attribute> entry{(*stored)[I->first].second[I->second]};
+          std::vector<world_model::Attribute> spliced;
+          spliceFromDatabase(uri, entry.front(), spliced);
+          databaseStore(uri, entry);
+          if (not spliced.empty()) {
+            databaseUpdate(uri, spliced);
+          }
+        }
+        //Then remove them so that they are not stored again
+        for (auto I = old_entries->rbegin(); I != old_entries->rend(); ++I) {
+          std::vector<world_model::Attribute>& entries = (*stored)[I->first].second;
+          entries.erase(entries.begin() + I->second);
+        }
+        for (auto I = stored->begin(); I != stored->end(); ++I) {
+          if (not I->second.empty()) {
+            databaseStore(I->first, I->second);
+          }
+        }
+        //Update expiration times
+        for (auto I = expired->begin(); I != expired->end(); ++I) {
+          if (not I->second.empty()) {
+            //Update values in the attributes database
+            databaseUpdate(I->first, I->second);
+          }
+        }
+        for (auto I = current->begin(); I != current->end(); ++I) {
+          currentUpdate(I->first, I->second);
+        }});
   }
-  //Update expiration times
-  for (auto I = to_expire.begin(); I != to_expire.end(); ++I) {
-    if (not I->second.empty()) {
-      //Update values in the attributes database
-      databaseUpdate(I->first, I->second);
+
+  //Periodically checkpoint the state. Only one thread claims each checkpoint.
+  grail_time now = world_model::getGRAILTime();
+  if (0 < checkpoint_interval) {
+    grail_time due = next_checkpoint;
+    if (now >= due and next_checkpoint.compare_exchange_strong(due, now + checkpoint_interval)) {
+      //Leave time for late data so that it does not invalidate the checkpoint
+      checkpoint(now - checkpoint_lag);
     }
   }
-  for (auto I = current_update.begin(); I != current_update.end(); ++I) {
-    if (not I->first.empty()) {
-      //Also update the current table
-      currentUpdate(I->first, I->second);
+  //Apply the retention rules the same way
+  if (has_retention) {
+    grail_time due = next_retention;
+    if (now >= due and next_retention.compare_exchange_strong(due, now + retention_interval)) {
+      applyRetention(now);
     }
   }
-  sqlite3_exec(db_handle, "COMMIT TRANSACTION;", NULL, 0, NULL);
 
   //time_diff = world_model::getGRAILTime() - time_start;
   //std::cerr<<"DB insertion time was "<<time_diff<<'\n';
   //time_start = world_model::getGRAILTime();
 
-  auto push = [&](StandingQuery* sq) {
-    //First see what items are of interest. This also tells the standing
-    //query to remember partial matches so we do not need to keep feeding
-    //it the current state, only the updates.
-    auto ws = sq->showInterested(current_update);
-    //Insert the data.
-    if (not ws.empty()) {
-      std::cerr<<"Inserting "<<ws.size()<<" entries for the standing query.\n";
-      sq->insertData(ws);
-    }
-    //Insert transients separately from normal data to enforce exact string matching
-    ws = sq->showInterestedTransient(transients);
-    if (not ws.empty()) {
-      std::cerr<<"Inserting "<<ws.size()<<" transient entries for the standing query.\n";
-      sq->insertData(ws);
-    }
-  };
-  StandingQuery::for_each(push);
-  //TODO FIXME Shorter if StandingQuery::offerData handled transient data.
-  //Send data to the standing queries
-  //StandingQuery::offerData(current_update, false, false);
+  //Queue the new data and transients for the standing queries. Matching
+  //happens on the standing query threads so this does not wait on clients.
+  if (not current_update.empty() or not transients.empty()) {
+    StandingQuery::offerData(current_update, false, false, transients);
+  }
   //time_diff = world_model::getGRAILTime() - time_start;
   //std::cerr<<"Standing query insertion time was "<<time_diff<<'\n';
 
@@ -572,31 +1452,40 @@ void SQLite3WorldModel::expireURI(world_model::URI uri, world_model::grail_time
   //Now remove the URI and its attributes from the current world model
   //Lock the access control to get unique access to the world state.
   {
-    SemaphoreLock lck(access_control);
+    SymbolTable::Symbol uri_id;
+    //A URI that was never interned cannot be in the world model
+    if (not SymbolTable::find(uri, uri_id)) {
+      return;
+    }
+    ShardLock lck(cur_state, uri_id);
     //The URI cannot be created through this message
-    if (cur_state.find(uri) == cur_state.end()) {
+    if (lck->find(uri_id) == lck->end()) {
       return;
     }
 
     //Copy over all of the attributes and expire them, then remove this
     //uri from the in-memory world memory.
-    for (auto I = cur_state[uri].begin(); I != cur_state[uri].end(); ++I) {
+    SymbolTable::Symbol creation_id = SymbolTable::intern(u"creation");
+    for (auto I = (*lck)[uri_id].begin(); I != (*lck)[uri_id].end(); ++I) {
       I->expiration_date = expires;
-      if (I->name == u"creation") {
-        to_expire.push_back(*I);
+      if (I->name == creation_id) {
+        to_expire.push_back(I->toAttribute());
       }
     }
-    cur_state.erase(uri);
+    lck->erase(uri_id);
+    recent_history.forget(uri_id);
+  }
+  if (journal) {
+    journal->append([this, uri, to_expire]() mutable {
+        forgetImage();
+        databaseUpdate(uri, to_expire);
+        currentUpdate(uri, to_expire);});
   }
-  sqlite3_exec(db_handle, "BEGIN TRANSACTION;", NULL, 0, NULL);
-  databaseUpdate(uri, to_expire);
-  currentUpdate(uri, to_expire);
-  sqlite3_exec(db_handle, "COMMIT TRANSACTION;", NULL, 0, NULL);
 
   //Offer a world state with the expiration date set to indicate expiration.
   WorldState changed_entry;
   changed_entry[uri] = to_expire;
-  StandingQuery::offerData(changed_entry, false, true);
+  StandingQuery::offerData(toSharedState(changed_entry), false, true);
 }
 
 void SQLite3WorldModel::expireURIAttributes(world_model::URI uri, std::vector<world_model::Attribute>& entries, world_model::grail_time expires) {
@@ -606,57 +1495,76 @@ void SQLite3WorldModel::expireURIAttributes(world_model::URI uri, std::vector<wo
 
   //Lock the access control to get unique access to the world state.
   {
-    SemaphoreLock lck(access_control);
+    SymbolTable::Symbol uri_id;
+    //A URI that was never interned cannot be in the world model
+    if (not SymbolTable::find(uri, uri_id)) {
+      return;
+    }
+    ShardLock lck(cur_state, uri_id);
 
     //Nothing to do if there isn't a URI
-    if (cur_state.find(uri) == cur_state.end()) {
+    if (lck->find(uri_id) == lck->end()) {
       return;
     }
 
     //Get a reference to this URI's attributes for easy access
-    std::vector<world_model::Attribute>& attributes = cur_state[uri];
+    std::vector<InternedAttribute>& attributes = (*lck)[uri_id];
 
     //Update the world model with each entry
     for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
       //Check if there is an entry that matches this one
-      auto same_attribute = [&](Attribute& attr) {
-        return (attr.name == entry->name) and
-          (attr.origin == entry->origin) and
+      SymbolTable::Symbol name_id, origin_id;
+      if (not (SymbolTable::find(entry->name, name_id) and
+            SymbolTable::find(entry->origin, origin_id))) {
+        continue;
+      }
+      auto same_attribute = [&](InternedAttribute& attr) {
+        return (attr.name == name_id) and
+          (attr.origin == origin_id) and
           (attr.creation_date == entry->creation_date);};
       auto slot = std::find_if(attributes.begin(), attributes.end(), same_attribute);
       //If a matching solution exists then update the database and erase this
       //from the current model.
       if (slot != attributes.end()) {
         slot->expiration_date = expires;
-        to_update.push_back(*slot);
+        to_update.push_back(slot->toAttribute());
         attributes.erase(slot);
+        recent_history.forget(RecentHistory::Key(uri_id, name_id, origin_id));
       }
     }
   }
-  sqlite3_exec(db_handle, "BEGIN TRANSACTION;", NULL, 0, NULL);
-  databaseUpdate(uri, to_update);
-  currentUpdate(uri, to_update);
-  sqlite3_exec(db_handle, "COMMIT TRANSACTION;", NULL, 0, NULL);
+  if (journal) {
+    journal->append([this, uri, to_update]() mutable {
+        forgetImage();
+        databaseUpdate(uri, to_update);
+        currentUpdate(uri, to_update);});
+  }
 
   //Offer a world state with the expiration date of attributes set to indicate
   //their expiration.
   WorldState changed_entry;
   changed_entry[uri] = entries;
-  StandingQuery::offerData(changed_entry, true, false);
+  StandingQuery::offerData(toSharedState(changed_entry), true, false);
 }
 
 void SQLite3WorldModel::deleteURI(world_model::URI uri) {
   //Remove the URI and its attributes from the current world model
   //Lock the access control to get unique access to the world state.
   {
-    SemaphoreLock lck(access_control);
+    SymbolTable::Symbol uri_id;
+    //A URI that was never interned cannot be in the world model
+    if (not SymbolTable::find(uri, uri_id)) {
+      return;
+    }
+    ShardLock lck(cur_state, uri_id);
     //The URI cannot be created through this message
-    if (cur_state.find(uri) == cur_state.end()) {
+    if (lck->find(uri_id) == lck->end()) {
       return;
     }
 
     //Delete this URI from the world model
-    cur_state.erase(uri);
+    lck->erase(uri_id);
+    recent_history.forget(uri_id);
   }
   //Remove this URI from the database
   //If the database is not being used then just return here.
@@ -665,34 +1573,27 @@ void SQLite3WorldModel::deleteURI(world_model::URI uri) {
   }
 
   //SemaphoreLock lck(db_access_control);
-  sqlite3_exec(db_handle, "BEGIN TRANSACTION;", NULL, 0, NULL);
-  std::vector<std::string> db_names{"attributes", "current"};
-  for (auto I = db_names.begin(); I != db_names.end(); ++I) {
-    //Access the database for this information
-    std::ostringstream request_stream;
-    request_stream << "DELETE FROM "+(*I)+" WHERE uri = ?1;";
-    //Prepare the statement
-    sqlite3_stmt* statement_p;
-    sqlite3_prepare_v2(db_handle, request_stream.str().c_str(), -1, &statement_p, NULL);
-    //Bind this attribute's parameters.
-    sqlite3_bind_text16(statement_p, 1, uri.data(), 2*uri.size(), SQLITE_STATIC);
-    //for (int idx = 0; idx < desired_attributes.size(); ++idx) {
-    //sqlite3_bind_text16(statement_p, 1+idx, desired_attributes[idx].data(), 2*desired_attributes[idx].size(), SQLITE_STATIC);
-    //}
-    //Execute the delete statement
-    while (SQLITE_ROW == sqlite3_step(statement_p)) {;
-    }
-    //Delete the statement
-    sqlite3_finalize(statement_p);
-  }
-  sqlite3_exec(db_handle, "COMMIT TRANSACTION;", NULL, 0, NULL);
+  journal->append([this, uri]() {
+      forgetImage();
+      sqlite3_int64 db_uri = dictionaryID(uri_dictionary, uri);
+      std::vector<std::string> db_names = historyTables();
+      db_names.push_back("current");
+      for (auto I = db_names.begin(); I != db_names.end(); ++I) {
+        //Get a prepared statement
+        StatementCache::Statement statement_p = statements->get("DELETE FROM "+(*I)+" WHERE uri_id = ?1;");
+        //Bind this attribute's parameters.
+        sqlite3_bind_int64(statement_p, 1, db_uri);
+        //Execute the delete statement
+        while (SQLITE_ROW == sqlite3_step(statement_p)) {;
+        }
+      }});
   
   //Deletions are the same as expirations from the standing query's perspective
   //Offer a world state with the expiration date set to indicate expiration.
   WorldState changed_entry;
   world_model::Attribute expiration{u"creation", -1, -1, u"", {}};
   changed_entry[uri].push_back(expiration);
-  StandingQuery::offerData(changed_entry, false, true);
+  StandingQuery::offerData(toSharedState(changed_entry), false, true);
 }
 
 void SQLite3WorldModel::deleteURIAttributes(world_model::URI uri, std::vector<world_model::Attribute> entries) {
@@ -711,24 +1612,35 @@ void SQLite3WorldModel::deleteURIAttributes(world_model::URI uri, std::vector<wo
   //Lock the access control to get unique access to the world state.
   //After cleaning up the world state remove these attributes from the database as well
   {
-    SemaphoreLock lck(access_control);
+    SymbolTable::Symbol uri_id;
+    //A URI that was never interned cannot be in the world model
+    if (not SymbolTable::find(uri, uri_id)) {
+      return;
+    }
+    ShardLock lck(cur_state, uri_id);
 
     //Nothing to do if there isn't a matching URI
-    if (cur_state.find(uri) == cur_state.end()) {
+    if (lck->find(uri_id) == lck->end()) {
       return;
     }
 
     //Get a reference to this URI's attributes for easy access
-    std::vector<world_model::Attribute>& attributes = cur_state[uri];
+    std::vector<InternedAttribute>& attributes = (*lck)[uri_id];
 
     //Update the world model with each entry
     for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
       //Check if there is an entry that matches this one
-      auto same_attribute = [&](Attribute& attr) {
-        return (attr.name == entry->name) and (attr.origin == entry->origin);};
+      SymbolTable::Symbol name_id, origin_id;
+      if (not (SymbolTable::find(entry->name, name_id) and
+            SymbolTable::find(entry->origin, origin_id))) {
+        continue;
+      }
+      auto same_attribute = [&](InternedAttribute& attr) {
+        return (attr.name == name_id) and (attr.origin == origin_id);};
       auto slot = std::find_if(attributes.begin(), attributes.end(), same_attribute);
       if (slot != attributes.end()) {
         attributes.erase(slot);
+        recent_history.forget(RecentHistory::Key(uri_id, name_id, origin_id));
       }
     }
   }
@@ -738,51 +1650,34 @@ void SQLite3WorldModel::deleteURIAttributes(world_model::URI uri, std::vector<wo
     return;
   }
 
-  std::ostringstream request_stream;
-  std::string att_request = "";
-  if (entries.size() > 0 ) {
-    att_request += " AND (";
-  }
-  for (int idx = 0; idx < entries.size(); ++idx) {
-    if (idx == 0) {
-      att_request += " (name = ?"+std::to_string(2*idx+2)+" AND origin = ?"+ std::to_string(2*idx+3)+") ";
-    }
-    else {
-      att_request += " OR (name = ?"+std::to_string(2*idx+2)+" AND origin = ?"+ std::to_string(2*idx+3)+") ";
-    }
-  }
-  if (entries.size() > 0 ) {
-    att_request += ") ";
-  }
   //SemaphoreLock lck(db_access_control);
-  sqlite3_exec(db_handle, "BEGIN TRANSACTION;", NULL, 0, NULL);
-  std::vector<std::string> db_names{"attributes", "current"};
-  for (auto I = db_names.begin(); I != db_names.end(); ++I) {
-    request_stream << "DELETE FROM "+(*I)+" WHERE uri = ?1" << att_request << ";";
-    //std::cerr<<"Giving delete request: "<<request_stream.str()<<'\n';
-    //Prepare the statement
-    sqlite3_stmt* statement_p;
-    sqlite3_prepare_v2(db_handle, request_stream.str().c_str(), -1, &statement_p, NULL);
-    //Bind this attribute's parameters.
-    sqlite3_bind_text16(statement_p, 1, uri.data(), 2*uri.size(), SQLITE_STATIC);
-    for (int idx = 0; idx < entries.size(); ++idx) {
-      sqlite3_bind_text16(statement_p, 2*idx + 2, entries[idx].name.data(), 2*entries[idx].name.size(), SQLITE_STATIC);
-      sqlite3_bind_text16(statement_p, 2*idx + 3, entries[idx].origin.data(), 2*entries[idx].origin.size(), SQLITE_STATIC);
-    }
-    //Execute the delete statement
-    while (SQLITE_ROW == sqlite3_step(statement_p)) {;
-    }
-    //Delete the statement
-    sqlite3_finalize(statement_p);
-  }
-  sqlite3_exec(db_handle, "COMMIT TRANSACTION;", NULL, 0, NULL);
+  journal->append([this, uri, entries]() {
+      forgetImage();
+      //Delete each attribute separately so that every delete is an index lookup
+      sqlite3_int64 db_uri = dictionaryID(uri_dictionary, uri);
+      std::vector<std::string> db_names = historyTables();
+      db_names.push_back("current");
+      for (auto I = db_names.begin(); I != db_names.end(); ++I) {
+        std::string request = "DELETE FROM "+(*I)+" WHERE uri_id = ?1 AND name_id = ?2 AND origin_id = ?3;";
+        for (auto entry = entries.begin(); entry != entries.end(); ++entry) {
+          //Get a prepared statement
+          StatementCache::Statement statement_p = statements->get(request);
+          //Bind this attribute's parameters.
+          sqlite3_bind_int64(statement_p, 1, db_uri);
+          sqlite3_bind_int64(statement_p, 2, dictionaryID(name_dictionary, entry->name));
+          sqlite3_bind_int64(statement_p, 3, dictionaryID(origin_dictionary, entry->origin));
+          //Execute the delete statement
+          while (SQLITE_ROW == sqlite3_step(statement_p)) {;
+          }
+        }
+      }});
   
   //Deletions are the same as expirations from the standing query's perspective
   //Offer a world state with the expiration date of attributes set to indicate
   //their expiration.
   WorldState changed_entry;
   changed_entry[uri] = entries;
-  StandingQuery::offerData(changed_entry, true, false);
+  StandingQuery::offerData(toSharedState(changed_entry), true, false);
 }
 
 
@@ -816,9 +1711,6 @@ WorldModel::world_state SQLite3WorldModel::fetchWorldData(sqlite3_stmt* statemen
       cur_vec.push_back(attr);
     }
   }
-
-  //Delete the statement
-  sqlite3_finalize(statement_p);
   return ws;
 }
 
@@ -828,85 +1720,71 @@ WorldModel::world_state SQLite3WorldModel::fetchWorldData(sqlite3_stmt* statemen
  */
 WorldModel::world_state SQLite3WorldModel::historicSnapshot(const world_model::URI& uri,
                                     std::vector<std::u16string> desired_attributes,
-                                    world_model::grail_time start, world_model::grail_time stop) {
+                                    world_model::grail_time /*start*/, world_model::grail_time stop) {
   //Return an empty result if there is no database access
   if (db_handle == NULL or desired_attributes.empty()) {
     return WorldModel::world_state();
   }
+  //Include any writes still waiting in the journal
+  journal->sync();
 
   //Combine all of the requests into a single regular expression to speed up the search.
-  std::u16string single_expression = u"(" + desired_attributes[0];
-  for (auto I = desired_attributes.begin()+1; I != desired_attributes.end(); ++I) {
-    single_expression += u"|" + *I;
+  //A single request is used as it is so that its literal prefix can be found.
+  std::u16string single_expression = desired_attributes[0];
+  if (1 < desired_attributes.size()) {
+    single_expression = u"(" + desired_attributes[0];
+    for (auto I = desired_attributes.begin()+1; I != desired_attributes.end(); ++I) {
+      single_expression += u"|" + *I;
+    }
+    single_expression += u")";
   }
-  single_expression += u")";
 
   //Access the database for this information
-  //Start assembling the query
-  //TODO FIXME There are a lot of different kinds of requests here but all have
-  //about the same results. DB access is still distressingly slow, but probably
-  //for some reason other than access time so we can probably clean this up.
-  std::ostringstream request_stream;
-  //In this request ?1 is the start time, ?2 is the end time, ?3 is the URI and
-  //all other SQLITE variables are attribute name expressions
-  //request_stream << "SELECT A2.uri, A2.name, MAX(A2.creation_date), A2.expiration_date, A2.origin, A2.data "<<
-    //"FROM attributes as A2, attributes as A1 WHERE A1.creation_date < ?2 AND A1.name = 'creation' "<<
-    //"AND (A1.expiration_date == 0 OR A1.expiration_date > ?2) AND A1.uri REGEXP ?3 AND A2.uri = A1.uri "<<
-    //"AND A2.creation_date BETWEEN ?1 and ?2 AND (A2.expiration_date == 0 OR A2.expiration_date > ?2) AND "<<
-    //"A2.name REGEXP ?4 GROUP BY A2.uri, A2.name, A2.origin;";
-    //
-  //request_stream << "SELECT A2.uri, A2.name, MAX(A2.creation_date), A2.expiration_date, A2.origin, A2.data "<<
-    //"FROM attributes as A2, attributes as A1 WHERE A1.creation_date < ?2 AND A1.name = 'creation' "<<
-    //"AND NOT (A1.expiration_date BETWEEN 1 and ?2) AND A1.uri REGEXP ?3 AND A2.uri = A1.uri "<<
-    //"AND A2.creation_date BETWEEN ?1 and ?2 AND NOT (A2.expiration_date BETWEEN 1 and ?2) AND "<<
-    //"A2.name REGEXP ?4 GROUP BY A2.uri, A2.name, A2.origin;";
-
-  //This is a bit faster than the self join. This is safe to use if we expire all of a URI's
-  //attributes when the URI is expired.
-  request_stream << "SELECT uri, name, MAX(creation_date), expiration_date, origin, data "<<
-    "FROM attributes WHERE creation_date <= ?2 AND NOT (expiration_date BETWEEN 1 AND ?2) "<<
-    "AND uri REGEXP ?3 AND name REGEXP ?4 GROUP BY uri, name, origin;";
-
-  //request_stream << "SELECT uri, name, MAX(creation_date), expiration_date, origin, data FROM "<<
-    //"( select * from attributes where uri REGEXP ?3 AND name REGEXP ?4) where NOT expiration_date BETWEEN 1 AND ?2 "<<
-    //"GROUP BY uri, name, origin;";
-
-  //Another alternative is to use the current table to determine which triples of uri,name, and origin
-  //should be fetched and then fetch them individually.
-  //request_stream << "select attributes.uri, attributes.name, MAX(attributes.creation_date), attributes.expiration_date, attributes.origin, attributes.data from attributes inner join current on (current.uri = attributes.uri AND current.name = attributes.name AND current.origin = attributes.origin) where attributes.creation_date <= ?2 and (attributes.expiration_date == 0 OR attributes.expiration_date > ?2) and current.uri REGEXP ?3 and current.name REGEXP ?4 GROUP BY current.uri, current.name, current.origin;";
-  //request_stream << "select attributes.uri, attributes.name, MAX(attributes.creation_date), attributes.expiration_date, attributes.origin, attributes.data from attributes inner join current on (current.uri = attributes.uri AND current.name = attributes.name AND current.origin = attributes.origin) where attributes.creation_date <= ?2 and NOT (attributes.expiration_date BETWEEN 1 and ?2) and current.uri REGEXP ?3 and current.name REGEXP ?4 GROUP BY current.uri, current.name, current.origin;";
-
-  //Filter first on times and then filter again on names
-  //request_stream << "select * from ( SELECT uri, name, MAX(creation_date), expiration_date, origin, data from attributes where creation_date <= ?2 and NOT (expiration_date BETWEEN 1 and ?2) GROUP BY uri, name, origin) A WHERE uri REGEXP ?3 and name REGEXP ?4;";
-
-  //request_stream << "select attributes.uri, attributes.name, MAX(attributes.creation_date), attributes.expiration_date, attributes.origin, attributes.data from attributes inner join current on ( SELECT uri, name, origin from current where current.uri REGEXP ?3 and current.name REGEXP ?4) A where (A.uri = attributes.uri AND A.name = attributes.name AND A.origin = attributes.origin) where attributes.creation_date <= ?2 and (attributes.expiration_date == 0 OR attributes.expiration_date > ?2);";
-
-  //std::cerr<<"Historic request is:\n"<<request_stream.str()<<'\n';
-  //Prepare the statement
-  sqlite3_stmt* statement_p;
-  sqlite3_prepare_v2(db_handle, request_stream.str().c_str(), -1, &statement_p, NULL);
-  //Bind this attribute's parameters.
-  sqlite3_bind_int64(statement_p, 1, start);
-  sqlite3_bind_int64(statement_p, 2, stop);
-  sqlite3_bind_text16(statement_p, 3, uri.data(), 2*uri.size(), SQLITE_STATIC);
-  sqlite3_bind_text16(statement_p, 4, single_expression.data(), 2*single_expression.size(), SQLITE_STATIC);
-  world_state result = fetchWorldData(statement_p);
+  //In this request ?1 is the time of the checkpoint the snapshot starts from,
+  //?2 is the end time, ?3 is the URI, ?4 is the attribute name expression,
+  //and ?5 through ?8 are the ranges of URIs and names that can match
+  world_state result;
+  {
+    //Read through a pooled connection so that solver writes are not blocked
+    ReadConnectionPool::Connection reader = readers->get();
+    StatementCache& cache = reader.valid() ? reader.statements() : *statements;
+    ReadTransaction transaction(reader.valid() ? reader.handle() : NULL);
+    grail_time base = no_checkpoint;
+    {
+      StatementCache::Statement statement_p = cache.get("SELECT MAX(time) FROM checkpoints WHERE time <= ?1;");
+      sqlite3_bind_int64(statement_p, 1, stop);
+      if (SQLITE_ROW == sqlite3_step(statement_p) and SQLITE_NULL != sqlite3_column_type(statement_p, 0)) {
+        base = sqlite3_column_int64(statement_p, 0);
+      }
+    }
+    std::vector<Partition> checkpointed;
+    if (no_checkpoint != base) {
+      checkpointed = partitionsBetween(cache, no_checkpoint, base);
+    }
+    std::vector<Partition> recent = partitionsBetween(cache, base + 1, stop);
+    forEachBatch(checkpointed, recent, [&](const std::vector<Partition>& c, const std::vector<Partition>& r) {
+        //Get a prepared statement
+        StatementCache::Statement statement_p = cache.get(snapshotQuery(c, r));
+        //Bind this attribute's parameters.
+        sqlite3_bind_int64(statement_p, 1, base);
+        sqlite3_bind_int64(statement_p, 2, stop);
+        sqlite3_bind_text16(statement_p, 3, uri.data(), 2*uri.size(), SQLITE_STATIC);
+        sqlite3_bind_text16(statement_p, 4, single_expression.data(), 2*single_expression.size(), SQLITE_STATIC);
+        bindPatternRange(statement_p, 5, uri);
+        bindPatternRange(statement_p, 7, single_expression);
+        world_state found = fetchWorldData(statement_p);
+        mergeLatest(result, found);});
+  }
 
   //Check the returned URIs to make sure they satisfy all of the attribute requirements
   for (auto I = desired_attributes.begin(); I != desired_attributes.end(); ++I) {
-    regex_t exp;
-    int err = regcomp(&exp, std::string(I->begin(), I->end()).c_str(), REG_EXTENDED);
-    if (0 != err) {
+    std::shared_ptr<const CompiledPattern> exp = RegexCache::get(*I);
+    if (not exp->valid()) {
       debug<<"Error compiling regular expression "<<std::string(I->begin(), I->end())<<" in historic snapshot request.\n";
     }
     else {
       auto attr_match = [&](const world_model::Attribute& attr) {
-        regmatch_t pmatch;
-        int match = regexec(&exp, std::string(attr.name.begin(), attr.name.end()).c_str(), 1, &pmatch, 0);
-        if (0 == match and 0 == pmatch.rm_so and attr.name.size() == pmatch.rm_eo) {
-          return true;
-        }
-        return false;
+        return exp->fullMatch(attr.name);
       };
       auto URI = result.begin();
       while (URI != result.end()) {
@@ -918,7 +1796,6 @@ WorldModel::world_state SQLite3WorldModel::historicSnapshot(const world_model::U
           ++URI;
         }
       }
-      regfree(&exp);
     }
   }
   return result;
@@ -932,42 +1809,66 @@ WorldModel::world_state SQLite3WorldModel::historicSnapshot(const world_model::U
 WorldModel::world_state SQLite3WorldModel::historicDataInRange(const world_model::URI& uri,
                                     std::vector<std::u16string>& desired_attributes,
                                     world_model::grail_time start, world_model::grail_time stop) {
+  //A negative limit returns every row
+  return rangeData(uri, desired_attributes, start, stop, -1);
+}
+
+WorldModel::world_state SQLite3WorldModel::historicDataPage(const world_model::URI& uri,
+                                    std::vector<std::u16string>& desired_attributes,
+                                    world_model::grail_time start, world_model::grail_time stop,
+                                    size_t max_rows) {
+  //Each batch of partitions returns its earliest rows so keep the earliest of those
+  WorldModel::world_state result = rangeData(uri, desired_attributes, start, stop, max_rows);
+  keepEarliest(result, max_rows);
+  return result;
+}
+
+WorldModel::world_state SQLite3WorldModel::rangeData(const world_model::URI& uri,
+                                    std::vector<std::u16string>& desired_attributes,
+                                    world_model::grail_time start, world_model::grail_time stop,
+                                    sqlite3_int64 limit) {
   //Return an empty result if there is no database access
   if (db_handle == NULL) {
     return WorldModel::world_state();
   }
+  //Include any writes still waiting in the journal
+  journal->sync();
   //Access the database for this information
-  std::ostringstream request_stream;
-  std::string att_request = "";
-
-  if (desired_attributes.size() > 0 ) {
-    att_request += " AND (";
-  }
-  for (int idx = 0; idx < desired_attributes.size(); ++idx) {
-    if (idx == 0) {
-      att_request += " (name REGEXP ?"+std::to_string(idx+4)+") ";
-    }
-    else {
-      att_request += " OR (name REGEXP ?"+std::to_string(idx+4)+") ";
+  //Read through a pooled connection so that solver writes are not blocked
+  ReadConnectionPool::Connection reader = readers->get();
+  StatementCache& cache = reader.valid() ? reader.statements() : *statements;
+  ReadTransaction transaction(reader.valid() ? reader.handle() : NULL);
+  std::vector<Partition> tables = partitionsBetween(cache, start, stop);
+  WorldModel::world_state result;
+  forEachBatch({}, tables, [&](const std::vector<Partition>&, const std::vector<Partition>& batch) {
+      //The statement is cached separately for each number of attributes and partitions
+      StatementCache::Statement statement_p = cache.get(rangeQuery(desired_attributes.size(), batch));
+      //Bind this attribute's parameters.
+      sqlite3_bind_text16(statement_p, 1, uri.data(), 2*uri.size(), SQLITE_STATIC);
+      sqlite3_bind_int64(statement_p, 2, start);
+      sqlite3_bind_int64(statement_p, 3, stop);
+      for (int idx = 0; idx < desired_attributes.size(); ++idx) {
+        sqlite3_bind_text16(statement_p, 4+idx, desired_attributes[idx].data(), 2*desired_attributes[idx].size(), SQLITE_STATIC);
+      }
+      //The ranges of URIs and names that can match follow the patterns
+      bindPatternRange(statement_p, desired_attributes.size()+4, uri);
+      for (int idx = 0; idx < desired_attributes.size(); ++idx) {
+        bindPatternRange(statement_p, 2*idx + desired_attributes.size()+6, desired_attributes[idx]);
+      }
+      sqlite3_bind_int64(statement_p, 3*desired_attributes.size()+6, limit);
+      WorldModel::world_state found = fetchWorldData(statement_p);
+      for (auto I = found.begin(); I != found.end(); ++I) {
+        std::vector<world_model::Attribute>& attributes = result[I->first];
+        attributes.insert(attributes.end(), I->second.begin(), I->second.end());
+      }});
+  //Batches are each in creation order, so merge them if there were several
+  if (tables.size() > max_query_partitions) {
+    for (auto I = result.begin(); I != result.end(); ++I) {
+      std::stable_sort(I->second.begin(), I->second.end(),
+          [](const world_model::Attribute& a, const world_model::Attribute& b) {
+            return a.creation_date < b.creation_date;});
     }
   }
-  if (desired_attributes.size() > 0 ) {
-    att_request += ") ";
-  }
-  request_stream << "SELECT * from attributes WHERE uri REGEXP ?1 "<<att_request<<
-    " AND creation_date BETWEEN ?2 AND ?3 order by creation_date asc;";
-  //Prepare the statement
-  sqlite3_stmt* statement_p;
-  sqlite3_prepare_v2(db_handle, request_stream.str().c_str(), -1, &statement_p, NULL);
-  //Bind this attribute's parameters.
-  sqlite3_bind_text16(statement_p, 1, uri.data(), 2*uri.size(), SQLITE_STATIC);
-  sqlite3_bind_int64(statement_p, 2, start);
-  sqlite3_bind_int64(statement_p, 3, stop);
-  for (int idx = 0; idx < desired_attributes.size(); ++idx) {
-    sqlite3_bind_text16(statement_p, 4+idx, desired_attributes[idx].data(), 2*desired_attributes[idx].size(), SQLITE_STATIC);
-  }
-
-  WorldModel::world_state result = fetchWorldData(statement_p);
   return result;
 
   /*
@@ -23,19 +23,24 @@
  ******************************************************************************/
 
 #include "sqlite_regexp_module.hpp"
-#include "regex_store.hpp"
 
+#include <algorithm>
+#include <memory>
 #include <string>
 
+#include <regex_cache.hpp>
 #include <sqlite3.h>
 
-using std::string;
-using std::u16string;
+//Older versions of sqlite do not have deterministic functions
+#ifndef SQLITE_DETERMINISTIC
+#define SQLITE_DETERMINISTIC 0
+#endif
 
-//Destroy the RegexStore object when the database is closed
-static void xDestroy(void* userParam) {
-	RegexStore* myRegStore = static_cast<RegexStore*>(userParam);
-	delete myRegStore;
+typedef std::shared_ptr<const CompiledPattern> Pattern;
+
+//Release a compiled pattern that sqlite kept for a statement
+static void releasePattern(void* pattern) {
+  delete static_cast<Pattern*>(pattern);
 }
 
 //Callback that implements regular expressions in sqlite3
@@ -53,22 +58,43 @@ static void sqlite3_regexp(sqlite3_context *context, int argc, sqlite3_value **a
     return;
   }
 
-	//Get the stored regex from the user context
-	RegexStore* myRegStore = static_cast<RegexStore*>(sqlite3_user_data(context));
-
-  u16string pattern = u16string((const char16_t*)sqlite3_value_text16(argv[0]));
-  u16string in_string = u16string((const char16_t*)sqlite3_value_text16(argv[1]));
+  //The pattern is compiled on the first row and kept by sqlite for as long
+  //as the statement uses the same pattern, so other rows only compare.
+  const CompiledPattern* exp = nullptr;
+  Pattern compiled;
+  Pattern* kept = static_cast<Pattern*>(sqlite3_get_auxdata(context, 0));
+  if (nullptr != kept) {
+    exp = kept->get();
+  }
+  else {
+    const char16_t* pattern = static_cast<const char16_t*>(sqlite3_value_text16(argv[0]));
+    compiled = RegexCache::get(std::u16string(pattern, sqlite3_value_bytes16(argv[0]) / sizeof(char16_t)));
+    exp = compiled.get();
+    //sqlite releases the copy right away if it cannot keep it
+    sqlite3_set_auxdata(context, 0, new Pattern(compiled), releasePattern);
+  }
+  if (not exp->valid()) {
+    sqlite3_result_error_code(context, 3);
+    return;
+  }
 
-	if (not myRegStore->preparePattern(pattern)) {
-		sqlite3_result_error_code(context, 3);
-	}
-	sqlite3_result_int(context, myRegStore->patternMatch(in_string));
-  return;
+  //The database stores UTF-8 so ASCII text is the narrow string that the
+  //pattern expects and can be matched without a conversion.
+  const char* text = reinterpret_cast<const char*>(sqlite3_value_text(argv[1]));
+  size_t length = sqlite3_value_bytes(argv[1]);
+  if (std::all_of(text, text + length, [](char c) { return 0 == (c & 0x80);})) {
+    sqlite3_result_int(context, exp->fullMatch(text, length));
+  }
+  else {
+    const char16_t* wide = static_cast<const char16_t*>(sqlite3_value_text16(argv[1]));
+    std::u16string in_string(wide, sqlite3_value_bytes16(argv[1]) / sizeof(char16_t));
+    sqlite3_result_int(context, exp->fullMatch(in_string));
+  }
 }
 
 int initializeRegex(sqlite3 *db) {
-	//TODO SQLITE_DETERMINISTIC was added in 3.8.3, should be ORed with SQLITE_UTF16
-	RegexStore* myRegStore = new RegexStore();
-	return sqlite3_create_function_v2(db, "REGEXP", 2, SQLITE_UTF16, myRegStore, sqlite3_regexp, NULL, NULL, xDestroy);
+  //Results only depend upon the arguments so sqlite may evaluate the
+  //function once for constant arguments
+  return sqlite3_create_function_v2(db, "REGEXP", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+      NULL, sqlite3_regexp, NULL, NULL, NULL);
 }
-
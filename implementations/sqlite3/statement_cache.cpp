@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A cache of prepared statements for a single sqlite3 connection.
+ ******************************************************************************/
+
+#include "statement_cache.hpp"
+
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <sqlite3.h>
+
+StatementCache::Statement::Statement(StatementCache* cache, const std::string& sql, sqlite3_stmt* statement_p) :
+  cache(cache), sql(sql), statement_p(statement_p) {
+}
+
+StatementCache::Statement::Statement(Statement&& other) :
+  cache(other.cache), sql(std::move(other.sql)), statement_p(other.statement_p) {
+  other.statement_p = NULL;
+}
+
+StatementCache::Statement::~Statement() {
+  if (NULL != statement_p) {
+    cache->release(sql, statement_p);
+  }
+}
+
+StatementCache::StatementCache(sqlite3* db_handle, size_t capacity) :
+  db_handle(db_handle), capacity(capacity), stats{0, 0, 0, 0} {
+}
+
+StatementCache::~StatementCache() {
+  for (auto I = recent.begin(); I != recent.end(); ++I) {
+    sqlite3_finalize(I->second);
+  }
+}
+
+StatementCache::Statement StatementCache::get(const std::string& sql) {
+  {
+    std::unique_lock<std::mutex> lck(cache_mutex);
+    auto I = idle.find(sql);
+    if (I != idle.end()) {
+      sqlite3_stmt* statement_p = I->second->second;
+      recent.erase(I->second);
+      idle.erase(I);
+      ++stats.hits;
+      return Statement(this, sql, statement_p);
+    }
+    ++stats.misses;
+  }
+  //Prepare outside of the lock so that other threads can use the cache.
+  //The persistent flag tells sqlite that this statement will be reused.
+  sqlite3_stmt* statement_p = NULL;
+  if (SQLITE_OK != sqlite3_prepare_v3(db_handle, sql.c_str(), -1,
+        SQLITE_PREPARE_PERSISTENT, &statement_p, NULL)) {
+    std::cerr<<"Error preparing statement: "<<sqlite3_errmsg(db_handle)<<'\n';
+    sqlite3_finalize(statement_p);
+    statement_p = NULL;
+  }
+  return Statement(this, sql, statement_p);
+}
+
+void StatementCache::release(const std::string& sql, sqlite3_stmt* statement_p) {
+  //Ready the statement for its next use and drop any bound pointers
+  sqlite3_reset(statement_p);
+  sqlite3_clear_bindings(statement_p);
+  {
+    std::unique_lock<std::mutex> lck(cache_mutex);
+    recent.push_front(std::make_pair(sql, statement_p));
+    idle.insert(std::make_pair(sql, recent.begin()));
+    if (recent.size() <= capacity) {
+      return;
+    }
+    //Make room by dropping the statement that has been idle the longest
+    IdleList::iterator oldest = std::prev(recent.end());
+    auto range = idle.equal_range(oldest->first);
+    for (auto I = range.first; I != range.second; ++I) {
+      if (I->second == oldest) {
+        idle.erase(I);
+        break;
+      }
+    }
+    statement_p = oldest->second;
+    recent.erase(oldest);
+    ++stats.evictions;
+  }
+  sqlite3_finalize(statement_p);
+}
+
+StatementCache::Statistics StatementCache::statistics() {
+  std::unique_lock<std::mutex> lck(cache_mutex);
+  Statistics current = stats;
+  current.cached = idle.size();
+  return current;
+}
+
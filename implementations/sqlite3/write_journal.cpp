@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A write-behind journal for an sqlite3 connection.
+ ******************************************************************************/
+
+#include "write_journal.hpp"
+
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sqlite3.h>
+
+WriteJournal::WriteJournal(sqlite3* db_handle, size_t batch_size,
+    std::chrono::milliseconds max_delay, size_t max_pending) :
+  db_handle(db_handle), batch_size(batch_size), max_delay(max_delay),
+  max_pending(max_pending), appended(0), committed(0), sync_target(0),
+  stats{0, 0, 0}, stopping(false) {
+  writer = std::thread(&WriteJournal::writerLoop, this);
+}
+
+WriteJournal::~WriteJournal() {
+  {
+    std::unique_lock<std::mutex> lck(journal_mutex);
+    stopping = true;
+  }
+  work_ready.notify_all();
+  writer.join();
+}
+
+uint64_t WriteJournal::append(Operation op) {
+  bool wake = false;
+  uint64_t sequence;
+  {
+    std::unique_lock<std::mutex> lck(journal_mutex);
+    progress.wait(lck, [&]() { return pending.size() < max_pending;});
+    if (pending.empty()) {
+      oldest = std::chrono::steady_clock::now();
+    }
+    pending.push_back(std::move(op));
+    sequence = ++appended;
+    //The writer only needs to know when a batch starts or fills up
+    wake = 1 == pending.size() or pending.size() >= batch_size;
+  }
+  if (wake) {
+    work_ready.notify_one();
+  }
+  return sequence;
+}
+
+uint64_t WriteJournal::lastAppended() {
+  std::unique_lock<std::mutex> lck(journal_mutex);
+  return appended;
+}
+
+void WriteJournal::sync() {
+  std::unique_lock<std::mutex> lck(journal_mutex);
+  uint64_t target = appended;
+  if (committed >= target) {
+    return;
+  }
+  if (sync_target < target) {
+    sync_target = target;
+  }
+  work_ready.notify_one();
+  progress.wait(lck, [&]() { return committed >= target;});
+}
+
+WriteJournal::Statistics WriteJournal::statistics() {
+  std::unique_lock<std::mutex> lck(journal_mutex);
+  Statistics current = stats;
+  current.pending = pending.size();
+  return current;
+}
+
+void WriteJournal::writerLoop() {
+  std::vector<Operation> batch;
+  std::unique_lock<std::mutex> lck(journal_mutex);
+  while (true) {
+    work_ready.wait(lck, [&]() { return stopping or not pending.empty();});
+    if (pending.empty()) {
+      //Stopping with nothing left to write
+      return;
+    }
+    //Let later operations join this transaction unless the batch is full,
+    //someone is waiting in sync, or the journal is shutting down.
+    work_ready.wait_until(lck, oldest + max_delay, [&]() {
+        return stopping or pending.size() >= batch_size or sync_target > committed;});
+    batch.swap(pending);
+    uint64_t last = appended;
+    lck.unlock();
+    //Writers blocked on a full queue can continue
+    progress.notify_all();
+
+    //A failed commit is reported but the operations are not retried, the same
+    //as when each insert used its own transaction.
+    sqlite3_exec(db_handle, "BEGIN TRANSACTION;", NULL, 0, NULL);
+    for (Operation& op : batch) {
+      try {
+        op();
+      }
+      catch (std::exception& err) {
+        std::cerr<<"Error writing to the database: "<<err.what()<<'\n';
+      }
+    }
+    char* err = NULL;
+    sqlite3_exec(db_handle, "COMMIT TRANSACTION;", NULL, 0, &err);
+    if (NULL != err) {
+      std::cerr<<"Error committing to the database: "<<err<<'\n';
+      sqlite3_free(err);
+      sqlite3_exec(db_handle, "ROLLBACK TRANSACTION;", NULL, 0, NULL);
+    }
+
+    lck.lock();
+    committed = last;
+    stats.operations += batch.size();
+    ++stats.transactions;
+    batch.clear();
+    progress.notify_all();
+  }
+}
+
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A bounded ring of the most recent versions of each attribute, identified by
+ * its URI, name, and origin. The creation and expiration dates of each version
+ * are kept so that a value arriving out of order can be placed in the history
+ * without asking the database for its neighbors.
+ * A ring holds every version created since its oldest entry, so only values
+ * older than that horizon need the database.
+ ******************************************************************************/
+
+#ifndef __RECENT_HISTORY_HPP__
+#define __RECENT_HISTORY_HPP__
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include <owl/world_model_protocol.hpp>
+
+#include "symbol_table.hpp"
+
+class RecentHistory {
+  public:
+    ///The URI, name, and origin of an attribute
+    typedef std::tuple<SymbolTable::Symbol, SymbolTable::Symbol, SymbolTable::Symbol> Key;
+
+    struct Version {
+      world_model::grail_time creation_date;
+      world_model::grail_time expiration_date;
+    };
+
+  private:
+    struct Shard {
+      std::mutex ring_mutex;
+      //Versions of each attribute ordered by creation date
+      std::map<Key, std::vector<Version>> rings;
+    };
+
+    //Most versions kept for one attribute
+    size_t depth;
+    std::vector<Shard> shards;
+
+    Shard& shardFor(const Key& key);
+
+    RecentHistory& operator=(const RecentHistory&) = delete;
+    RecentHistory(const RecentHistory&) = delete;
+
+  public:
+    ///Default number of versions kept for each attribute
+    static const size_t default_depth = 16;
+
+    RecentHistory(size_t depth = default_depth, size_t num_shards = 64);
+
+    /**
+     * Start the history of a new attribute with the given version, dropping
+     * anything known about earlier versions.
+     */
+    void start(const Key& key, world_model::grail_time creation);
+
+    /**
+     * Record a new current value that expires the previous current value.
+     * A history is started at the previous value if there was none.
+     */
+    void advance(const Key& key, world_model::grail_time previous, world_model::grail_time creation);
+
+    /**
+     * Place a value created before the current value into the history.
+     * If the value is within the history, sets expiration to the value's
+     * expiration date, sets has_before and before to the version it follows
+     * (with before's new expiration date), and returns true. Before is not
+     * set if the value has the same creation date as an existing version.
+     * Returns false if the value is older than the history, in which case
+     * nothing changes and the database must be consulted.
+     */
+    bool splice(const Key& key, world_model::grail_time current, world_model::grail_time creation,
+        world_model::grail_time& expiration, bool& has_before, Version& before);
+
+    ///Forget the history of an attribute, or of every attribute of a URI
+    void forget(const Key& key);
+    void forget(SymbolTable::Symbol uri);
+};
+
+#endif //ifndef __RECENT_HISTORY_HPP__
+
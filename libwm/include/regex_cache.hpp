@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A process-wide cache of compiled regular expressions. Clients tend to send
+ * the same few patterns over and over so patterns are compiled once and then
+ * shared by searches, snapshots, and standing queries. Patterns that are
+ * really literal strings, or a literal prefix followed by .*, are matched
+ * with string comparisons instead of POSIX regex.
+ * All matches must consume the entire input string.
+ ******************************************************************************/
+
+#ifndef __REGEX_CACHE_HPP__
+#define __REGEX_CACHE_HPP__
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+//TODO In the future C++11 support for regex should be used over these POSIX
+//regex c headers.
+#include <sys/types.h>
+#include <regex.h>
+
+class CompiledPattern {
+  public:
+    enum class Kind {
+      //Only matches the literal string itself
+      literal,
+      //Matches any string beginning with the literal string
+      prefix,
+      //Must be matched with the compiled regex
+      regex,
+      //The pattern did not compile and matches nothing
+      invalid
+    };
+
+  private:
+    Kind kind;
+    std::u16string literal;
+    std::string narrow_literal;
+    //A string that begins every string this pattern matches
+    std::u16string prefix;
+    regex_t exp;
+
+    CompiledPattern& operator=(const CompiledPattern&) = delete;
+    CompiledPattern(const CompiledPattern&) = delete;
+
+  public:
+    ///Compile the pattern, checking for a literal or prefix first
+    CompiledPattern(const std::u16string& pattern);
+    ~CompiledPattern();
+
+    ///False if the pattern is not a valid regular expression
+    bool valid() const { return Kind::invalid != kind; }
+
+    Kind type() const { return kind; }
+
+    /**
+     * A string that begins every string that fully matches this pattern.
+     * This is the whole string for literal patterns and may be empty.
+     */
+    const std::u16string& literalPrefix() const { return prefix; }
+
+    ///True if the pattern matches all of the given string
+    bool fullMatch(const std::u16string& str) const;
+
+    ///The same as the u16string version for a narrow copy of the string
+    bool fullMatch(const std::string& narrow) const;
+
+    /**
+     * The same as the narrow string version without copying the string.
+     * The string must be terminated by a null character at its length.
+     */
+    bool fullMatch(const char* narrow, size_t length) const;
+};
+
+class RegexCache {
+  private:
+    typedef std::pair<std::u16string, std::shared_ptr<const CompiledPattern>> Entry;
+
+    //Most recently used patterns are at the front
+    static std::list<Entry> entries;
+    static std::unordered_map<std::u16string, std::list<Entry>::iterator> index;
+    static std::mutex cache_mutex;
+
+  public:
+    ///Number of compiled patterns to keep
+    static const size_t capacity = 256;
+
+    /**
+     * Return the compiled version of a pattern, compiling it if it is not
+     * cached. The returned pattern may be shared between threads and remains
+     * valid after it is evicted from the cache.
+     */
+    static std::shared_ptr<const CompiledPattern> get(const std::u16string& pattern);
+
+    ///Number of cached patterns
+    static size_t size();
+};
+
+#endif //ifndef __REGEX_CACHE_HPP__
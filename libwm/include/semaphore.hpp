@@ -1,36 +1,55 @@
 /*******************************************************************************
- * Implementation of counting semaphores using the resource allocation in
- * initialization pattern for waiting and signalling.
+ * A reader/writer lock using the resource allocation in initialization
+ * pattern for waiting and signalling.
+ * Readers "flag" the semaphore and writers "lock" it. Readers that arrive
+ * while no writer is waiting only touch an atomic counter. Once a writer is
+ * waiting new readers block so that a steady stream of readers cannot starve
+ * writers, and readers that blocked on a writer are let in before the next
+ * writer so that writers cannot starve readers either.
  ******************************************************************************/
 
 #ifndef __SEMAPHORE_HPP__
 #define __SEMAPHORE_HPP__
 
+#include <atomic>
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
 
 class Semaphore {
   private:
-    //TODO FIXME This should be std::atomic_size_t and the count_m mutex could go away.
-    size_t count;
-    //Lock during an intermediate step in the lock() function.
-    std::mutex count_m;
-    //Lock to prevent all flag and lock actions.
-    std::mutex master;
-    //Used to notify locking commands when the count changes.
-    std::condition_variable cond;
+    //Set in the state while a writer holds or is waiting for the lock.
+    static const uint32_t writer_bit = 0x80000000u;
+    //The low bits of the state count the readers that have flagged.
+    std::atomic<uint32_t> state;
+    //Only one writer at a time may set the writer bit.
+    std::mutex writer_m;
+    //Protects the slow paths and the condition variables below.
+    std::mutex m;
+    //Readers blocked on a writer wait here.
+    std::condition_variable reader_cond;
+    //Writers wait here for readers to leave or for blocked readers to enter.
+    std::condition_variable writer_cond;
+    //Number of readers that blocked on a writer and have not yet entered.
+    size_t readers_waiting;
+
+    Semaphore& operator=(const Semaphore&) = delete;
+    Semaphore(const Semaphore&) = delete;
 
   public:
 
     Semaphore();
 
-    ///The Semaphore::lock method locks the master lock and makes this call block
+    /**
+     * Flag for reading. Any number of readers may hold a flag at the same
+     * time but this blocks while a writer holds or is waiting for the lock.
+     */
     void flag();
     void unflag();
 
     /**
-     * This waits until count is zero and makes other calls to
-     * lock or notify block until unlock is called.
+     * This waits until all readers have unflagged and makes other calls to
+     * flag or lock block until unlock is called.
      */
     void lock();
     void unlock();
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * Storage for the current state of the world model that is split into
+ * shards by a hash of the URI. Each shard has its own reader/writer lock so
+ * that inserts into different URIs do not serialize against one another or
+ * against snapshots of unrelated URIs. URIs, attribute names, and origins
+ * are stored as symbols from the SymbolTable.
+ * A sorted index of the URI strings is kept beside the shards so that
+ * searches for a URI prefix only visit the URIs under that prefix.
+ ******************************************************************************/
+
+#ifndef __SHARDED_WORLD_STATE_HPP__
+#define __SHARDED_WORLD_STATE_HPP__
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <owl/world_model_protocol.hpp>
+
+#include "semaphore.hpp"
+#include "symbol_table.hpp"
+
+/**
+ * Attribute data is immutable once it arrives so it is shared, rather than
+ * copied, between the current state, updates, and standing queries.
+ */
+typedef std::shared_ptr<const world_model::Buffer> Payload;
+
+///Make a payload from a copy of the data. Empty data shares one payload.
+Payload makePayload(const world_model::Buffer& data);
+
+/**
+ * An attribute as it is stored in the current state, with the name and
+ * origin interned in the SymbolTable.
+ */
+struct InternedAttribute {
+  SymbolTable::Symbol name;
+  SymbolTable::Symbol origin;
+  world_model::grail_time creation_date;
+  world_model::grail_time expiration_date;
+  Payload data;
+
+  InternedAttribute(const world_model::Attribute& attr);
+  ///Use already interned name and origin symbols
+  InternedAttribute(const world_model::Attribute& attr,
+      SymbolTable::Symbol name, SymbolTable::Symbol origin);
+  InternedAttribute(SymbolTable::Symbol name, SymbolTable::Symbol origin,
+      world_model::grail_time creation_date, world_model::grail_time expiration_date,
+      Payload data);
+
+  ///Convert back to a protocol attribute, optionally without its data
+  world_model::Attribute toAttribute(bool get_data = true) const;
+};
+
+///Current state of a set of URIs, keyed by the interned URI
+typedef std::map<SymbolTable::Symbol, std::vector<InternedAttribute>> InternedState;
+
+/**
+ * Attributes with shared payloads keyed by URI string so that URIs sort the
+ * same way as in a WorldState. Used to pass updates to standing queries.
+ */
+typedef std::map<world_model::URI, std::vector<InternedAttribute>> SharedState;
+
+///Intern the attributes of a world state, copying each data buffer once
+SharedState toSharedState(const world_model::WorldState& ws);
+
+///Convert back to a protocol world state, optionally without data
+world_model::WorldState toWorldState(const SharedState& ss, bool get_data = true);
+
+class ShardedWorldState {
+  private:
+    struct Shard {
+      //Readers flag this and writers lock it
+      Semaphore access_control;
+      InternedState state;
+    };
+
+    std::vector<Shard> shards;
+
+    //Every URI in any shard, sorted by its string so that URIs sharing a
+    //prefix are adjacent. A shard's lock is held when this is locked, never
+    //the other way around.
+    Semaphore index_control;
+    std::map<std::u16string, SymbolTable::Symbol> uri_index;
+
+    ShardedWorldState& operator=(const ShardedWorldState&) = delete;
+    ShardedWorldState(const ShardedWorldState&) = delete;
+
+    ///Return the shard that stores the given URI
+    Shard& shardFor(SymbolTable::Symbol uri);
+
+    ///Add or remove a URI from the prefix index
+    void updateIndex(SymbolTable::Symbol uri, bool present);
+
+    ///Remove every URI
+    void clear();
+
+    friend class ShardFlag;
+    friend class ShardLock;
+
+  public:
+    ///Default number of shards, should be well above the number of cores.
+    static const size_t default_shards = 64;
+
+    ShardedWorldState(size_t num_shards = default_shards);
+
+    ///Number of URIs in all shards. Only a hint if there are concurrent writers.
+    size_t size();
+
+    /**
+     * Visit every URI and its attributes. Each shard is flagged for reading
+     * while it is visited so the visitor must not try to lock this state.
+     */
+    void forEach(std::function<void(SymbolTable::Symbol, const std::vector<InternedAttribute>&)> f);
+
+    /**
+     * Visit a copy of each shard's state in turn. The copy is made while the
+     * shard is flagged but the visitor is called after the flag is released.
+     * Attribute data is shared with the current state, not copied.
+     */
+    void forEachShard(std::function<void(SharedState&)> f);
+
+    /**
+     * Visit every URI that begins with the given prefix, in sorted order.
+     * The index is flagged while visiting so the visitor must not lock
+     * any shard of this state. An empty prefix visits every URI.
+     */
+    void forEachWithPrefix(const std::u16string& prefix,
+        std::function<void(SymbolTable::Symbol)> f);
+
+    ///True if the URI is in the current state
+    bool contains(SymbolTable::Symbol uri);
+
+    /**
+     * Replace the current contents with the given state, for instance
+     * when loading the state from a database.
+     */
+    void assign(const world_model::WorldState& ws);
+
+    ///Replace the current contents with already interned state
+    void assign(const InternedState& is);
+};
+
+/**
+ * Flag the shard containing a URI for reading, similar to a SemaphoreFlag.
+ * Other readers can proceed but writers of this shard will block.
+ */
+class ShardFlag {
+  private:
+    SemaphoreFlag flag;
+    const InternedState& state;
+  public:
+    ShardFlag(ShardedWorldState& sws, SymbolTable::Symbol uri);
+    const InternedState& operator*() const { return state; }
+    const InternedState* operator->() const { return &state; }
+};
+
+/**
+ * Lock the shard containing a URI for writing, similar to a SemaphoreLock.
+ * Only the shard holding this URI is locked so that writes to URIs in other
+ * shards can proceed.
+ * Only the given URI may be added to or removed from the shard while it is
+ * locked; the URI index is updated for it when the lock is released.
+ */
+class ShardLock {
+  private:
+    SemaphoreLock lock;
+    InternedState& state;
+    ShardedWorldState& sws;
+    SymbolTable::Symbol uri;
+    //If the URI was in the state when the lock was taken
+    bool existed;
+  public:
+    ShardLock(ShardedWorldState& sws, SymbolTable::Symbol uri);
+    ~ShardLock();
+    InternedState& operator*() const { return state; }
+    InternedState* operator->() const { return &state; }
+};
+
+#endif //ifndef __SHARDED_WORLD_STATE_HPP__
@@ -27,9 +27,13 @@
 #define __STANDING_QUERY_HPP__
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <list>
 #include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <set>
@@ -37,15 +41,13 @@
 #include <thread>
 #include <vector>
 
-#include <threadsafe_set.hpp>
+#include <regex_cache.hpp>
+#include <sharded_world_state.hpp>
+#include <subscription_index.hpp>
+#include <symbol_table.hpp>
 
 #include <owl/world_model_protocol.hpp>
 
-//TODO In the future C++11 support for regex should be used over these POSIX
-//regex c headers.
-#include <sys/types.h>
-#include <regex.h>
-
 using world_model::WorldState;
 
 class StandingQuery {
@@ -54,36 +56,79 @@ class StandingQuery {
 		 * Private static objects and functions
 		 **************************************************************************/
 		struct Update {
-			WorldState state;
+			SharedState state;
+			//Transients are matched with exact string matching and are not stored
+			//as partial matches
+			SharedState transients;
 			bool invalidate_attributes;
 			bool invalidate_objects;
 		};
 
-		//Input/output queue. Input from solver threads, output to standing query thread
+		/**
+		 * Input queues, one per matcher thread. Input from solver threads, output
+		 * to the matcher threads. Every update goes into every queue and each
+		 * matcher thread delivers it to its own share of the subscriptions so
+		 * that each standing query sees updates in the order they were offered.
+		 */
 		static std::mutex solver_data_mutex;
-    static std::queue<Update> solver_data;
+    static std::vector<std::queue<std::shared_ptr<const Update>>> solver_data;
 
 		/**
-		 * Loop that moves data from the internal data queue to interested client
-		 * threads.
+		 * Maximum number of updates waiting in each queue. Solver threads
+		 * block in offerData when the matcher threads fall this far behind.
 		 */
-		static void dataProcessingLoop();
+		static const size_t max_queued_updates = 1024;
+
+		///Upper bound on the number of matcher threads.
+		static const size_t max_matcher_threads = 8;
+
+		///Signalled when new updates are queued or processing should stop.
+		static std::condition_variable data_available;
+
+		///Signalled when a matcher thread finishes delivering an update.
+		static std::condition_variable data_delivered;
+
+		///Number of updates offered and the number delivered by each thread.
+		static uint64_t updates_offered;
+		static std::vector<uint64_t> updates_delivered;
+
+		///Set to stop the matcher threads when the library is unloaded.
+		static bool stop_processing;
 
 		/**
-		 * Thread that runs the dataProcessingLoop.
+		 * Loop that moves data from a matcher thread's queue to the interested
+		 * standing queries. Sleeps on @data_available when there is no data.
 		 */
-		static std::thread data_processing_thread;
+		static void dataProcessingLoop(size_t thread_index);
 
 		/**
-		 * Mutex that guarantees that only one data_processing_thread is running.
+		 * Match an update against a standing query and insert anything of
+		 * interest into it.
 		 */
-		static std::mutex data_processing_mutex;
+		static void deliverUpdate(StandingQuery* sq, const Update& update);
 
 		/**
-		 * The set of all current standing queries, used to find all of the
-		 * existing StandingQuery objects so that data can be offered to them.
+		 * Threads that run the dataProcessingLoop. These are started with the
+		 * first offered update. The solver_data_mutex must be held to start them.
 		 */
-    static ThreadsafeSet<StandingQuery*> subscriptions;
+		static std::vector<std::thread> data_processing_threads;
+
+		///Stops and joins the matcher threads during static destruction.
+		static struct ProcessingShutdown {
+			~ProcessingShutdown();
+		} processing_shutdown;
+
+		///Used to spread standing queries over the matcher threads.
+		static std::atomic<size_t> next_matcher;
+
+		///Which matcher thread delivers updates to this standing query.
+		size_t matcher;
+
+		/**
+		 * The index of all current standing queries, used to find the
+		 * StandingQuery objects that data should be offered to.
+		 */
+    static SubscriptionIndex subscriptions;
 
 		/**
 		 * A mutex to protect access to the @subscriptions set.
@@ -108,21 +153,25 @@ class StandingQuery {
     //Need to lock this mutex before changing @cur_state
     std::mutex data_mutex;
     //Place where the world model will store data for this standing query.
-    WorldState cur_state;
+    //Attribute data is shared with the world model and other queries.
+    SharedState cur_state;
     //Remember which URIs and attributes match this query
     //For attributes remember which of the desired attributes they matched
-    std::map<world_model::URI, bool> uri_accepted;
+    //URIs and attribute names are interned so that these caches
+    //compare integers rather than strings
+    std::map<SymbolTable::Symbol, bool> uri_accepted;
     std::map<world_model::URI, std::set<size_t>> uri_matches;
     //Remember accepted attributes so that the standing query can notify
     //the subscriber when identifiers and attributes are expired or deleted
     //The data_mutex must be locked before modifying this structure
-    std::map<world_model::URI, std::set<std::u16string>> current_matches;
+    std::map<world_model::URI, std::set<SymbolTable::Symbol>> current_matches;
     ///This contains empty sets for entries without matches
-    std::map<std::u16string, std::set<size_t>> attribute_accepted;
+    std::map<SymbolTable::Symbol, std::set<size_t>> attribute_accepted;
     world_model::URI uri_pattern;
     std::vector<std::u16string> desired_attributes;
-    regex_t uri_regex;
-    std::map<std::u16string, regex_t> attr_regex;
+    //Compiled patterns come from the RegexCache and are shared with copies
+    std::shared_ptr<const CompiledPattern> uri_regex;
+    std::map<std::u16string, std::shared_ptr<const CompiledPattern>> attr_regex;
 		//True if this query should also retrieve data
     bool get_data;
 		//True after the provided regular expression successfully compiles
@@ -135,7 +184,10 @@ class StandingQuery {
 		 * be quickly set.  This also allows for rapid rechecking of a match if
 		 * attributes are deleted or expired.
 		 */
-    WorldState partial;
+    SharedState partial;
+
+    ///Get the compiled URI and attribute patterns and set regex_valid
+    void compilePatterns();
 
 	public:
     /**
@@ -152,14 +204,12 @@ class StandingQuery {
 		 * Create a new standing query, initializing internal regex code and adding
 		 * this StandingQuery to the internal list of queries that should see
 		 * incoming data from solvers.
-		 * Start the @data_processing_thread if this is the first standing query.
 		 */
-    StandingQuery(WorldState& cur_state, const world_model::URI& uri,
+    StandingQuery(ShardedWorldState& cur_state, const world_model::URI& uri,
         const std::vector<std::u16string>& desired_attributes, bool get_data = true);
 
 		/**
 		 * Remove this standing query from the internal list of queries.
-		 * If there are no more standing queries stop the @data_processing_thread.
 		 */
 		~StandingQuery();
 
@@ -175,23 +225,35 @@ class StandingQuery {
 		 */
 		WorldState getData();
 
+		///The same as getData but without copying the attribute data
+		SharedState getSharedData();
+
     /**
      * Update the list of attributes provided by origins.
      */
     static void addOriginAttributes(std::u16string& origin, std::set<std::u16string>& attributes);
 
 		/**
-		 * Offer data from the input queue for every StandingQuery
+		 * Offer data to every StandingQuery. The data is queued and this returns
+		 * without waiting for it to be matched unless the queue is full.
 		 * @invalidate is true if the object or attributes are not longer valid,
 		 * due to expiration or deletion, and should be removed.
+		 * @transients are offered with exact string matching of attribute names.
+		 */
+		static void offerData(const SharedState& ws, bool invalidate_attributes, bool invalidate_objects,
+				const SharedState& transients = SharedState());
+
+		/**
+		 * Block until every update offered before this call has been delivered
+		 * to the standing queries.
 		 */
-		static void offerData(WorldState& ws, bool invalidate_attributes, bool invalidate_objects);
+		static void flush();
 
     /**
      * Return true if this origin has data that this standing query might
      * be interested in and false otherwise.
      */
-    bool interestingOrigin(std::u16string& origin);
+    bool interestingOrigin(const std::u16string& origin);
 
     /**
      * Return a subset of the world state that this query is interested in.
@@ -201,7 +263,7 @@ class StandingQuery {
      * itself is interesting, but will skip this if the world state
      * contains data from multiple origins.
      */
-    WorldState showInterested(WorldState& ws, bool multiple_origins = false);
+    SharedState showInterested(const SharedState& ws, bool multiple_origins = false);
 
     /**
      * Return a subset of the world state that this query is interested in.
@@ -211,20 +273,20 @@ class StandingQuery {
      * the origin itself is interesting, but will skip this if the world state
      * contains data from multiple origins.
      */
-    WorldState showInterestedTransient(WorldState& ws, bool multiple_origins = false);
+    SharedState showInterestedTransient(const SharedState& ws, bool multiple_origins = false);
 
     /**
      * Invalidate a subset of the world state that would be modified if the
      * supplied URI is expired or deleted.
      */
-		void invalidateObject(world_model::URI name, world_model::Attribute creation);
+		void invalidateObject(world_model::URI name, const InternedAttribute& creation);
 
     /**
      * Return a subset of the world state that would be modified if the
      * supplied URI attributes are expired or deleted.
      */
     void invalidateAttributes(world_model::URI name,
-        std::vector<world_model::Attribute>& attrs_to_remove);
+        const std::vector<InternedAttribute>& attrs_to_remove);
 
     /**
      * Insert data in a thread safe way
@@ -232,7 +294,7 @@ class StandingQuery {
      * query first so the caller must check that first, on their own
      * or with the showInterested function call.
      */
-    void insertData(WorldState& ws);
+    void insertData(SharedState& ws);
 };
 
 #endif //ifndef __STANDING_QUERY_HPP__
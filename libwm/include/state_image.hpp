@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A binary image of the current state and the transient types so that a
+ * world model can start without rebuilding its current state from the
+ * database. Each image carries a watermark chosen by the database backend;
+ * an image is only loaded if its watermark is the one the database expects,
+ * meaning that nothing was written to the database after the image.
+ * Images are written in host byte order and are not meant to be moved
+ * between machines.
+ ******************************************************************************/
+
+#ifndef __STATE_IMAGE_HPP__
+#define __STATE_IMAGE_HPP__
+
+#include <cstdint>
+#include <set>
+#include <string>
+#include <utility>
+
+#include "sharded_world_state.hpp"
+#include "symbol_table.hpp"
+
+class StateImage {
+  public:
+    ///Attribute name and origin pairs of transient types
+    typedef std::set<std::pair<SymbolTable::Symbol, SymbolTable::Symbol>> TransientTypes;
+
+    /**
+     * Write the state and transient types to the file with the given
+     * watermark. The image is written to a temporary file that replaces the
+     * old image once it is complete. Returns false if it could not be written.
+     */
+    static bool save(const std::string& filename, int64_t watermark,
+        ShardedWorldState& state, const TransientTypes& transient);
+
+    /**
+     * Replace the state and transient types with those of the image in the
+     * file. Returns false, changing nothing, if the file is missing, damaged,
+     * or does not have the given watermark.
+     */
+    static bool load(const std::string& filename, int64_t watermark,
+        ShardedWorldState& state, TransientTypes& transient);
+};
+
+#endif //ifndef __STATE_IMAGE_HPP__
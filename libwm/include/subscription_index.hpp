@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * An inverted index over standing queries so that an update is only matched
+ * against the queries that could be interested in it.
+ * Queries whose attribute patterns are all literal strings are indexed by
+ * those attribute names and every other query is a candidate for any
+ * attribute. Each query also has a literal prefix taken from its URI pattern
+ * and is only a candidate if one of the updated URIs starts with it.
+ * Candidates still need to be checked with their regular expressions.
+ ******************************************************************************/
+
+#ifndef __SUBSCRIPTION_INDEX_HPP__
+#define __SUBSCRIPTION_INDEX_HPP__
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <owl/world_model_protocol.hpp>
+
+#include "semaphore.hpp"
+#include "sharded_world_state.hpp"
+#include "symbol_table.hpp"
+
+class StandingQuery;
+
+class SubscriptionIndex {
+  private:
+    //Iterating threads flag this and inserts and erases lock it
+    Semaphore access_control;
+
+    //Every indexed query and the literal prefix of its URI pattern
+    std::map<StandingQuery*, std::u16string> uri_prefix;
+
+    //Queries whose attribute patterns are all literal, by attribute name
+    std::unordered_map<SymbolTable::Symbol, std::set<StandingQuery*>> by_attribute;
+
+    //Queries that may match any attribute name
+    std::set<StandingQuery*> any_attribute;
+
+    ///Return true if any URI in the state begins with the prefix
+    static bool hasPrefix(const SharedState& ws, const std::u16string& prefix);
+
+    SubscriptionIndex& operator=(const SubscriptionIndex&) = delete;
+    SubscriptionIndex(const SubscriptionIndex&) = delete;
+
+  public:
+    SubscriptionIndex() {};
+
+    /**
+     * Add a query with the given URI and attribute patterns.
+     * Waits for any threads that are iterating over the index.
+     */
+    void insert(StandingQuery* sq, const world_model::URI& uri_pattern,
+        const std::vector<std::u16string>& desired_attributes);
+
+    /**
+     * Remove a query. Once this returns no thread is using the query
+     * through this index.
+     */
+    void erase(StandingQuery* sq);
+
+    ///Call f on every query in the index
+    void for_each(std::function<void(StandingQuery*)> f);
+
+    /**
+     * Call f on every query that might be interested in the given update.
+     * Invalidations are not filtered by attribute name because the query
+     * may need to see them to expire values that it already stored.
+     * The function must not insert into or erase from this index.
+     */
+    void forEachCandidate(const SharedState& state,
+        const SharedState& transients, bool invalidation,
+        std::function<void(StandingQuery*)> f);
+};
+
+#endif //ifndef __SUBSCRIPTION_INDEX_HPP__
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A process-wide table of interned strings. URIs, attribute names, and origins
+ * are repeated many times in the world model so they are stored once here and
+ * referred to with compact integer symbols elsewhere. Symbols can be compared
+ * and used as map keys much more cheaply than the strings themselves.
+ * Interned strings are never removed so a symbol stays valid for the life of
+ * the process.
+ ******************************************************************************/
+
+#ifndef __SYMBOL_TABLE_HPP__
+#define __SYMBOL_TABLE_HPP__
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include "semaphore.hpp"
+
+class SymbolTable {
+  public:
+    typedef uint32_t Symbol;
+
+  private:
+    struct Entry {
+      std::u16string str;
+      //Narrow copy of the string for POSIX regex matching
+      std::string narrow;
+    };
+
+    //Strings in the order that they were interned, indexed by symbol.
+    //A deque never moves its elements so references to them remain valid.
+    static std::deque<Entry> strings;
+    static std::unordered_map<std::u16string, Symbol> symbols;
+    //Lookups flag this and new strings lock it
+    static Semaphore access_control;
+
+  public:
+    /**
+     * Return the symbol for this string, adding the string to the table if
+     * it has not been seen before.
+     */
+    static Symbol intern(const std::u16string& str);
+
+    /**
+     * Find the symbol for this string without adding it to the table.
+     * Returns false if the string has never been interned.
+     */
+    static bool find(const std::u16string& str, Symbol& symbol);
+
+    ///Return the string for an interned symbol.
+    static const std::u16string& lookup(Symbol symbol);
+
+    ///Return a narrow (char) copy of the string for an interned symbol.
+    static const std::string& narrow(Symbol symbol);
+
+    ///The number of interned strings.
+    static size_t size();
+};
+
+#endif //ifndef __SYMBOL_TABLE_HPP__
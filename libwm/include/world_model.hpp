@@ -29,7 +29,9 @@
 #ifndef __WORLD_MODEL_HPP__
 #define __WORLD_MODEL_HPP__
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <string>
@@ -39,14 +41,42 @@
 
 #include <owl/world_model_protocol.hpp>
 
+#include "recent_history.hpp"
 #include "semaphore.hpp"
+#include "sharded_world_state.hpp"
 #include "standing_query.hpp"
+#include "symbol_table.hpp"
 
 ///Representation of storage and search functionality for the world model
 class WorldModel {
   public:
     typedef std::map<world_model::URI, std::vector<world_model::Attribute>> world_state;
 
+    /**
+     * Called with each URI that matches a snapshot request and the matching
+     * attributes of that URI. The attributes point into the current state
+     * and are only valid during the call.
+     */
+    typedef std::function<void(SymbolTable::Symbol uri,
+        const std::vector<const InternedAttribute*>& attributes)> SnapshotVisitor;
+
+    /**
+     * Yields the data of a range request a chunk at a time so that the
+     * whole range is never held in memory at once.
+     */
+    class RangeCursor {
+      public:
+        virtual ~RangeCursor() {};
+
+        /**
+         * Replace chunk with the next rows of the range. Every row in a
+         * chunk was created no later than any row of the following chunks
+         * and each URI's attributes are in creation date order.
+         * Returns false, leaving chunk empty, once the range is exhausted.
+         */
+        virtual bool next(world_state& chunk) = 0;
+    };
+
   private:
 
     WorldModel& operator=(const WorldModel&) = delete;
@@ -56,14 +86,19 @@ class WorldModel {
     //Do not store transient types in a database.
     //Recognize types by a unique attribute name and origin pair
     std::mutex transient_lock;
-    std::set<std::pair<std::u16string, std::u16string>> transient;
+    std::set<std::pair<SymbolTable::Symbol, SymbolTable::Symbol>> transient;
 
-    //The current state of the world model.
-    world_state cur_state;
+    //The current state of the world model. The state is sharded by URI and
+    //each shard has its own access control so that reads can be done
+    //simultaneously and writes only require exclusive access to one shard.
+    ShardedWorldState cur_state;
 
-    //Read operations can be done simultaneously but a write operation requires
-    //exclusive access to the current state map.
-    Semaphore access_control;
+    //Recent versions of each attribute so that out of order data can be
+    //placed into the history without asking the database
+    RecentHistory recent_history;
+
+    ///Keep only the max_rows attributes with the earliest creation dates
+    static void keepEarliest(world_state& state, size_t max_rows);
     
   public:
 
@@ -136,6 +171,27 @@ class WorldModel {
                                         std::vector<std::u16string>& desired_attributes,
                                         bool get_data = true);
 
+    /**
+     * Visit the current state of each URI that matches a snapshot request
+     * without copying it into a world_state. Matching follows the same rules
+     * as currentSnapshot.
+     * The URI's shard is flagged for reading while the visitor runs, so the
+     * visitor should be quick and must not write to the world model.
+     */
+    void visitCurrentSnapshot(const world_model::URI& uri,
+                              std::vector<std::u16string>& desired_attributes,
+                              SnapshotVisitor visitor);
+
+    /**
+     * Visit the current state of the given URIs, in order, like the pattern
+     * version of visitCurrentSnapshot. This lets a large snapshot be visited
+     * a few URIs at a time from the results of searchURI.
+     */
+    void visitCurrentSnapshot(std::vector<world_model::URI>::const_iterator first,
+                              std::vector<world_model::URI>::const_iterator last,
+                              std::vector<std::u16string>& desired_attributes,
+                              SnapshotVisitor visitor);
+
     /**
      * Get the state of the world model after the data from the given time range.
      * Any number of read requests can be simultaneously serviced.
@@ -151,13 +207,45 @@ class WorldModel {
     virtual world_state historicDataInRange(const world_model::URI& uri,
                                             std::vector<std::u16string>& desired_attributes,
                                             world_model::grail_time start, world_model::grail_time stop) = 0;
+
+    /**
+     * Get the earliest data in a time range, at most max_rows attributes.
+     * Each URI's attributes are in creation date order.
+     * The default reads the whole range with historicDataInRange, so
+     * backends should override this to only read the rows they return.
+     */
+    virtual world_state historicDataPage(const world_model::URI& uri,
+                                         std::vector<std::u16string>& desired_attributes,
+                                         world_model::grail_time start, world_model::grail_time stop,
+                                         size_t max_rows);
+
+    /**
+     * Get the same data as historicDataInRange through a cursor that yields
+     * at most chunk_rows attributes at a time.
+     * The default cursor reads the range a page at a time with
+     * historicDataPage, starting each page at the last creation date seen.
+     */
+    virtual std::unique_ptr<RangeCursor> historicRangeCursor(const world_model::URI& uri,
+                                                             std::vector<std::u16string>& desired_attributes,
+                                                             world_model::grail_time start, world_model::grail_time stop,
+                                                             size_t chunk_rows);
     
     /**
      * Register an attribute name as a transient type. Transient types are not
      * permanently stored on disk but are retrieveable through currentSnapshot requests.
      */
     virtual void registerTransient(std::u16string& attr_name, std::u16string& origin);
-    
+
+    /**
+     * Save an image of the current state that the next start can load
+     * instead of rebuilding the current state from the database. The image
+     * is only loaded if nothing was written after it, so save it once no
+     * more writes can arrive, such as at shutdown.
+     * Returns false if this world model does not keep images or the image
+     * could not be saved.
+     */
+    virtual bool saveStateImage() { return false; }
+
     /**
      * When this request is called the query object is immediately populated.
      * Afterwards any updates that arrive that match the query criteria are
@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A bounded ring of the most recent versions of each attribute.
+ ******************************************************************************/
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include <recent_history.hpp>
+
+using world_model::grail_time;
+typedef RecentHistory::Version Version;
+
+//Drop the oldest versions of a ring that is over its depth
+static void trim(std::vector<Version>& ring, size_t depth) {
+  if (ring.size() > depth) {
+    ring.erase(ring.begin(), ring.begin() + (ring.size() - depth));
+  }
+}
+
+RecentHistory::RecentHistory(size_t depth, size_t num_shards) :
+  depth(std::max<size_t>(2, depth)), shards(num_shards) {
+}
+
+RecentHistory::Shard& RecentHistory::shardFor(const Key& key) {
+  //Shard by URI so that all of a URI's attributes are together
+  return shards[std::get<0>(key) % shards.size()];
+}
+
+void RecentHistory::start(const Key& key, grail_time creation) {
+  Shard& shard = shardFor(key);
+  std::unique_lock<std::mutex> lck(shard.ring_mutex);
+  shard.rings[key] = std::vector<Version>{Version{creation, 0}};
+}
+
+void RecentHistory::advance(const Key& key, grail_time previous, grail_time creation) {
+  Shard& shard = shardFor(key);
+  std::unique_lock<std::mutex> lck(shard.ring_mutex);
+  std::vector<Version>& ring = shard.rings[key];
+  //Start over from the previous value if the history does not end there
+  if (ring.empty() or ring.back().creation_date != previous) {
+    ring.assign(1, Version{previous, 0});
+  }
+  ring.back().expiration_date = creation;
+  ring.push_back(Version{creation, 0});
+  trim(ring, depth);
+}
+
+bool RecentHistory::splice(const Key& key, grail_time current, grail_time creation,
+    grail_time& expiration, bool& has_before, Version& before) {
+  Shard& shard = shardFor(key);
+  std::unique_lock<std::mutex> lck(shard.ring_mutex);
+  std::vector<Version>& ring = shard.rings[key];
+  //Without a history ending at the current value only the current value is known
+  if (ring.empty() or ring.back().creation_date != current) {
+    ring.assign(1, Version{current, 0});
+  }
+  if (creation < ring.front().creation_date) {
+    return false;
+  }
+  //Find the last version created at or before this one
+  auto after = std::upper_bound(ring.begin(), ring.end(), creation,
+      [](grail_time time, const Version& v) { return time < v.creation_date;});
+  auto prev = after - 1;
+  expiration = prev->expiration_date;
+  //A value with the same creation date as a known version changes nothing
+  if (prev->creation_date == creation) {
+    has_before = false;
+    return true;
+  }
+  prev->expiration_date = creation;
+  has_before = true;
+  before = *prev;
+  ring.insert(after, Version{creation, expiration});
+  trim(ring, depth);
+  return true;
+}
+
+void RecentHistory::forget(const Key& key) {
+  Shard& shard = shardFor(key);
+  std::unique_lock<std::mutex> lck(shard.ring_mutex);
+  shard.rings.erase(key);
+}
+
+void RecentHistory::forget(SymbolTable::Symbol uri) {
+  Shard& shard = shardFor(Key(uri, 0, 0));
+  std::unique_lock<std::mutex> lck(shard.ring_mutex);
+  auto first = shard.rings.lower_bound(Key(uri, 0, 0));
+  auto last = first;
+  while (last != shard.rings.end() and std::get<0>(last->first) == uri) {
+    ++last;
+  }
+  shard.rings.erase(first, last);
+}
+
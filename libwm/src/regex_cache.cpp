@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <regex_cache.hpp>
+
+//Characters with special meaning in POSIX extended regular expressions
+static const std::u16string special_chars = u".[]()*+?{}|^$\\";
+
+//Find the literal string at the start of a regex pattern
+static std::u16string findPrefix(const std::u16string& pattern) {
+  //Alternation can make any part of the pattern optional
+  if (std::u16string::npos != pattern.find(u'|')) {
+    return std::u16string();
+  }
+  //Matches are anchored at the start anyway
+  size_t start = (not pattern.empty() and u'^' == pattern[0]) ? 1 : 0;
+  size_t end = pattern.find_first_of(special_chars, start);
+  if (std::u16string::npos == end) {
+    return pattern.substr(start);
+  }
+  //A repetition makes the character before it optional
+  if (end > start and (u'*' == pattern[end] or u'?' == pattern[end] or u'{' == pattern[end])) {
+    --end;
+  }
+  return pattern.substr(start, end - start);
+}
+
+CompiledPattern::CompiledPattern(const std::u16string& pattern) {
+  if (std::u16string::npos == pattern.find_first_of(special_chars)) {
+    kind = Kind::literal;
+    literal = pattern;
+  }
+  else if (2 <= pattern.size() and
+           0 == pattern.compare(pattern.size() - 2, 2, u".*") and
+           pattern.size() - 2 == pattern.find_first_of(special_chars)) {
+    kind = Kind::prefix;
+    literal = pattern.substr(0, pattern.size() - 2);
+  }
+  else {
+    std::string narrow(pattern.begin(), pattern.end());
+    if (0 == regcomp(&exp, narrow.c_str(), REG_EXTENDED)) {
+      kind = Kind::regex;
+      prefix = findPrefix(pattern);
+    }
+    else {
+      kind = Kind::invalid;
+      std::cerr<<"Error compiling regular expression: "<<narrow<<".\n";
+    }
+  }
+  narrow_literal = std::string(literal.begin(), literal.end());
+  if (Kind::literal == kind or Kind::prefix == kind) {
+    prefix = literal;
+  }
+}
+
+CompiledPattern::~CompiledPattern() {
+  if (Kind::regex == kind) {
+    regfree(&exp);
+  }
+}
+
+bool CompiledPattern::fullMatch(const std::u16string& str) const {
+  switch (kind) {
+    case Kind::literal:
+      return str == literal;
+    case Kind::prefix:
+      return 0 == str.compare(0, literal.size(), literal);
+    case Kind::regex:
+      return fullMatch(std::string(str.begin(), str.end()));
+    default:
+      return false;
+  }
+}
+
+bool CompiledPattern::fullMatch(const std::string& narrow) const {
+  return fullMatch(narrow.c_str(), narrow.size());
+}
+
+bool CompiledPattern::fullMatch(const char* narrow, size_t length) const {
+  switch (kind) {
+    case Kind::literal:
+      return 0 == narrow_literal.compare(0, std::string::npos, narrow, length);
+    case Kind::prefix:
+      return length >= narrow_literal.size() and
+        0 == narrow_literal.compare(0, std::string::npos, narrow, narrow_literal.size());
+    case Kind::regex:
+      {
+        //Check for a match that consumes the entire string
+        regmatch_t pmatch;
+        int match = regexec(&exp, narrow, 1, &pmatch, 0);
+        return 0 == match and 0 == pmatch.rm_so and length == pmatch.rm_eo;
+      }
+    default:
+      return false;
+  }
+}
+
+std::list<RegexCache::Entry> RegexCache::entries;
+std::unordered_map<std::u16string, std::list<RegexCache::Entry>::iterator> RegexCache::index;
+std::mutex RegexCache::cache_mutex;
+
+std::shared_ptr<const CompiledPattern> RegexCache::get(const std::u16string& pattern) {
+  {
+    std::unique_lock<std::mutex> lck(cache_mutex);
+    auto I = index.find(pattern);
+    if (I != index.end()) {
+      //Move this pattern to the front of the list
+      entries.splice(entries.begin(), entries, I->second);
+      return I->second->second;
+    }
+  }
+  //Compile outside of the lock, then cache the result unless another thread
+  //cached the same pattern in the meantime.
+  std::shared_ptr<const CompiledPattern> compiled = std::make_shared<const CompiledPattern>(pattern);
+  std::unique_lock<std::mutex> lck(cache_mutex);
+  auto I = index.find(pattern);
+  if (I != index.end()) {
+    entries.splice(entries.begin(), entries, I->second);
+    return I->second->second;
+  }
+  entries.push_front(Entry{pattern, compiled});
+  index[pattern] = entries.begin();
+  //Evict the least recently used pattern
+  if (entries.size() > capacity) {
+    index.erase(entries.back().first);
+    entries.pop_back();
+  }
+  return compiled;
+}
+
+size_t RegexCache::size() {
+  std::unique_lock<std::mutex> lck(cache_mutex);
+  return entries.size();
+}
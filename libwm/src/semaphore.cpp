@@ -1,35 +1,69 @@
+#include <atomic>
 #include <condition_variable>
 #include <mutex>
 
 #include <semaphore.hpp>
 
-Semaphore::Semaphore() {
-  count = 0;
+Semaphore::Semaphore() : state(0), readers_waiting(0) {
 }
 
 void Semaphore::flag() {
-  std::unique_lock<std::mutex> lck(master);
-  ++count;
+  //Fast path: no writer is waiting so just count this reader.
+  uint32_t cur = state.load();
+  while (not (cur & writer_bit)) {
+    if (state.compare_exchange_weak(cur, cur + 1)) {
+      return;
+    }
+  }
+  //Slow path: wait for the writer to finish. Writers only set the writer
+  //bit while holding m so the bit cannot be set again between the check
+  //below and incrementing the reader count.
+  std::unique_lock<std::mutex> lck(m);
+  ++readers_waiting;
+  while (state.load() & writer_bit) {
+    reader_cond.wait(lck);
+  }
+  ++state;
+  --readers_waiting;
+  //The next writer waits for all blocked readers to enter first.
+  if (0 == readers_waiting) {
+    writer_cond.notify_all();
+  }
 }
+
 void Semaphore::unflag() {
-  std::unique_lock<std::mutex> lck(master);
-  --count;
-  //If a lock call is blocking on the count let it know that count
-  //has been decremented
-  cond.notify_one();
+  uint32_t prev = state.fetch_sub(1);
+  //If this was the last reader and a writer is waiting let it know that
+  //it can proceed. Notify under the mutex so the wakeup cannot be lost.
+  if ((prev & writer_bit) and 1 == (prev & ~writer_bit)) {
+    std::unique_lock<std::mutex> lck(m);
+    writer_cond.notify_all();
+  }
 }
 
 void Semaphore::lock() {
-  //While this is locked new calls to flag will block.
-  std::unique_lock<std::mutex> lck(count_m);
-  while(count != 0) {
-    cond.wait(lck);
+  //Only one writer can wait for readers at a time.
+  writer_m.lock();
+  std::unique_lock<std::mutex> lck(m);
+  //Let in any readers that blocked on the previous writer.
+  while (0 != readers_waiting) {
+    writer_cond.wait(lck);
+  }
+  //While this is set new calls to flag will block.
+  state |= writer_bit;
+  //Wait for readers that already flagged to finish.
+  while (0 != (state.load() & ~writer_bit)) {
+    writer_cond.wait(lck);
   }
-  //Lock once more so that a call to unlock() is needed.
-  master.lock();
 }
+
 void Semaphore::unlock() {
-  master.unlock();
+  {
+    std::unique_lock<std::mutex> lck(m);
+    state &= ~writer_bit;
+    reader_cond.notify_all();
+  }
+  writer_m.unlock();
 }
 
 SemaphoreFlag::SemaphoreFlag(Semaphore& s) : s(s){
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <sharded_world_state.hpp>
+
+using namespace world_model;
+typedef SymbolTable::Symbol Symbol;
+
+Payload makePayload(const Buffer& data) {
+  static const Payload empty = std::make_shared<const Buffer>();
+  if (data.empty()) {
+    return empty;
+  }
+  return std::make_shared<const Buffer>(data);
+}
+
+InternedAttribute::InternedAttribute(const Attribute& attr) :
+  name(SymbolTable::intern(attr.name)), origin(SymbolTable::intern(attr.origin)),
+  creation_date(attr.creation_date), expiration_date(attr.expiration_date),
+  data(makePayload(attr.data)) {
+}
+
+InternedAttribute::InternedAttribute(const Attribute& attr, Symbol name, Symbol origin) :
+  name(name), origin(origin),
+  creation_date(attr.creation_date), expiration_date(attr.expiration_date),
+  data(makePayload(attr.data)) {
+}
+
+InternedAttribute::InternedAttribute(Symbol name, Symbol origin,
+    grail_time creation_date, grail_time expiration_date, Payload data) :
+  name(name), origin(origin),
+  creation_date(creation_date), expiration_date(expiration_date),
+  data(data) {
+}
+
+Attribute InternedAttribute::toAttribute(bool get_data) const {
+  return Attribute{SymbolTable::lookup(name), creation_date, expiration_date,
+    SymbolTable::lookup(origin), get_data ? *data : Buffer{}};
+}
+
+SharedState toSharedState(const WorldState& ws) {
+  SharedState ss;
+  for (const std::pair<const URI, std::vector<Attribute>>& entry : ws) {
+    std::vector<InternedAttribute>& attributes = ss[entry.first];
+    for (const Attribute& attr : entry.second) {
+      attributes.push_back(InternedAttribute(attr));
+    }
+  }
+  return ss;
+}
+
+WorldState toWorldState(const SharedState& ss, bool get_data) {
+  WorldState ws;
+  for (const std::pair<const URI, std::vector<InternedAttribute>>& entry : ss) {
+    std::vector<Attribute>& attributes = ws[entry.first];
+    for (const InternedAttribute& attr : entry.second) {
+      attributes.push_back(attr.toAttribute(get_data));
+    }
+  }
+  return ws;
+}
+
+ShardedWorldState::ShardedWorldState(size_t num_shards) :
+  shards(0 == num_shards ? 1 : num_shards) {
+}
+
+ShardedWorldState::Shard& ShardedWorldState::shardFor(Symbol uri) {
+  return shards[uri % shards.size()];
+}
+
+void ShardedWorldState::updateIndex(Symbol uri, bool present) {
+  const std::u16string& name = SymbolTable::lookup(uri);
+  SemaphoreLock lck(index_control);
+  if (present) {
+    uri_index[name] = uri;
+  }
+  else {
+    uri_index.erase(name);
+  }
+}
+
+size_t ShardedWorldState::size() {
+  size_t total = 0;
+  for (Shard& shard : shards) {
+    SemaphoreFlag flag(shard.access_control);
+    total += shard.state.size();
+  }
+  return total;
+}
+
+void ShardedWorldState::forEach(std::function<void(Symbol, const std::vector<InternedAttribute>&)> f) {
+  for (Shard& shard : shards) {
+    SemaphoreFlag flag(shard.access_control);
+    for (const std::pair<const Symbol, std::vector<InternedAttribute>>& entry : shard.state) {
+      f(entry.first, entry.second);
+    }
+  }
+}
+
+void ShardedWorldState::forEachShard(std::function<void(SharedState&)> f) {
+  for (Shard& shard : shards) {
+    SharedState ws;
+    {
+      SemaphoreFlag flag(shard.access_control);
+      for (const std::pair<const Symbol, std::vector<InternedAttribute>>& entry : shard.state) {
+        ws[SymbolTable::lookup(entry.first)] = entry.second;
+      }
+    }
+    if (not ws.empty()) {
+      f(ws);
+    }
+  }
+}
+
+void ShardedWorldState::forEachWithPrefix(const std::u16string& prefix,
+    std::function<void(Symbol)> f) {
+  SemaphoreFlag flag(index_control);
+  //URIs with this prefix are sorted at or just after the prefix itself
+  for (auto I = uri_index.lower_bound(prefix);
+      I != uri_index.end() and 0 == I->first.compare(0, prefix.size(), prefix); ++I) {
+    f(I->second);
+  }
+}
+
+bool ShardedWorldState::contains(Symbol uri) {
+  Shard& shard = shardFor(uri);
+  SemaphoreFlag flag(shard.access_control);
+  return shard.state.end() != shard.state.find(uri);
+}
+
+void ShardedWorldState::clear() {
+  //Lock every shard while clearing so that readers never see a mix of
+  //old and new state within a single shard
+  for (Shard& shard : shards) {
+    SemaphoreLock lck(shard.access_control);
+    shard.state.clear();
+  }
+  SemaphoreLock lck(index_control);
+  uri_index.clear();
+}
+
+void ShardedWorldState::assign(const WorldState& ws) {
+  clear();
+  for (const std::pair<const URI, std::vector<Attribute>>& entry : ws) {
+    Symbol uri = SymbolTable::intern(entry.first);
+    ShardLock lck(*this, uri);
+    std::vector<InternedAttribute>& attributes = (*lck)[uri];
+    for (const Attribute& attr : entry.second) {
+      attributes.push_back(InternedAttribute(attr));
+    }
+  }
+}
+
+void ShardedWorldState::assign(const InternedState& is) {
+  clear();
+  for (const std::pair<const Symbol, std::vector<InternedAttribute>>& entry : is) {
+    ShardLock lck(*this, entry.first);
+    (*lck)[entry.first] = entry.second;
+  }
+}
+
+ShardFlag::ShardFlag(ShardedWorldState& sws, Symbol uri) :
+  flag(sws.shardFor(uri).access_control), state(sws.shardFor(uri).state) {
+}
+
+ShardLock::ShardLock(ShardedWorldState& sws, Symbol uri) :
+  lock(sws.shardFor(uri).access_control), state(sws.shardFor(uri).state),
+  sws(sws), uri(uri) {
+  existed = state.end() != state.find(uri);
+}
+
+ShardLock::~ShardLock() {
+  //The shard is still locked here so the index changes in the same order
+  //as the shard does
+  bool exists = state.end() != state.find(uri);
+  if (exists != existed) {
+    sws.updateIndex(uri, exists);
+  }
+}
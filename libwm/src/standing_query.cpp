@@ -34,21 +34,35 @@
 using std::u16string;
 using world_model::WorldState;
 
-//Input/output queue. Input from solver threads, output to standing query thread
+//Input queues, one per matcher thread. Input from solver threads, output to
+//the matcher threads.
 std::mutex StandingQuery::solver_data_mutex;
-std::queue<StandingQuery::Update> StandingQuery::solver_data;
+std::vector<std::queue<std::shared_ptr<const StandingQuery::Update>>> StandingQuery::solver_data;
 
-//Thread that runs the dataProcessingLoop.
-std::thread StandingQuery::data_processing_thread;
+//Signal the matcher threads when there is new data
+std::condition_variable StandingQuery::data_available;
 
-///Mutex that ensures that only one data_processing_thread runs.
-std::mutex StandingQuery::data_processing_mutex;
+//Signal solver and flushing threads when data has been delivered
+std::condition_variable StandingQuery::data_delivered;
+
+uint64_t StandingQuery::updates_offered = 0;
+std::vector<uint64_t> StandingQuery::updates_delivered;
+
+bool StandingQuery::stop_processing = false;
+
+//Threads that run the dataProcessingLoop.
+std::vector<std::thread> StandingQuery::data_processing_threads;
+
+std::atomic<size_t> StandingQuery::next_matcher(0);
+
+const size_t StandingQuery::max_queued_updates;
+const size_t StandingQuery::max_matcher_threads;
 
 /**
- * The set of all current standing queries, used to find all of the
- * existing StandingQuery objects so that data can be offered to them.
+ * The index of all current standing queries, used to find the
+ * StandingQuery objects that data should be offered to.
  */
-ThreadsafeSet<StandingQuery*> StandingQuery::subscriptions;
+SubscriptionIndex StandingQuery::subscriptions;
 
 /**
  * A mutex to protect access to the @subscriptions set.
@@ -66,101 +80,149 @@ std::map<std::u16string, std::set<std::u16string>> StandingQuery::origin_attribu
  */
 std::mutex StandingQuery::origin_attr_mutex;
 
+//Declared after the other static members so that the matcher threads are
+//stopped before the queues and subscriptions they use are destroyed.
+StandingQuery::ProcessingShutdown StandingQuery::processing_shutdown;
+
+StandingQuery::ProcessingShutdown::~ProcessingShutdown() {
+	{
+		std::unique_lock<std::mutex> lck(solver_data_mutex);
+		stop_processing = true;
+	}
+	data_available.notify_all();
+	for (std::thread& t : data_processing_threads) {
+		t.join();
+	}
+}
+
 /**
- * Loop that moves data from the internal data queue to interested client
- * threads.
+ * Match an update against a standing query and insert anything of
+ * interest into it.
  */
-void StandingQuery::dataProcessingLoop() {
-	bool running = true;
-	static timespec sleep_interval;
-	sleep_interval.tv_sec = 0;
-	//Sleep for 5 milliseconds by default, tune according to the rate of new data.
-	sleep_interval.tv_nsec = 5000000;
+void StandingQuery::deliverUpdate(StandingQuery* sq, const Update& update) {
+	//Queries with invalid patterns cannot match anything
+	if (not sq->regex_valid) {
+		return;
+	}
+	//Check for invalidation from expiration/deletion
+	if (update.invalidate_attributes) {
+		for (auto& I : update.state) {
+			sq->invalidateAttributes(I.first, I.second);
+		}
+	}
+	else if (update.invalidate_objects) {
+		for (auto& I : update.state) {
+			//Invalidating an ID requires an update to the creation attribute
+			if (not I.second.empty() and I.second[0].name == SymbolTable::intern(u"creation")) {
+				sq->invalidateObject(I.first, I.second[0]);
+			}
+		}
+	}
+	else {
+		//First see what items are of interest. This also tells the standing
+		//query to remember partial matches so we do not need to keep feeding
+		//it the current state, only the updates.
+		if (not update.state.empty()) {
+			auto ws = sq->showInterested(update.state);
+			//Insert the data.
+			if (not ws.empty()) {
+				sq->insertData(ws);
+			}
+		}
+		//Insert transients separately from normal data to enforce exact string matching
+		if (not update.transients.empty()) {
+			auto ws = sq->showInterestedTransient(update.transients);
+			if (not ws.empty()) {
+				sq->insertData(ws);
+			}
+		}
+	}
+}
 
+/**
+ * Loop that moves data from a matcher thread's queue to the interested
+ * standing queries.
+ */
+void StandingQuery::dataProcessingLoop(size_t thread_index) {
 	try {
-		while (running) {
-			//TODO Put in a timer and fail with an error after too long?
-			solver_data_mutex.lock();
-			if (not solver_data.empty()) {
-				//TODO Move data from @solver_data into individual queries.
-				//TODO If there is no more data then sleep for a brief period
-				//TODO If there has not been any new data for a long period of time exit the loop
-				Update update;
-
-				auto push = [&](StandingQuery* sq) {
-					//Check for invalidation from expiration/deletion
-					if (update.invalidate_attributes) {
-						for (auto& I : update.state) {
-							sq->invalidateAttributes(I.first, I.second);
-						}
-					}
-					else if (update.invalidate_objects) {
-						for (auto& I : update.state) {
-							//Invalidating an ID requires an update to the creation attribute
-							if (not I.second.empty() and I.second[0].name == u"creation") {
-								sq->invalidateObject(I.first, I.second[0]);
-							}
-						}
-					}
-					else {
-						//First see what items are of interest. This also tells the standing
-						//query to remember partial matches so we do not need to keep feeding
-						//it the current state, only the updates.
-						auto ws = sq->showInterested(update.state);
-						//Insert the data.
-						if (not ws.empty()) {
-							sq->insertData(ws);
-						}
-						/* TODO FIXME Handle transients in the queue -- have a separate transient queue?
-						//Insert transients separately from normal data to enforce exact string matching
-						ws = sq->showInterestedTransient(transients);
-						if (not ws.empty()) {
-						sq->insertData(ws);
-						}
-						*/
-					}
-				};
-				while (not solver_data.empty()) {
-					update = solver_data.front();
-					solver_data.pop();
-					StandingQuery::for_each(push);
+		while (true) {
+			std::shared_ptr<const Update> update;
+			size_t num_threads;
+			{
+				std::unique_lock<std::mutex> lck(solver_data_mutex);
+				while (not stop_processing and solver_data[thread_index].empty()) {
+					data_available.wait(lck);
+				}
+				if (stop_processing) {
+					return;
 				}
-				solver_data_mutex.unlock();
+				//Leave the update in the queue until it is delivered so that it
+				//counts against the queue limit.
+				update = solver_data[thread_index].front();
+				num_threads = data_processing_threads.size();
 			}
-			else {
-				solver_data_mutex.unlock();
-				timespec remaining;
-				nanosleep(&sleep_interval, &remaining);
-				//TODO See if sleep was interrupted
-				//TODO Tune the sleep interval to anticipate data arrival
+			//Deliver to this thread's share of the standing queries. Other matcher
+			//threads can deliver to their own standing queries at the same time.
+			auto push = [&](StandingQuery* sq) {
+				if (thread_index == sq->matcher % num_threads) {
+					deliverUpdate(sq, *update);
+				}
+			};
+			subscriptions.forEachCandidate(update->state, update->transients,
+					update->invalidate_attributes or update->invalidate_objects, push);
+			{
+				std::unique_lock<std::mutex> lck(solver_data_mutex);
+				solver_data[thread_index].pop();
+				++updates_delivered[thread_index];
 			}
+			data_delivered.notify_all();
 		}
 	}
-	catch (std::exception err) {
-		std::cerr<<"Error in streaming data thread: "<<err.what()<<'\n';
+	catch (std::exception& err) {
+		std::cerr<<"Error in standing query matching thread: "<<err.what()<<'\n';
 	}
-
-	//Unlock the mutex so that a new data processing thread can spawn.
-	data_processing_mutex.unlock();
 }
 
 /**
  * Offer data from the input queue for every StandingQuery
  */
-void StandingQuery::offerData(WorldState& ws, bool invalidate_attributes, bool invalidate_objects) {
-	//TODO Put in a timer and fail with an error after too long?
+void StandingQuery::offerData(const SharedState& ws, bool invalidate_attributes, bool invalidate_objects,
+		const SharedState& transients) {
+	std::shared_ptr<const Update> update = std::make_shared<const Update>(
+			Update{ws, transients, invalidate_attributes, invalidate_objects});
 	{
 		std::unique_lock<std::mutex> lck(solver_data_mutex);
-		solver_data.push(Update{ws, invalidate_attributes, invalidate_objects});
-	}
-	//Spawn the dataProcessingLoop thread if it is not running
-	{
-		if (data_processing_mutex.try_lock()) {
-			//The data processing thread will unlock the mutex at exit, allowing a
-			//new thread to spawn if it exits.
-			data_processing_thread = std::thread(dataProcessingLoop);
-			data_processing_thread.detach();
+		//Start the matcher threads if they are not running
+		if (data_processing_threads.empty()) {
+			size_t num_threads = std::max(1u, std::thread::hardware_concurrency());
+			num_threads = std::min(num_threads, max_matcher_threads);
+			solver_data.resize(num_threads);
+			updates_delivered.resize(num_threads, 0);
+			for (size_t i = 0; i < num_threads; ++i) {
+				data_processing_threads.push_back(std::thread(dataProcessingLoop, i));
+			}
+		}
+		//Wait for space in the queues so that memory use stays bounded if the
+		//matcher threads fall behind.
+		auto full = [&](std::queue<std::shared_ptr<const Update>>& q) {
+			return q.size() >= max_queued_updates;};
+		while (std::any_of(solver_data.begin(), solver_data.end(), full)) {
+			data_delivered.wait(lck);
+		}
+		for (auto& q : solver_data) {
+			q.push(update);
 		}
+		++updates_offered;
+	}
+	data_available.notify_all();
+}
+
+void StandingQuery::flush() {
+	std::unique_lock<std::mutex> lck(solver_data_mutex);
+	uint64_t target = updates_offered;
+	auto behind = [&](uint64_t delivered) { return delivered < target;};
+	while (std::any_of(updates_delivered.begin(), updates_delivered.end(), behind)) {
+		data_delivered.wait(lck);
 	}
 }
 
@@ -173,86 +235,66 @@ void StandingQuery::for_each(std::function<void(StandingQuery*)> f) {
 	subscriptions.for_each(f);
 }
 
-StandingQuery::StandingQuery(WorldState& cur_state, const world_model::URI& uri,
-		const std::vector<std::u16string>& desired_attributes, bool get_data) :
-	uri_pattern(uri), desired_attributes(desired_attributes), get_data(get_data) {
-	//Add this standing query into the subscriptions set so that it receives
-	//updates from the @data_processing_thread
-	subscriptions.insert(this);
-
+void StandingQuery::compilePatterns() {
 	//Set this to true only after all regex patterns have compiled
 	regex_valid = false;
-	std::string u8_pattern(uri_pattern.begin(), uri_pattern.end());
-	int err = regcomp(&uri_regex, u8_pattern.c_str(), REG_EXTENDED);
-	if (0 != err) {
+	attr_regex.clear();
+	uri_regex = RegexCache::get(uri_pattern);
+	if (not uri_regex->valid()) {
 		return;
 	}
 	for (auto I = desired_attributes.begin(); I != desired_attributes.end(); ++I) {
-		regex_t re;
-		std::string u8_attr_pattern(I->begin(), I->end());
-		int err = regcomp(&re, u8_attr_pattern.c_str(), REG_EXTENDED);
-		if (0 != err) {
-			regfree(&uri_regex);
-			for (auto J = attr_regex.begin(); J != attr_regex.end(); ++J) {
-				regfree(&(J->second));
-			}
+		std::shared_ptr<const CompiledPattern> re = RegexCache::get(*I);
+		if (not re->valid()) {
 			return;
 		}
-		else {
-			attr_regex[*I] = re;
-		}
+		attr_regex[*I] = re;
 	}
 	regex_valid = true;
-	//Set up initial data from the current state.
-  WorldState ws = this->showInterested(cur_state, true);
-  this->insertData(ws);
 }
 
-///Free memory from regular expressions
+StandingQuery::StandingQuery(ShardedWorldState& cur_state, const world_model::URI& uri,
+		const std::vector<std::u16string>& desired_attributes, bool get_data) :
+	matcher(next_matcher++), uri_pattern(uri), desired_attributes(desired_attributes), get_data(get_data) {
+	//Compile the patterns before matcher threads can see this query. A query
+	//with an invalid pattern is never indexed and so never receives updates.
+	compilePatterns();
+	if (not regex_valid) {
+		return;
+	}
+	//Add this standing query into the subscriptions set so that it receives
+	//updates from the @data_processing_threads
+	subscriptions.insert(this, uri_pattern, desired_attributes);
+	//Set up initial data from the current state, one shard at a time.
+  cur_state.forEachShard([&](const SharedState& shard) {
+      SharedState ws = this->showInterested(shard, true);
+      this->insertData(ws);
+      });
+}
+
+///Stop receiving updates
 StandingQuery::~StandingQuery() {
-  //Delete all of the regex used in the standing standing queries
-  if (regex_valid) {
-    //Delete the identifier regex
-    regfree(&uri_regex);
-    //Now delete the attribute regex patterns
-    for (auto J = attr_regex.begin(); J != attr_regex.end(); ++J) {
-      regfree(&(J->second));
-    }
-  }
+  //Compiled patterns are owned by the RegexCache and are released with their
+  //last user.
   //Remove this standing query into the subscriptions set so that it no longer
-  //receives updates from the @data_processing_thread
+  //receives updates from the @data_processing_threads
   subscriptions.erase(this);
 }
 
 ///Copy constructor
-StandingQuery::StandingQuery(const StandingQuery& other) {
+StandingQuery::StandingQuery(const StandingQuery& other) : matcher(next_matcher++) {
   uri_pattern = other.uri_pattern;
   desired_attributes = other.desired_attributes;
+  get_data = other.get_data;
 
-	//Set this to true only after all regex patterns have compiled
-	std::string u8_pattern(uri_pattern.begin(), uri_pattern.end());
-	int err = regcomp(&uri_regex, u8_pattern.c_str(), REG_EXTENDED);
-	if (0 != err) {
+	//The compiled patterns are shared with the other query
+	uri_regex = other.uri_regex;
+	attr_regex = other.attr_regex;
+	regex_valid = other.regex_valid;
+	//Only queries with valid patterns are indexed
+	if (not regex_valid) {
 		return;
 	}
-	for (auto I = desired_attributes.begin(); I != desired_attributes.end(); ++I) {
-		regex_t re;
-		std::string u8_attr_pattern(I->begin(), I->end());
-		int err = regcomp(&re, u8_attr_pattern.c_str(), REG_EXTENDED);
-		if (0 != err) {
-			regfree(&uri_regex);
-			for (auto J = attr_regex.begin(); J != attr_regex.end(); ++J) {
-				regfree(&(J->second));
-			}
-			return;
-		}
-		else {
-			attr_regex[*I] = re;
-		}
-	}
-	regex_valid = true;
-
-  get_data = other.get_data;
 
 	//Lock other query and copy its data
 	{
@@ -262,47 +304,26 @@ StandingQuery::StandingQuery(const StandingQuery& other) {
 		partial = other.partial;
 	}
   //Add this standing query into the subscriptions set so that it receives
-  //updates from the @data_processing_thread
-  subscriptions.insert(this);
+  //updates from the @data_processing_threads
+  subscriptions.insert(this, uri_pattern, desired_attributes);
 }
 
 ///Assignment
 StandingQuery& StandingQuery::operator=(const StandingQuery& other) {
-	//Clear old regex if there was one
-  if (regex_valid) {
-    regfree(&uri_regex);
-    for (auto J = attr_regex.begin(); J != attr_regex.end(); ++J) {
-      regfree(&(J->second));
-    }
-  }
+  //Remove this query from the index until its new patterns are known
+  subscriptions.erase(this);
   uri_pattern = other.uri_pattern;
   desired_attributes = other.desired_attributes;
+  get_data = other.get_data;
 
-	//Set this to true only after all regex patterns have compiled
-	regex_valid = false;
-	std::string u8_pattern(uri_pattern.begin(), uri_pattern.end());
-	int err = regcomp(&uri_regex, u8_pattern.c_str(), REG_EXTENDED);
-	if (0 != err) {
+	//The compiled patterns are shared with the other query
+	uri_regex = other.uri_regex;
+	attr_regex = other.attr_regex;
+	regex_valid = other.regex_valid;
+	//Only queries with valid patterns are indexed
+	if (not regex_valid) {
 		return *this;
 	}
-	for (auto I = desired_attributes.begin(); I != desired_attributes.end(); ++I) {
-		regex_t re;
-		std::string u8_attr_pattern(I->begin(), I->end());
-		int err = regcomp(&re, u8_attr_pattern.c_str(), REG_EXTENDED);
-		if (0 != err) {
-			regfree(&uri_regex);
-			for (auto J = attr_regex.begin(); J != attr_regex.end(); ++J) {
-				regfree(&(J->second));
-			}
-			return *this;
-		}
-		else {
-			attr_regex[*I] = re;
-		}
-	}
-	regex_valid = true;
-
-  get_data = other.get_data;
 
 	//Lock other query and copy its data
 	{
@@ -311,6 +332,8 @@ StandingQuery& StandingQuery::operator=(const StandingQuery& other) {
 		cur_state = other.cur_state;
 		partial = other.partial;
 	}
+  //Index this query with its new patterns
+  subscriptions.insert(this, uri_pattern, desired_attributes);
 	return *this;
 }
 
@@ -318,7 +341,7 @@ StandingQuery& StandingQuery::operator=(const StandingQuery& other) {
  * Return true if this origin has data that this standing query might
  * be interested in and false otherwise.
  */
-bool StandingQuery::interestingOrigin(std::u16string& origin) {
+bool StandingQuery::interestingOrigin(const std::u16string& origin) {
   //Fetch the attributes that this origin provides
   std::set<std::u16string> attrs;
   {
@@ -338,22 +361,19 @@ bool StandingQuery::interestingOrigin(std::u16string& origin) {
   for (const std::u16string& attr : attrs) {
     //See if we need to check this attribute string against regexes or if the
     //results was already computed
-    auto attr_store = attribute_accepted.find(attr);
+    SymbolTable::Symbol name_id = SymbolTable::intern(attr);
+    auto attr_store = attribute_accepted.find(name_id);
     if (attribute_accepted.end() == attr_store) {
       std::set<size_t> patt_match;
-      std::string name_str = std::string(attr.begin(), attr.end());
+      const std::string& name_str = SymbolTable::narrow(name_id);
       for (size_t search_ind = 0; search_ind < desired_attributes.size(); ++search_ind) {
-        //Use regex matching
-        regmatch_t pmatch;
-        int match = regexec(&attr_regex[desired_attributes[search_ind]],
-            name_str.c_str(), 1, &pmatch, 0);
-        if (0 == match and 0 == pmatch.rm_so and name_str.size() == pmatch.rm_eo) {
+        if (attr_regex[desired_attributes[search_ind]]->fullMatch(name_str)) {
           //Remember that this attribute was matched
           patt_match.insert(search_ind);
         }
       }
       //Now remember which desired attributes this pattern matched.
-      attribute_accepted[attr] = patt_match;
+      attribute_accepted[name_id] = patt_match;
       //Stop here if this origin is of interest
       if (not patt_match.empty()) {
         return true;
@@ -372,7 +392,7 @@ bool StandingQuery::interestingOrigin(std::u16string& origin) {
 }
 
 ///Return a subset of the world state that this query is interested in.
-WorldState StandingQuery::showInterested(WorldState& ws, bool multiple_origins) {
+SharedState StandingQuery::showInterested(const SharedState& ws, bool multiple_origins) {
   //Optimize the search if every value in this state comes from the same origin.
   //If this origin is not interesting then don't bother checking its data.
   //This is to avoid checking large numbers of attributes against the uri
@@ -380,8 +400,8 @@ WorldState StandingQuery::showInterested(WorldState& ws, bool multiple_origins)
   if (not multiple_origins and attr_regex.size() < ws.size()) {
     //Assume here that the world state does not have any empty vectors
     try {
-      if (not interestingOrigin(ws.begin()->second.at(0).origin)) {
-        return WorldState();
+      if (not interestingOrigin(SymbolTable::lookup(ws.begin()->second.at(0).origin))) {
+        return SharedState();
       }
     }
     //Catch an out of range exception from at()
@@ -396,7 +416,8 @@ WorldState StandingQuery::showInterested(WorldState& ws, bool multiple_origins)
   //doing regexp searches.
   for (auto I = ws.begin(); I != ws.end(); ++I) {
     //First check the cached results
-    auto uriI = uri_accepted.find(I->first);
+    SymbolTable::Symbol uri_id = SymbolTable::intern(I->first);
+    auto uriI = uri_accepted.find(uri_id);
     if (uriI != uri_accepted.end()) {
       if (uriI->second) {
         matches.push_back(I->first);
@@ -404,21 +425,18 @@ WorldState StandingQuery::showInterested(WorldState& ws, bool multiple_origins)
     }
     //Do a regex and update uri_accepted if no cached result was found
     else {
-      regmatch_t pmatch;
-      std::string search_id(I->first.begin(), I->first.end());
-      int match = regexec(&uri_regex, search_id.c_str(), 1, &pmatch, 0);
-      if (0 == match and 0 == pmatch.rm_so and I->first.size() == pmatch.rm_eo) {
-        uri_accepted[I->first] = true;
+      if (uri_regex->fullMatch(SymbolTable::narrow(uri_id))) {
+        uri_accepted[uri_id] = true;
         {
           std::unique_lock<std::mutex> lck(data_mutex);
-          current_matches[I->first] = std::set<std::u16string>();
+          current_matches[I->first] = std::set<SymbolTable::Symbol>();
         }
         matches.push_back(I->first);
         //Start off with no matching attributes
         uri_matches[I->first] = std::set<size_t>();
       }
       else {
-        uri_accepted[I->first] = false;
+        uri_accepted[uri_id] = false;
       }
     }
   }
@@ -426,28 +444,25 @@ WorldState StandingQuery::showInterested(WorldState& ws, bool multiple_origins)
   //Now find the attributes of interest for each URI
   //Attribute searches have AND relationships - this URI's results are only
   //matched if all of the attribute search patterns have matches.
-  WorldState result;
+  SharedState result;
   for (auto uri_match = matches.begin(); uri_match != matches.end(); ++uri_match) {
-    std::vector<world_model::Attribute>& uri_partial = partial[*uri_match];
-    //Make a vector of attributes to search through
-    std::vector<world_model::Attribute> attributes = ws[*uri_match];
+    std::vector<InternedAttribute>& uri_partial = partial[*uri_match];
+    //The attributes to search through
+    const std::vector<InternedAttribute>& attributes = ws.at(*uri_match);
     //Make a place to put results for this uri
-    std::vector<world_model::Attribute> uri_attributes;
+    std::vector<InternedAttribute> uri_attributes;
     //Fill in the attribute_accepted map for any unknown attributes
     size_t prev_match_count = uri_matches[*uri_match].size();
     for (auto I = attributes.begin(); I != attributes.end(); ++I) {
       //See if we need to check this attribute string against regexes or if the
       //results was already computed
-      auto attr_store = attribute_accepted.find(I->name);
+      SymbolTable::Symbol name_id = I->name;
+      auto attr_store = attribute_accepted.find(name_id);
       if (attribute_accepted.end() == attr_store) {
         std::set<size_t> patt_match;
-        std::string name_str = std::string(I->name.begin(), I->name.end());
+        const std::string& name_str = SymbolTable::narrow(name_id);
         for (size_t search_ind = 0; search_ind < desired_attributes.size(); ++search_ind) {
-          //Use regex matching
-          regmatch_t pmatch;
-          int match = regexec(&attr_regex[desired_attributes[search_ind]],
-              name_str.c_str(), 1, &pmatch, 0);
-          if (0 == match and 0 == pmatch.rm_so and name_str.size() == pmatch.rm_eo) {
+          if (attr_regex[desired_attributes[search_ind]]->fullMatch(name_str)) {
             //Remember that this attribute was matched
             patt_match.insert(search_ind);
             //Remember that this index was matched
@@ -455,7 +470,7 @@ WorldState StandingQuery::showInterested(WorldState& ws, bool multiple_origins)
           }
         }
         //Now remember which desired attributes this pattern matched.
-        attribute_accepted[I->name] = patt_match;
+        attribute_accepted[name_id] = patt_match;
       }
       //Otherwise add this attribute's matches to the URI's match results
       else {
@@ -465,10 +480,10 @@ WorldState StandingQuery::showInterested(WorldState& ws, bool multiple_origins)
       }
 
       //Store this if the attribute matched
-      if (not attribute_accepted[I->name].empty()) {
+      if (not attribute_accepted[name_id].empty()) {
         //Add the attribute to the list of accepted attributes for this insert
         uri_attributes.push_back(*I);
-        auto same_attr = std::find_if(uri_partial.begin(), uri_partial.end(), [&](world_model::Attribute& wma) {
+        auto same_attr = std::find_if(uri_partial.begin(), uri_partial.end(), [&](InternedAttribute& wma) {
             return wma.name == I->name and wma.origin == I->origin;});
         //Update the attribute
         if (same_attr != uri_partial.end()) {
@@ -497,7 +512,7 @@ WorldState StandingQuery::showInterested(WorldState& ws, bool multiple_origins)
   return result;
 }
 
-WorldState StandingQuery::showInterestedTransient(WorldState& ws, bool multiple_origins) {
+SharedState StandingQuery::showInterestedTransient(const SharedState& ws, bool multiple_origins) {
   //Optimize the search if every value in this state comes from the same origin.
   //If this origin is not interesting then don't bother checking its data.
   //This is to avoid checking large numbers of attributes against the uri
@@ -505,8 +520,8 @@ WorldState StandingQuery::showInterestedTransient(WorldState& ws, bool multiple_
   if (not multiple_origins and attr_regex.size() < ws.size()) {
     //Assume here that the world state does not have any empty vectors
     try {
-      if (not interestingOrigin(ws.begin()->second.at(0).origin)) {
-        return WorldState();
+      if (not interestingOrigin(SymbolTable::lookup(ws.begin()->second.at(0).origin))) {
+        return SharedState();
       }
     }
     //Catch an out of range exception from at()
@@ -521,7 +536,8 @@ WorldState StandingQuery::showInterestedTransient(WorldState& ws, bool multiple_
   //doing regexp searches.
   for (auto I = ws.begin(); I != ws.end(); ++I) {
     //First check the cached results
-    auto uriI = uri_accepted.find(I->first);
+    SymbolTable::Symbol uri_id = SymbolTable::intern(I->first);
+    auto uriI = uri_accepted.find(uri_id);
     if (uriI != uri_accepted.end()) {
       if (uriI->second) {
         matches.push_back(I->first);
@@ -529,21 +545,18 @@ WorldState StandingQuery::showInterestedTransient(WorldState& ws, bool multiple_
     }
     //Do a regex and update uri_accepted if no cached result was found
     else {
-      regmatch_t pmatch;
-      std::string search_id(I->first.begin(), I->first.end());
-      int match = regexec(&uri_regex, search_id.c_str(), 1, &pmatch, 0);
-      if (0 == match and 0 == pmatch.rm_so and I->first.size() == pmatch.rm_eo) {
-        uri_accepted[I->first] = true;
+      if (uri_regex->fullMatch(SymbolTable::narrow(uri_id))) {
+        uri_accepted[uri_id] = true;
         {
           std::unique_lock<std::mutex> lck(data_mutex);
-          current_matches[I->first] = std::set<std::u16string>();
+          current_matches[I->first] = std::set<SymbolTable::Symbol>();
         }
         matches.push_back(I->first);
         //Start off with no matching attributes
         uri_matches[I->first] = std::set<size_t>();
       }
       else {
-        uri_accepted[I->first] = false;
+        uri_accepted[uri_id] = false;
       }
     }
   }
@@ -553,25 +566,26 @@ WorldState StandingQuery::showInterestedTransient(WorldState& ws, bool multiple_
   //matched if all of the attribute search patterns have matches.
   //We don't cache transient matches since they are direct string comparisons
   //Check directly if attribute was requested
-  WorldState result;
+  SharedState result;
   for (auto uri_match = matches.begin(); uri_match != matches.end(); ++uri_match) {
     //TODO FIXME For transient attributes do not use the uri_partial structure
     //since transient values should not be stored. This also means that the
     //cached uri_matches map should not store matches to transient attributes either.
-    std::vector<world_model::Attribute>& uri_partial = partial[*uri_match];
-    //Make a vector of attributes to search through
-    std::vector<world_model::Attribute> attributes = ws[*uri_match];
+    std::vector<InternedAttribute>& uri_partial = partial[*uri_match];
+    //The attributes to search through
+    const std::vector<InternedAttribute>& attributes = ws.at(*uri_match);
     //Make a place to put results for this uri
-    std::vector<world_model::Attribute> uri_attributes;
+    std::vector<InternedAttribute> uri_attributes;
     //Fill in the attribute_accepted map for any unknown attributes
     size_t prev_match_count = uri_matches[*uri_match].size();
     for (auto I = attributes.begin(); I != attributes.end(); ++I) {
       //Use direct string comparison for transients. Don't use the cached
       //map since that just using string comparison again
+      SymbolTable::Symbol name_id = I->name;
+      const std::u16string& name_str = SymbolTable::lookup(name_id);
       std::set<size_t> patt_match;
-      std::string name_str = std::string(I->name.begin(), I->name.end());
       for (size_t search_ind = 0; search_ind < desired_attributes.size(); ++search_ind) {
-        if (I->name == desired_attributes[search_ind]) {
+        if (name_str == desired_attributes[search_ind]) {
           //Remember that this attribute was matched
           patt_match.insert(search_ind);
           //Remember that this search index was matched for this URI
@@ -579,13 +593,13 @@ WorldState StandingQuery::showInterestedTransient(WorldState& ws, bool multiple_
         }
       }
       //Now remember which desired attributes this pattern matched.
-      attribute_accepted[I->name] = patt_match;
+      attribute_accepted[name_id] = patt_match;
 
       //Store this if any attributes matched
-      if (not attribute_accepted[I->name].empty()) {
+      if (not attribute_accepted[name_id].empty()) {
         //Add the attribute to the list of accepted attributes for this insert
         uri_attributes.push_back(*I);
-        auto same_attr = std::find_if(uri_partial.begin(), uri_partial.end(), [&](world_model::Attribute& wma) {
+        auto same_attr = std::find_if(uri_partial.begin(), uri_partial.end(), [&](InternedAttribute& wma) {
             return wma.name == I->name and wma.origin == I->origin;});
         //Update the attribute
         if (same_attr != uri_partial.end()) {
@@ -614,16 +628,19 @@ WorldState StandingQuery::showInterestedTransient(WorldState& ws, bool multiple_
   return result;
 }
 
-void StandingQuery::invalidateObject(world_model::URI name, world_model::Attribute creation) {
+void StandingQuery::invalidateObject(world_model::URI name, const InternedAttribute& creation) {
   //Make sure we don't store a partial for this if it is expired or deleted.
   partial.erase(name);
-  uri_accepted.erase(name);
+  SymbolTable::Symbol uri_id;
+  if (SymbolTable::find(name, uri_id)) {
+    uri_accepted.erase(uri_id);
+  }
   uri_matches.erase(name);
   std::unique_lock<std::mutex> lck(data_mutex);
   auto state = cur_state.find(name);
   //If this data is in the current state then expire all of the attributes
   if (state != cur_state.end()) {
-    std::for_each(state->second.begin(), state->second.end(), [&](world_model::Attribute& attr) {
+    std::for_each(state->second.begin(), state->second.end(), [&](InternedAttribute& attr) {
 				//Remove this from the cached matches of this identifier and set an
 				//expiration date in the current state
         current_matches[name].erase(attr.name);
@@ -633,11 +650,11 @@ void StandingQuery::invalidateObject(world_model::URI name, world_model::Attribu
 	//expired, but now make sure that all attributes ever sent from this request
 	//are also expired.
   if (current_matches.end() != current_matches.find(name)) {
-    std::set<std::u16string>& attr_names = current_matches[name];
-    for (const std::u16string& attr_name : attr_names) {
+    std::set<SymbolTable::Symbol>& attr_names = current_matches[name];
+    for (SymbolTable::Symbol attr_name : attr_names) {
       //Push an attribute with the expired attribute's name and no data
-			cur_state[name].push_back(world_model::Attribute{attr_name,
-					creation.expiration_date, creation.expiration_date, u"", {}});
+			cur_state[name].push_back(InternedAttribute{attr_name, SymbolTable::intern(u""),
+					creation.expiration_date, creation.expiration_date, makePayload({})});
     }
 		//Finally remove this object name from the matches list.
     current_matches.erase(name);
@@ -645,23 +662,22 @@ void StandingQuery::invalidateObject(world_model::URI name, world_model::Attribu
 }
 
 void StandingQuery::invalidateAttributes(world_model::URI name,
-    std::vector<world_model::Attribute>& attrs_to_remove) {
-  using world_model::Attribute;
-  std::set<std::pair<u16string, u16string>> is_expired;
-  std::for_each(attrs_to_remove.begin(), attrs_to_remove.end(), [&](const Attribute& a) {
+    const std::vector<InternedAttribute>& attrs_to_remove) {
+  std::set<std::pair<SymbolTable::Symbol, SymbolTable::Symbol>> is_expired;
+  std::for_each(attrs_to_remove.begin(), attrs_to_remove.end(), [&](const InternedAttribute& a) {
       is_expired.insert(std::make_pair(a.name, a.origin));});
   //Make sure we don't store a partial for this if it is expired or deleted.
   {
     auto state = partial.find(name);
     if (state != partial.end()) {
-      std::vector<Attribute>& attrs = state->second;
-      attrs.erase(std::remove_if(attrs.begin(), attrs.end(), [&](Attribute& a) {
+      std::vector<InternedAttribute>& attrs = state->second;
+      attrs.erase(std::remove_if(attrs.begin(), attrs.end(), [&](InternedAttribute& a) {
             return 0 < is_expired.count(std::make_pair(a.name, a.origin));}), attrs.end());
     }
   }
 	//Function to quickly find to be deleted entries
-	auto tbd = [&](const std::u16string& attr_name) {
-		auto check = [&](const Attribute& attr) { return attr.name == attr_name;};
+	auto tbd = [&](SymbolTable::Symbol attr_name) {
+		auto check = [&](const InternedAttribute& attr) { return attr.name == attr_name;};
 		return std::find_if(attrs_to_remove.begin(), attrs_to_remove.end(), check);
 	};
   {
@@ -672,8 +688,8 @@ void StandingQuery::invalidateAttributes(world_model::URI name,
     //If this data is in the current state then expire it
     if (state != cur_state.end()) {
 			//Expire each attribute that is to be deleted
-      std::for_each(state->second.begin(), state->second.end(), [&](Attribute& attr) {
-					std::vector<world_model::Attribute>::iterator match = tbd(attr.name);
+      std::for_each(state->second.begin(), state->second.end(), [&](InternedAttribute& attr) {
+					auto match = tbd(attr.name);
           if (attrs_to_remove.end() != match) {
             //Set expired attributes to expired
             attr.expiration_date = match->expiration_date;
@@ -686,12 +702,13 @@ void StandingQuery::invalidateAttributes(world_model::URI name,
 		//attributes here.
     if (current_matches.end() != current_matches.find(name)) {
 			//Find the transmitted attributes of the object with this name
-      std::set<std::u16string>& attr_names = current_matches[name];
-      for (const std::u16string& attr_name : attr_names) {
-				std::vector<world_model::Attribute>::iterator match = tbd(attr_name);
+      std::set<SymbolTable::Symbol>& attr_names = current_matches[name];
+      for (SymbolTable::Symbol attr_name : attr_names) {
+				auto match = tbd(attr_name);
 				if (attrs_to_remove.end() != match) {
 					//Push an attribute with the expired attribute's name and no data
-					cur_state[name].push_back(world_model::Attribute{attr_name, match->expiration_date, match->expiration_date, u"", {}});
+					cur_state[name].push_back(InternedAttribute{attr_name, SymbolTable::intern(u""),
+							match->expiration_date, match->expiration_date, makePayload({})});
 				}
       }
     }
@@ -699,14 +716,14 @@ void StandingQuery::invalidateAttributes(world_model::URI name,
 }
 
 ///Insert data in a thread safe way
-void StandingQuery::insertData(WorldState& ws) {
+void StandingQuery::insertData(SharedState& ws) {
   std::unique_lock<std::mutex> lck(data_mutex);
   for (auto I = ws.begin(); I != ws.end(); ++I) {
     //Update the state with each entry
-    std::vector<world_model::Attribute>& state = cur_state[I->first];
+    std::vector<InternedAttribute>& state = cur_state[I->first];
     for (auto entry = I->second.begin(); entry != I->second.end(); ++entry) {
       //Check if there is already an entry with the same name and origin
-      auto same_attribute = [&](world_model::Attribute& attr) {
+      auto same_attribute = [&](InternedAttribute& attr) {
         return (attr.name == entry->name) and (attr.origin == entry->origin);};
       auto slot = std::find_if(state.begin(), state.end(), same_attribute);
       //Update
@@ -725,9 +742,12 @@ void StandingQuery::insertData(WorldState& ws) {
 
 ///Clear the current data and return what it stored. Thread safe.
 WorldState StandingQuery::getData() {
+  return toWorldState(getSharedData());
+}
+
+SharedState StandingQuery::getSharedData() {
   std::unique_lock<std::mutex> lck(data_mutex);
-  WorldState data = cur_state;
-  cur_state.clear();
+  SharedState data;
+  data.swap(cur_state);
   return data;
 }
-
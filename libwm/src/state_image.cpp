@@ -0,0 +1,272 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * A binary image of the current state and the transient types.
+ * The image is laid out as:
+ *   magic, version, number of strings, watermark
+ *   every string in the SymbolTable, so that symbols are string indexes
+ *   number of transient types, then their name and origin symbols
+ *   number of URIs, then each URI symbol and its attributes
+ *   a checksum of everything before it
+ ******************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <state_image.hpp>
+
+using world_model::Buffer;
+using world_model::grail_time;
+typedef SymbolTable::Symbol Symbol;
+
+static const char image_magic[8] = {'O', 'W', 'L', 'S', 'T', 'A', 'T', 'E'};
+static const uint32_t image_version = 1;
+
+//FNV-1a hash of the bytes of an image
+class ImageChecksum {
+  private:
+    uint64_t hash;
+  public:
+    ImageChecksum() : hash(14695981039346656037ULL) {}
+    void add(const unsigned char* bytes, size_t length) {
+      for (size_t i = 0; i < length; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+      }
+    }
+    uint64_t value() const { return hash; }
+};
+
+//Writes values to an image file, remembering if any write failed
+class ImageWriter {
+  private:
+    FILE* file;
+    ImageChecksum checksum;
+    bool good;
+  public:
+    ImageWriter(FILE* file) : file(file), good(true) {}
+
+    void write(const void* data, size_t length) {
+      checksum.add(static_cast<const unsigned char*>(data), length);
+      good = good and length == fwrite(data, 1, length, file);
+    }
+
+    template<typename T>
+    void put(T value) {
+      write(&value, sizeof(T));
+    }
+
+    ///Write the checksum. Returns false if any write failed.
+    bool finish() {
+      uint64_t sum = checksum.value();
+      good = good and sizeof(sum) == fwrite(&sum, 1, sizeof(sum), file);
+      return good;
+    }
+};
+
+//Reads values from a mapped image, failing rather than reading past its end
+class ImageReader {
+  private:
+    const unsigned char* position;
+    const unsigned char* end;
+  public:
+    bool good;
+
+    ImageReader(const unsigned char* begin, const unsigned char* end) :
+      position(begin), end(end), good(true) {}
+
+    ///Return the next length bytes, or NULL if the image is too short
+    const unsigned char* bytes(size_t length) {
+      if (not good or static_cast<size_t>(end - position) < length) {
+        good = false;
+        return NULL;
+      }
+      const unsigned char* start = position;
+      position += length;
+      return start;
+    }
+
+    template<typename T>
+    T get() {
+      T value = T();
+      const unsigned char* source = bytes(sizeof(T));
+      if (NULL != source) {
+        memcpy(&value, source, sizeof(T));
+      }
+      return value;
+    }
+};
+
+bool StateImage::save(const std::string& filename, int64_t watermark,
+    ShardedWorldState& state, const TransientTypes& transient) {
+  //Copy the state first so that no shard is flagged during disk writes.
+  //Payloads are shared rather than copied.
+  InternedState copy;
+  state.forEach([&](Symbol uri, const std::vector<InternedAttribute>& attributes) {
+      copy[uri] = attributes;});
+  //Every symbol in the copy was interned before this
+  uint32_t num_strings = SymbolTable::size();
+
+  std::string temp_name = filename + ".tmp";
+  FILE* file = fopen(temp_name.c_str(), "wb");
+  if (NULL == file) {
+    std::cerr<<"Could not open "<<temp_name<<" to write the state image.\n";
+    return false;
+  }
+  ImageWriter out(file);
+  out.write(image_magic, sizeof(image_magic));
+  out.put<uint32_t>(image_version);
+  out.put<uint32_t>(num_strings);
+  out.put<int64_t>(watermark);
+  for (Symbol sym = 0; sym < num_strings; ++sym) {
+    const std::u16string& str = SymbolTable::lookup(sym);
+    out.put<uint32_t>(str.size());
+    out.write(str.data(), sizeof(char16_t) * str.size());
+  }
+  out.put<uint32_t>(transient.size());
+  for (const std::pair<Symbol, Symbol>& type : transient) {
+    out.put<uint32_t>(type.first);
+    out.put<uint32_t>(type.second);
+  }
+  out.put<uint32_t>(copy.size());
+  for (const std::pair<const Symbol, std::vector<InternedAttribute>>& entry : copy) {
+    out.put<uint32_t>(entry.first);
+    out.put<uint32_t>(entry.second.size());
+    for (const InternedAttribute& attr : entry.second) {
+      out.put<uint32_t>(attr.name);
+      out.put<uint32_t>(attr.origin);
+      out.put<int64_t>(attr.creation_date);
+      out.put<int64_t>(attr.expiration_date);
+      out.put<uint32_t>(attr.data->size());
+      out.write(attr.data->data(), attr.data->size());
+    }
+  }
+  bool success = out.finish() and 0 == fflush(file) and 0 == fsync(fileno(file));
+  success = 0 == fclose(file) and success;
+  //Replace the old image only once the new one is complete
+  if (not success or 0 != rename(temp_name.c_str(), filename.c_str())) {
+    std::cerr<<"Error writing the state image to "<<filename<<".\n";
+    unlink(temp_name.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool StateImage::load(const std::string& filename, int64_t watermark,
+    ShardedWorldState& state, TransientTypes& transient) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (-1 == fd) {
+    return false;
+  }
+  struct stat file_stat;
+  size_t length = 0;
+  if (0 == fstat(fd, &file_stat)) {
+    length = file_stat.st_size;
+  }
+  //Too short for the header and checksum
+  if (length < sizeof(image_magic) + 2*sizeof(uint32_t) + sizeof(int64_t) + sizeof(uint64_t)) {
+    close(fd);
+    return false;
+  }
+  void* mapped = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (MAP_FAILED == mapped) {
+    return false;
+  }
+  madvise(mapped, length, MADV_SEQUENTIAL);
+  const unsigned char* begin = static_cast<const unsigned char*>(mapped);
+  const unsigned char* end = begin + length - sizeof(uint64_t);
+
+  ImageReader in(begin, end);
+  bool success = 0 == memcmp(image_magic, in.bytes(sizeof(image_magic)), sizeof(image_magic)) and
+    image_version == in.get<uint32_t>();
+  uint32_t num_strings = in.get<uint32_t>();
+  success = success and watermark == in.get<int64_t>();
+  if (success) {
+    ImageChecksum checksum;
+    checksum.add(begin, end - begin);
+    uint64_t stored;
+    memcpy(&stored, end, sizeof(stored));
+    success = checksum.value() == stored;
+  }
+
+  //Symbols in the image are the string indexes of the image's table
+  std::vector<Symbol> symbols;
+  auto symbol = [&](uint32_t index) {
+    if (index >= symbols.size()) {
+      in.good = false;
+      return Symbol(0);
+    }
+    return symbols[index];
+  };
+  TransientTypes new_transient;
+  InternedState new_state;
+  if (success) {
+    symbols.reserve(num_strings);
+    for (uint32_t i = 0; i < num_strings and in.good; ++i) {
+      uint32_t size = in.get<uint32_t>();
+      const unsigned char* chars = in.bytes(sizeof(char16_t) * size);
+      if (NULL != chars) {
+        std::u16string str(size, u'\0');
+        memcpy(&str[0], chars, sizeof(char16_t) * size);
+        symbols.push_back(SymbolTable::intern(str));
+      }
+    }
+    uint32_t num_transient = in.get<uint32_t>();
+    for (uint32_t i = 0; i < num_transient and in.good; ++i) {
+      Symbol name = symbol(in.get<uint32_t>());
+      Symbol origin = symbol(in.get<uint32_t>());
+      new_transient.insert(std::make_pair(name, origin));
+    }
+    uint32_t num_uris = in.get<uint32_t>();
+    for (uint32_t i = 0; i < num_uris and in.good; ++i) {
+      std::vector<InternedAttribute>& attributes = new_state[symbol(in.get<uint32_t>())];
+      uint32_t num_attributes = in.get<uint32_t>();
+      for (uint32_t j = 0; j < num_attributes and in.good; ++j) {
+        Symbol name = symbol(in.get<uint32_t>());
+        Symbol origin = symbol(in.get<uint32_t>());
+        grail_time creation = in.get<int64_t>();
+        grail_time expiration = in.get<int64_t>();
+        uint32_t size = in.get<uint32_t>();
+        const unsigned char* data = in.bytes(size);
+        if (NULL != data) {
+          attributes.push_back(InternedAttribute(name, origin, creation, expiration,
+                makePayload(Buffer(data, data + size))));
+        }
+      }
+    }
+    success = in.good;
+  }
+  munmap(mapped, length);
+  if (not success) {
+    return false;
+  }
+  state.assign(new_state);
+  transient.swap(new_transient);
+  return true;
+}
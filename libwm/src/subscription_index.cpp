@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include <algorithm>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <regex_cache.hpp>
+#include <subscription_index.hpp>
+
+//Queries with only literal attribute patterns are indexed by name
+static bool isLiteral(const std::u16string& pattern) {
+  return CompiledPattern::Kind::literal == RegexCache::get(pattern)->type();
+}
+
+bool SubscriptionIndex::hasPrefix(const SharedState& ws, const std::u16string& prefix) {
+  if (prefix.empty()) {
+    return not ws.empty();
+  }
+  //URIs are sorted so any with this prefix come at or just after it
+  auto I = ws.lower_bound(prefix);
+  return I != ws.end() and 0 == I->first.compare(0, prefix.size(), prefix);
+}
+
+void SubscriptionIndex::insert(StandingQuery* sq, const world_model::URI& uri_pattern,
+    const std::vector<std::u16string>& desired_attributes) {
+  bool all_literal = not desired_attributes.empty() and
+    std::all_of(desired_attributes.begin(), desired_attributes.end(), isLiteral);
+  std::vector<SymbolTable::Symbol> names;
+  if (all_literal) {
+    for (const std::u16string& attr : desired_attributes) {
+      names.push_back(SymbolTable::intern(attr));
+    }
+  }
+  std::u16string prefix = RegexCache::get(uri_pattern)->literalPrefix();
+
+  SemaphoreLock lck(access_control);
+  uri_prefix[sq] = prefix;
+  if (all_literal) {
+    for (SymbolTable::Symbol name : names) {
+      by_attribute[name].insert(sq);
+    }
+  }
+  else {
+    any_attribute.insert(sq);
+  }
+}
+
+void SubscriptionIndex::erase(StandingQuery* sq) {
+  SemaphoreLock lck(access_control);
+  if (0 == uri_prefix.erase(sq)) {
+    return;
+  }
+  if (0 == any_attribute.erase(sq)) {
+    for (auto I = by_attribute.begin(); I != by_attribute.end();) {
+      I->second.erase(sq);
+      if (I->second.empty()) {
+        I = by_attribute.erase(I);
+      }
+      else {
+        ++I;
+      }
+    }
+  }
+}
+
+void SubscriptionIndex::for_each(std::function<void(StandingQuery*)> f) {
+  SemaphoreFlag flag(access_control);
+  for (auto& I : uri_prefix) {
+    f(I.first);
+  }
+}
+
+void SubscriptionIndex::forEachCandidate(const SharedState& state,
+    const SharedState& transients, bool invalidation,
+    std::function<void(StandingQuery*)> f) {
+  SemaphoreFlag flag(access_control);
+
+  //Check the prefix of a query's URI pattern against the updated URIs
+  auto uri_candidate = [&](StandingQuery* sq) {
+    const std::u16string& prefix = uri_prefix.at(sq);
+    return hasPrefix(state, prefix) or hasPrefix(transients, prefix);
+  };
+
+  if (invalidation) {
+    for (auto& I : uri_prefix) {
+      if (uri_candidate(I.first)) {
+        f(I.first);
+      }
+    }
+    return;
+  }
+
+  //Gather queries that could care about the updated attribute names
+  std::set<StandingQuery*> candidates(any_attribute);
+  if (not by_attribute.empty()) {
+    std::set<SymbolTable::Symbol> names;
+    for (const SharedState* ws : {&state, &transients}) {
+      for (auto& I : *ws) {
+        for (const InternedAttribute& attr : I.second) {
+          names.insert(attr.name);
+        }
+      }
+    }
+    for (SymbolTable::Symbol name : names) {
+      auto I = by_attribute.find(name);
+      if (I != by_attribute.end()) {
+        candidates.insert(I->second.begin(), I->second.end());
+      }
+    }
+  }
+  for (StandingQuery* sq : candidates) {
+    if (uri_candidate(sq)) {
+      f(sq);
+    }
+  }
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+#include <symbol_table.hpp>
+
+std::deque<SymbolTable::Entry> SymbolTable::strings;
+std::unordered_map<std::u16string, SymbolTable::Symbol> SymbolTable::symbols;
+Semaphore SymbolTable::access_control;
+
+SymbolTable::Symbol SymbolTable::intern(const std::u16string& str) {
+  //Most strings have already been seen so try a read first
+  {
+    SemaphoreFlag flag(access_control);
+    auto I = symbols.find(str);
+    if (I != symbols.end()) {
+      return I->second;
+    }
+  }
+  SemaphoreLock lck(access_control);
+  //Another thread may have added this string while the lock was released
+  auto I = symbols.find(str);
+  if (I != symbols.end()) {
+    return I->second;
+  }
+  Symbol symbol = strings.size();
+  strings.push_back(Entry{str, std::string(str.begin(), str.end())});
+  symbols[str] = symbol;
+  return symbol;
+}
+
+bool SymbolTable::find(const std::u16string& str, Symbol& symbol) {
+  SemaphoreFlag flag(access_control);
+  auto I = symbols.find(str);
+  if (I == symbols.end()) {
+    return false;
+  }
+  symbol = I->second;
+  return true;
+}
+
+const std::u16string& SymbolTable::lookup(Symbol symbol) {
+  SemaphoreFlag flag(access_control);
+  return strings[symbol].str;
+}
+
+const std::string& SymbolTable::narrow(Symbol symbol) {
+  SemaphoreFlag flag(access_control);
+  return strings[symbol].narrow;
+}
+
+size_t SymbolTable::size() {
+  SemaphoreFlag flag(access_control);
+  return strings.size();
+}
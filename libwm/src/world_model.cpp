@@ -23,7 +23,10 @@
  * database backend used.
  *****************************************************************************/
 #include "world_model.hpp"
+#include "regex_cache.hpp"
+#include <algorithm>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <utility>
 
@@ -32,6 +35,7 @@ using std::vector;
 using std::u16string;
 using world_model::Attribute;
 using world_model::Buffer;
+using world_model::grail_time;
 using world_model::URI;
 using world_model::WorldState;
 
@@ -64,123 +68,281 @@ WorldModel::~WorldModel() {
 std::vector<world_model::URI> WorldModel::searchURI(const std::u16string& glob) {
   //debug<<"Searching for "<<std::string(glob.begin(), glob.end())<<'\n';
   std::vector<world_model::URI> result;
-  //Build a regular expression from the glob and search for matches in the
+  //Get the compiled expression for the glob and search for matches in the
   //keys of the world_state map.
-  regex_t exp;
-  std::string glob_str(glob.begin(), glob.end());
-  int err = regcomp(&exp, glob_str.c_str(), REG_EXTENDED);
+  std::shared_ptr<const CompiledPattern> exp = RegexCache::get(glob);
   //Return no results if the expression did not compile.
   //TODO Should indicate error but throwing an exception might be overboard.
-  if (0 != err) {
-    std::cerr<<"Error compiling regular expression: "<<std::string(glob.begin(), glob.end())<<".\n";
+  if (not exp->valid()) {
     return result;
   }
 
-  //Flag the access control so that this read does not conflict with a write.
-  SemaphoreFlag flag(access_control);
+  //A literal pattern can only match one URI so look it up directly
+  if (CompiledPattern::Kind::literal == exp->type()) {
+    SymbolTable::Symbol uri_id;
+    if (SymbolTable::find(glob, uri_id) and cur_state.contains(uri_id)) {
+      result.push_back(glob);
+    }
+    return result;
+  }
 
-  //Check for a matchs in the URIs and remember any URIs that match
-  for (auto I = cur_state.begin(); I != cur_state.end(); ++I) {
+  //Only URIs that begin with the pattern's literal prefix can match so the
+  //full pattern is only checked against the URIs under that prefix.
+  std::vector<SymbolTable::Symbol> candidates;
+  cur_state.forEachWithPrefix(exp->literalPrefix(), [&](SymbolTable::Symbol cur_uri) {
+    candidates.push_back(cur_uri);
+  });
+  for (SymbolTable::Symbol cur_uri : candidates) {
     //Check each match to make sure it consumes the whole string
-    regmatch_t pmatch;
-    std::string match_str = std::string(I->first.begin(), I->first.end());
-    int match = regexec(&exp, match_str.c_str(), 1, &pmatch, 0);
-    if (0 == match and 0 == pmatch.rm_so and I->first.size() == pmatch.rm_eo) {
-      //debug<<"Matched "<<std::string(I->first.begin(), I->first.end())<<'\n';
-      result.push_back(I->first);
+    if (exp->fullMatch(SymbolTable::narrow(cur_uri))) {
+      result.push_back(SymbolTable::lookup(cur_uri));
     }
   }
-  regfree(&exp);
   return result;
 }
 
 WorldModel::world_state WorldModel::currentSnapshot(const URI& uri,
                                                     vector<u16string>& desired_attributes,
                                                     bool get_data) {
+  world_state result;
+  visitCurrentSnapshot(uri, desired_attributes,
+      [&](SymbolTable::Symbol uri_id, const std::vector<const InternedAttribute*>& attributes) {
+        std::vector<world_model::Attribute>& matched_attributes = result[SymbolTable::lookup(uri_id)];
+        for (const InternedAttribute* attr : attributes) {
+          matched_attributes.push_back(attr->toAttribute(get_data));
+        }
+      });
+  return result;
+}
+
+void WorldModel::visitCurrentSnapshot(const URI& uri,
+                                      vector<u16string>& desired_attributes,
+                                      SnapshotVisitor visitor) {
   //Return if nothing was requested
   if (desired_attributes.empty()) {
-    return WorldModel::world_state();
+    return;
   }
   //Find which URIs match the given search string
   std::vector<world_model::URI> matches = searchURI(uri);
+  visitCurrentSnapshot(matches.begin(), matches.end(), desired_attributes, visitor);
+}
 
-  world_state result;
-  
-  if (0 < matches.size()) {
-    //Make a regular expression for each attribute
-    //First build the expressions
-    std::vector<regex_t> expressions;
-    for (auto exp_str = desired_attributes.begin(); exp_str != desired_attributes.end(); ++exp_str) {
-      regex_t exp;
-      //Need a variable to hold the memory for the c string in regexec call
-      std::string tmp_str(exp_str->begin(), exp_str->end());
-      int err = regcomp(&exp, tmp_str.c_str(), REG_EXTENDED);
-      if (0 != err) {
-        debug<<"Error compiling regular expression "<<tmp_str<<" in attribute of snapshot request.\n";
+void WorldModel::visitCurrentSnapshot(std::vector<world_model::URI>::const_iterator first,
+                                      std::vector<world_model::URI>::const_iterator last,
+                                      vector<u16string>& desired_attributes,
+                                      SnapshotVisitor visitor) {
+  //Return if nothing was requested
+  if (desired_attributes.empty() or first == last) {
+    return;
+  }
+
+  //Get the compiled regular expression for each attribute
+  std::vector<std::shared_ptr<const CompiledPattern>> expressions;
+  for (auto exp_str = desired_attributes.begin(); exp_str != desired_attributes.end(); ++exp_str) {
+    std::shared_ptr<const CompiledPattern> exp = RegexCache::get(*exp_str);
+    if (not exp->valid()) {
+      debug<<"Error compiling regular expression "<<std::string(exp_str->begin(), exp_str->end())<<" in attribute of snapshot request.\n";
+    }
+    else {
+      expressions.push_back(exp);
+    }
+  }
+  //Find the attributes of interest for each URI
+  //Attributes search have an AND relationship - this identifier's results are only
+  //returned if all of the attribute search have matches.
+  std::vector<const InternedAttribute*> matched_attributes;
+  for (auto uri_match = first; uri_match != last; ++uri_match) {
+    matched_attributes.clear();
+    std::vector<bool> attr_matched(expressions.size());
+    SymbolTable::Symbol uri_id;
+    //The URI may have been deleted since the search
+    if (not SymbolTable::find(*uri_match, uri_id)) {
+      continue;
+    }
+    //Flag the URI's shard so that this read does not conflict with a write.
+    //The flag is held while the visitor runs so the attributes are not copied.
+    ShardFlag flag(cur_state, uri_id);
+    auto state = flag->find(uri_id);
+    if (state == flag->end()) {
+      continue;
+    }
+    const std::vector<InternedAttribute>& attributes = state->second;
+    //Check each of this URI's attributes to see if it was requested
+    for (auto attr = attributes.begin(); attr != attributes.end(); ++attr) {
+      //This is a desired attribute if it appears in the attributes list
+      //Check for a match that consumes the entire string
+      //TODO Should also check origins here
+      //Count which search expressions match
+      bool matched = false;
+      const std::string& name_str = SymbolTable::narrow(attr->name);
+      for (size_t search_ind = 0; search_ind < expressions.size(); ++search_ind) {
+        if (expressions[search_ind]->fullMatch(name_str)) {
+          attr_matched[search_ind] = true;
+          matched = true;
+        }
       }
-      else {
-        expressions.push_back(exp);
+      //If any expression matched then this attributes is desired
+      if (matched) {
+        matched_attributes.push_back(&(*attr));
+      }
+    }
+    //If all of the desired attributes were matched then pass this URI
+    //and its attributes to the visitor.
+    if (std::none_of(attr_matched.begin(), attr_matched.end(), [&](const bool& b) { return not b;})) {
+      visitor(uri_id, matched_attributes);
+    }
+  }
+}
+
+void WorldModel::keepEarliest(world_state& state, size_t max_rows) {
+  vector<grail_time> dates;
+  for (auto I = state.begin(); I != state.end(); ++I) {
+    for (Attribute& attr : I->second) {
+      dates.push_back(attr.creation_date);
+    }
+  }
+  if (dates.size() <= max_rows) {
+    return;
+  }
+  if (0 == max_rows) {
+    state.clear();
+    return;
+  }
+  std::nth_element(dates.begin(), dates.begin() + (max_rows - 1), dates.end());
+  grail_time cutoff = dates[max_rows - 1];
+  //Keep every row created before the cutoff and as many created at the cutoff as fit
+  size_t at_cutoff = max_rows - std::count_if(dates.begin(), dates.end(),
+      [&](grail_time date) { return date < cutoff;});
+  auto I = state.begin();
+  while (I != state.end()) {
+    vector<Attribute> kept;
+    for (Attribute& attr : I->second) {
+      if (attr.creation_date < cutoff or (attr.creation_date == cutoff and 0 < at_cutoff--)) {
+        kept.push_back(std::move(attr));
+      }
+    }
+    if (kept.empty()) {
+      I = state.erase(I);
+    }
+    else {
+      I->second = std::move(kept);
+      ++I;
+    }
+  }
+}
+
+WorldModel::world_state WorldModel::historicDataPage(const URI& uri, vector<u16string>& desired_attributes,
+    grail_time start, grail_time stop, size_t max_rows) {
+  world_state result = historicDataInRange(uri, desired_attributes, start, stop);
+  keepEarliest(result, max_rows);
+  return result;
+}
+
+/**
+ * Reads a range a page of rows at a time with historicDataPage. Each page
+ * starts at the last creation date of the page before it so that no more
+ * than a chunk is read at once however the rows are spread over time.
+ */
+class PagedRangeCursor : public WorldModel::RangeCursor {
+  private:
+    typedef std::pair<WorldModel::world_state::iterator, size_t> Row;
+
+    WorldModel& wm;
+    URI uri;
+    vector<u16string> desired_attributes;
+    size_t chunk_rows;
+    //The next page starts here and the last one ends at stop
+    grail_time page_start;
+    grail_time stop;
+    bool exhausted;
+
+    //Data of the current page and its rows in creation date order
+    WorldModel::world_state page_data;
+    vector<Row> rows;
+    size_t position;
+
+    static grail_time created(const Row& row) {
+      return row.first->second[row.second].creation_date;
+    }
+
+    void sortRows() {
+      rows.clear();
+      position = 0;
+      for (auto I = page_data.begin(); I != page_data.end(); ++I) {
+        for (size_t idx = 0; idx < I->second.size(); ++idx) {
+          rows.push_back(Row(I, idx));
+        }
       }
+      std::stable_sort(rows.begin(), rows.end(), [](const Row& a, const Row& b) {
+          return created(a) < created(b);});
     }
-    //Flag the access control so that this read does not conflict with a write.
-    SemaphoreFlag flag(access_control);
-    
-    //Find the attributes of interest for each URI
-    //Attributes search have an AND relationship - this identifier's results are only
-    //returned if all of the attribute search have matches.
-    for (auto uri_match = matches.begin(); uri_match != matches.end(); ++uri_match) {
-      //Holding a reference to attributes is not thread safe, so make a copy here
-      std::vector<world_model::Attribute> attributes = cur_state[*uri_match];
-      std::vector<world_model::Attribute> matched_attributes;
-      std::vector<bool> attr_matched(expressions.size());
-      //Check each of this URI's attributes to see if it was requested
-      for (auto attr = attributes.begin(); attr != attributes.end(); ++attr) {
-        //This is a desired attribute if it appears in the attributes list
-        //Also return this attribute if no attributes were specified
-        //Check for a match that consumes the entire string
-        //TODO Should also check origins here
-        //Count which search expressions match
-        bool matched = false;
-        for (size_t search_ind = 0; search_ind < expressions.size(); ++search_ind) {
-          //Use regex matching
-          regmatch_t pmatch;
-          //Need a variable to hold the memory for the c string in regexec call
-          std::string tmp_str(attr->name.begin(), attr->name.end());
-          int match = regexec(&expressions[search_ind], tmp_str.c_str(), 1, &pmatch, 0);
-          if (0 == match and 0 == pmatch.rm_so and attr->name.size() == pmatch.rm_eo) {
-            attr_matched[search_ind] = true;
-            matched = true;
-          }
+
+    void readPage() {
+      page_data = wm.historicDataPage(uri, desired_attributes, page_start, stop, chunk_rows);
+      sortRows();
+      if (rows.size() < chunk_rows) {
+        exhausted = true;
+        return;
+      }
+      grail_time last = created(rows.back());
+      if (created(rows.front()) < last) {
+        //More rows may have been created at the last time, so leave that
+        //time for the next page
+        while (created(rows.back()) == last) {
+          rows.pop_back();
+        }
+        page_start = last;
+      }
+      else {
+        //Every row of the page was created at the same time, so read all of
+        //the rows created then before moving past it
+        page_data = wm.historicDataInRange(uri, desired_attributes, last, last);
+        sortRows();
+        if (last == stop) {
+          exhausted = true;
         }
-        //If any expression matched then this attributes is desired
-        if (matched) {
-          if (get_data) {
-            matched_attributes.push_back(*attr);
-          }
-          else {
-            matched_attributes.push_back(
-                Attribute{attr->name, attr->creation_date, attr->expiration_date, attr->origin, Buffer{}});
-          }
+        else {
+          page_start = last + 1;
         }
       }
-      //If all of the desired attributes were matched then return this URI
-      //and its attributes to the user.
-      if (std::none_of(attr_matched.begin(), attr_matched.end(), [&](const bool& b) { return not b;})) {
-        result[*uri_match] = matched_attributes;
+    }
+
+  public:
+    PagedRangeCursor(WorldModel& wm, const URI& uri, vector<u16string>& desired_attributes,
+        grail_time start, grail_time stop, size_t chunk_rows) :
+      wm(wm), uri(uri), desired_attributes(desired_attributes),
+      chunk_rows(std::max<size_t>(1, chunk_rows)), page_start(start), stop(stop),
+      exhausted(start > stop), position(0) {
+    }
+
+    bool next(WorldModel::world_state& chunk) {
+      chunk.clear();
+      while (position == rows.size() and not exhausted) {
+        readPage();
+      }
+      if (position == rows.size()) {
+        return false;
+      }
+      size_t end = std::min(position + chunk_rows, rows.size());
+      for (; position < end; ++position) {
+        Row& row = rows[position];
+        chunk[row.first->first].push_back(std::move(row.first->second[row.second]));
       }
+      return true;
     }
-    //Free the memory used in the regex
-    std::for_each(expressions.begin(), expressions.end(), [&](regex_t& exp) { regfree(&exp);});
-  }
+};
 
-  return result;
+std::unique_ptr<WorldModel::RangeCursor> WorldModel::historicRangeCursor(const URI& uri,
+    vector<u16string>& desired_attributes, grail_time start, grail_time stop, size_t chunk_rows) {
+  return std::unique_ptr<RangeCursor>(
+      new PagedRangeCursor(*this, uri, desired_attributes, start, stop, chunk_rows));
 }
 
 //Register an attribute name as a transient type. Transient types are not
 //stored in the SQL table but are stored in the cur_state map.
 void WorldModel::registerTransient(std::u16string& attr_name, std::u16string& origin) {
   std::unique_lock<std::mutex> lck(transient_lock);
-  transient.insert(std::make_pair(attr_name, origin));
+  transient.insert(std::make_pair(SymbolTable::intern(attr_name), SymbolTable::intern(origin)));
 }
 
 /**
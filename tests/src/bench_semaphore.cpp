@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * Microbenchmark for the reader/writer Semaphore used to protect the world
+ * model's current state. For 1 to 64 reader threads and 0, 1, or 4 writer
+ * threads this reports the throughput of the readers and writers, the worst
+ * latency that any writer saw while waiting for the lock, and how evenly the
+ * lock was shared between writers.
+ ******************************************************************************/
+
+#include <semaphore.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdlib.h>
+
+using namespace std;
+using namespace std::chrono;
+
+//Work done while holding the flag or lock, to simulate a map lookup
+void simulateWork(volatile size_t& value) {
+  for (size_t i = 0; i < 50; ++i) {
+    value = value + i;
+  }
+}
+
+struct Result {
+  size_t reads;
+  size_t writes;
+  //Fewest and most writes done by a single writer thread
+  size_t min_writes;
+  size_t max_writes;
+  microseconds max_write_wait;
+};
+
+Result runBenchmark(size_t readers, size_t writers, milliseconds duration) {
+  Semaphore sem;
+  atomic<bool> running(true);
+  atomic<size_t> reads(0);
+  vector<size_t> writes(writers, 0);
+  microseconds max_write_wait(0);
+  mutex wait_mutex;
+  volatile size_t shared_value = 0;
+
+  vector<thread> threads;
+  for (size_t i = 0; i < readers; ++i) {
+    threads.push_back(thread([&]() {
+          size_t local_reads = 0;
+          while (running) {
+            SemaphoreFlag flag(sem);
+            simulateWork(shared_value);
+            ++local_reads;
+          }
+          reads += local_reads;
+        }));
+  }
+  for (size_t i = 0; i < writers; ++i) {
+    threads.push_back(thread([&, i]() {
+          size_t local_writes = 0;
+          microseconds local_wait(0);
+          while (running) {
+            auto start = steady_clock::now();
+            {
+              SemaphoreLock lck(sem);
+              local_wait = max(local_wait,
+                  duration_cast<microseconds>(steady_clock::now() - start));
+              simulateWork(shared_value);
+            }
+            ++local_writes;
+          }
+          lock_guard<mutex> lck(wait_mutex);
+          writes[i] = local_writes;
+          max_write_wait = max(max_write_wait, local_wait);
+        }));
+  }
+
+  this_thread::sleep_for(duration);
+  running = false;
+  for (thread& t : threads) {
+    t.join();
+  }
+  Result result{reads, 0, 0, 0, max_write_wait};
+  if (not writes.empty()) {
+    result.min_writes = *min_element(writes.begin(), writes.end());
+    result.max_writes = *max_element(writes.begin(), writes.end());
+  }
+  for (size_t w : writes) {
+    result.writes += w;
+  }
+  return result;
+}
+
+int main(int argc, char** argv) {
+  //Optionally take the run time of each test in milliseconds
+  milliseconds duration(200);
+  if (argc > 1) {
+    duration = milliseconds(atoi(argv[1]));
+  }
+  double seconds = duration.count() / 1000.0;
+
+  cout<<"readers\twriters\treads/s\t\twrites/s\tmin/max writes per writer\tmax write wait (us)\n";
+  for (size_t readers = 1; readers <= 64; readers *= 2) {
+    for (size_t writers : {0, 1, 4}) {
+      Result result = runBenchmark(readers, writers, duration);
+      cout<<readers<<'\t'<<writers<<'\t'<<
+        (size_t)(result.reads / seconds)<<"\t\t"<<
+        (size_t)(result.writes / seconds)<<"\t\t"<<
+        result.min_writes<<'/'<<result.max_writes<<"\t\t\t"<<
+        result.max_write_wait.count()<<'\n';
+    }
+  }
+  return 0;
+}
@@ -34,6 +34,7 @@
 
 #include <algorithm>
 #include <iostream>
+#include <set>
 #include <vector>
 #include <unistd.h>
 
@@ -117,6 +118,16 @@ bool searchSingleURI(WorldModel& wm) {
   }
 }
 
+//Literal patterns and literal prefixes are matched without regex
+bool searchLiteralURI(WorldModel& wm) {
+  vector<URI> exact = wm.searchURI(uri1);
+  vector<URI> partial = wm.searchURI(u"test");
+  vector<URI> prefix = wm.searchURI(u"test2.*");
+  vector<URI> after_prefix = wm.searchURI(u"test[2-9]");
+  return exact == vector<URI>{uri1} and partial.empty() and
+    prefix == vector<URI>{uri2} and after_prefix == vector<URI>{uri2};
+}
+
 //Requires URIs to have been previously created in createAndSearchURIs
 bool insertHalfAttributes(WorldModel& wm) {
   vector<Attribute> attributes1half{
@@ -143,7 +154,8 @@ vector<Attribute> attributes1rest{
 
 //Requires URIs to have been previously created in createAndSearchURIs
 bool checkStandingQueryFour(StandingQuery& sq) {
-
+  //Standing queries are updated asynchronously so wait for pending data
+  StandingQuery::flush();
   WorldModel::world_state ws = sq.getData();
   if (ws.end() == ws.find(uri1)) {
     return false;
@@ -261,7 +273,8 @@ bool insertAndRetrieveData(WorldModel& wm) {
 
 //Should match the results of insertAndRetrieveData
 bool checkStandingQuery(StandingQuery& sq) {
-
+  //Standing queries are updated asynchronously so wait for pending data
+  StandingQuery::flush();
   WorldModel::world_state ws = sq.getData();
   if (ws.end() == ws.find(uri1)) {
     std::cerr<<"Result empty\n";
@@ -295,7 +308,8 @@ bool checkStandingQuery(StandingQuery& sq) {
 
 //Should match the results of insertAndRetrieveData
 bool checkStandingQueryPartial(StandingQuery& sq) {
-
+  //Standing queries are updated asynchronously so wait for pending data
+  StandingQuery::flush();
   WorldModel::world_state ws = sq.getData();
   if (ws.end() == ws.find(uri1)) {
     std::cerr<<"Result empty\n";
@@ -333,7 +347,8 @@ bool checkStandingQueryPartial(StandingQuery& sq) {
 
 //Should have only an update to att3
 bool checkStandingQueryPartial2(StandingQuery& sq) {
-
+  //Standing queries are updated asynchronously so wait for pending data
+  StandingQuery::flush();
   WorldModel::world_state ws = sq.getData();
   if (ws.end() == ws.find(uri1)) {
     std::cerr<<"Result empty\n";
@@ -365,7 +380,8 @@ bool checkStandingQueryPartial2(StandingQuery& sq) {
 
 //Should match the results of insertAndRetrieveData, but expire time should be non-zero
 bool checkExpiredStandingQuery(StandingQuery& sq) {
-
+  //Standing queries are updated asynchronously so wait for pending data
+  StandingQuery::flush();
   WorldModel::world_state ws = sq.getData();
   if (ws.end() == ws.find(uri1)) {
     std::cerr<<"Failed checkExpiredStandingQuery: Result empty\n";
@@ -446,7 +462,8 @@ bool insertAndRetrieveData2(WorldModel& wm) {
 
 //Should match the results of insertAndRetrieveData2
 bool checkStandingQuery2(StandingQuery& sq) {
-
+  //Standing queries are updated asynchronously so wait for pending data
+  StandingQuery::flush();
   WorldModel::world_state ws = sq.getData();
   if (ws.end() == ws.find(uri1)) {
     std::cerr<<"Result empty\n";
@@ -579,6 +596,135 @@ bool testHistoricRange(WorldModel& wm) {
   }
 }
 
+//Insert values out of order, both recent ones and ones older than any
+//recent history, and check that each version expires when the next begins
+bool testOutOfOrderHistory(WorldModel& wm) {
+  wm.createURI(uri1, u"test_world_model", 0);
+  auto insert = [&](grail_time creation) {
+    vector<Attribute> entries{Attribute{u"att1", creation, 0, u"test_world_model", {1}}};
+    wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri1, entries)});
+  };
+  for (grail_time creation = 100; creation <= 4000; creation += 100) {
+    insert(creation);
+  }
+  insert(3950);
+  insert(150);
+  insert(3975);
+  insert(50);
+  vector<u16string> search_atts{u"att1"};
+  vector<Attribute> found = wm.historicDataInRange(uri1, search_atts, 0, 5000)[uri1];
+  if (found.size() != 44) {
+    return false;
+  }
+  for (size_t i = 0; i + 1 < found.size(); ++i) {
+    if (found[i].expiration_date != found[i+1].creation_date) {
+      return false;
+    }
+  }
+  return 0 == found.back().expiration_date;
+}
+
+//Insert values older than the recent history from several threads at once
+//and check that the versions still expire one after another
+bool testConcurrentOldHistory(WorldModel& wm) {
+  wm.createURI(uri1, u"test_world_model", 0);
+  auto insert = [&](grail_time creation) {
+    vector<Attribute> entries{Attribute{u"att1", creation, 0, u"test_world_model", {1}}};
+    wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri1, entries)});
+  };
+  for (grail_time creation = 1000; creation <= 4000; creation += 100) {
+    insert(creation);
+  }
+  //Each thread fills in versions between the same two stored versions
+  vector<thread> threads;
+  for (grail_time offset = 1; offset <= 8; ++offset) {
+    threads.push_back(thread([&, offset]() {
+          for (grail_time base = 1000; base < 1500; base += 100) {
+            insert(base + offset);
+          }}));
+  }
+  for_each(threads.begin(), threads.end(), [&](thread& t) { t.join();});
+  vector<u16string> search_atts{u"att1"};
+  vector<Attribute> found = wm.historicDataInRange(uri1, search_atts, 0, 5000)[uri1];
+  if (found.size() != 31 + 8*5) {
+    return false;
+  }
+  for (size_t i = 0; i + 1 < found.size(); ++i) {
+    if (found[i].expiration_date != found[i+1].creation_date) {
+      return false;
+    }
+  }
+  return 0 == found.back().expiration_date;
+}
+
+//A range cursor should return the same data as a range request in small
+//chunks that are in creation date order
+bool testRangeCursor(WorldModel& wm) {
+  wm.createURI(uri1, u"test_world_model", 0);
+  for (grail_time creation = 100; creation <= 20000; creation += 100) {
+    vector<Attribute> entries{Attribute{u"att1", creation, 0, u"test_world_model", {1}}};
+    wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri1, entries)});
+  }
+  vector<u16string> search_atts{u"att1"};
+  size_t expected = wm.historicDataInRange(uri1, search_atts, 0, 30000)[uri1].size();
+  std::unique_ptr<WorldModel::RangeCursor> cursor = wm.historicRangeCursor(uri1, search_atts, 0, 30000, 7);
+  WorldModel::world_state chunk;
+  size_t total = 0;
+  grail_time last = 0;
+  while (cursor->next(chunk)) {
+    vector<Attribute>& found = chunk[uri1];
+    if (1 != chunk.size() or found.empty() or 7 < found.size()) {
+      return false;
+    }
+    for (Attribute& attr : found) {
+      if (attr.creation_date < last) {
+        return false;
+      }
+      last = attr.creation_date;
+    }
+    total += found.size();
+  }
+  return 200 == expected and expected == total and chunk.empty();
+}
+
+//A range cursor should return every row once when many rows share a
+//creation date and the rows are unevenly spread over the range
+bool testRangeCursorBursts(WorldModel& wm) {
+  wm.createURI(uri1, u"test_world_model", 0);
+  size_t inserted = 0;
+  for (grail_time creation = 1000; creation <= 12000; creation += (creation < 10000 ? 1000 : 1)) {
+    //Bursts of rows created at the same time by different origins
+    size_t origins = (0 == creation % 1000) ? 20 : 1;
+    for (size_t idx = 0; idx < origins; ++idx) {
+      u16string origin = u"origin" + u16string(1, u'a' + idx);
+      vector<Attribute> entries{Attribute{u"att1", creation, 0, origin, {1}}};
+      wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri1, entries)});
+      ++inserted;
+    }
+  }
+  vector<u16string> search_atts{u"att1"};
+  std::unique_ptr<WorldModel::RangeCursor> cursor = wm.historicRangeCursor(uri1, search_atts, 0, 30000, 7);
+  WorldModel::world_state chunk;
+  std::set<pair<grail_time, u16string>> seen;
+  size_t total = 0;
+  grail_time last = 0;
+  while (cursor->next(chunk)) {
+    vector<Attribute>& found = chunk[uri1];
+    if (1 != chunk.size() or found.empty() or 7 < found.size()) {
+      return false;
+    }
+    for (Attribute& attr : found) {
+      if (attr.creation_date < last) {
+        return false;
+      }
+      last = attr.creation_date;
+      seen.insert(make_pair(attr.creation_date, attr.origin));
+    }
+    total += found.size();
+  }
+  return inserted == total and inserted == seen.size();
+}
+
 //Assumes that URI was inserted
 bool testExpireURI1(WorldModel& wm) {
   wm.expireURI(uri1, 210);
@@ -992,6 +1138,309 @@ void readAfterWriteThread(WorldModel* wm_p, u16string att_name, size_t num_read_
   }
 }
 
+//Check that a statement only reaches the attributes table through an index
+bool usesAttributeIndex(SQLite3WorldModel& wm, const std::string& statement) {
+  vector<string> plan = wm.queryPlan(statement);
+  bool searched = false;
+  for (string& step : plan) {
+    //Older versions of sqlite write SCAN TABLE rather than SCAN
+    if (0 == step.find("SCAN attributes") or 0 == step.find("SCAN TABLE attributes")) {
+      return false;
+    }
+    if (0 == step.find("SEARCH") and string::npos != step.find("attributes USING")) {
+      searched = true;
+    }
+  }
+  return searched;
+}
+
+//Check that a statement matches URI and name patterns within the prefix
+//range of the dictionary index rather than scanning the dictionary
+bool usesDictionaryIndex(SQLite3WorldModel& wm, const std::string& statement) {
+  vector<string> plan = wm.queryPlan(statement);
+  return none_of(plan.begin(), plan.end(), [](const string& step) {
+      return 0 == step.find("SCAN uris") or 0 == step.find("SCAN TABLE uris") or
+        0 == step.find("SCAN names") or 0 == step.find("SCAN TABLE names");});
+}
+
+bool testQueryPlans(SQLite3WorldModel& wm) {
+  //Store a value so that the first partition exists
+  wm.createURI(u"plan test", u"test_world_model", 100);
+  wm.sync();
+  typedef SQLite3WorldModel::Partition Partition;
+  vector<Partition> tables{Partition{"attributes", 0, SQLite3WorldModel::partition_span},
+    Partition{SQLite3WorldModel::partitionTable(0), 0, SQLite3WorldModel::partition_span}};
+  bool success = usesAttributeIndex(wm, SQLite3WorldModel::snapshotQuery(tables, tables)) and
+    usesDictionaryIndex(wm, SQLite3WorldModel::snapshotQuery(tables, tables)) and
+    usesAttributeIndex(wm, SQLite3WorldModel::rangeQuery(0, tables)) and
+    usesAttributeIndex(wm, SQLite3WorldModel::rangeQuery(2, tables)) and
+    usesDictionaryIndex(wm, SQLite3WorldModel::rangeQuery(2, tables));
+  for (const Partition& table : tables) {
+    success = success and
+      usesAttributeIndex(wm, SQLite3WorldModel::neighborQuery(true, table.table)) and
+      usesAttributeIndex(wm, SQLite3WorldModel::neighborQuery(false, table.table));
+  }
+  return success and usesAttributeIndex(wm, SQLite3WorldModel::expirationQuery("attributes"));
+}
+
+//Write a database with the table layout used before schema version 2
+bool makeOldDatabase(const string& dbname) {
+  sqlite3* db = nullptr;
+  if (SQLITE_OK != sqlite3_open_v2(dbname.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr)) {
+    sqlite3_close(db);
+    return false;
+  }
+  const char* statements =
+    "CREATE TABLE attributes ('uri' TEXT, 'name' TEXT, creation_date INTEGER, "
+    "expiration_date INTEGER, 'origin' TEXT, 'data' BLOB);"
+    "CREATE TABLE current ('uri' TEXT, 'name' TEXT, creation_date INTEGER, "
+    "expiration_date INTEGER, 'origin' TEXT, 'data' BLOB, PRIMARY KEY(uri, name, origin));"
+    "INSERT INTO attributes VALUES ('test1', 'creation', 1, 0, 'test_world_model', X'');"
+    "INSERT INTO attributes VALUES ('test1', 'att1', 100, 200, 'test_world_model', X'00010203');"
+    "INSERT INTO attributes VALUES ('test1', 'att1', 200, 0, 'test_world_model', X'010203');"
+    "INSERT INTO current VALUES ('test1', 'creation', 1, 0, 'test_world_model', X'');"
+    "INSERT INTO current VALUES ('test1', 'att1', 200, 0, 'test_world_model', X'010203');";
+  bool success = SQLITE_OK == sqlite3_exec(db, statements, nullptr, nullptr, nullptr);
+  sqlite3_close(db);
+  return success;
+}
+
+//Repeated inserts and queries should reuse their prepared statements
+bool testStatementReuse(SQLite3WorldModel& wm) {
+  wm.createURI(uri1, u"test_world_model", 0);
+  const size_t rounds = 50;
+  for (size_t i = 1; i <= rounds; ++i) {
+    vector<Attribute> entries{Attribute{u"att1", (grail_time)(10*i), 0, u"test_world_model", {1, 2, 3}}};
+    wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri1, entries)});
+    vector<u16string> search_atts{u"att1"};
+    wm.historicSnapshot(uri1, search_atts, 0, 10*i);
+  }
+  wm.sync();
+  StatementCache::Statistics stats = wm.statementStatistics();
+  //Each statement shape is prepared once unless threads compete for it.
+  //Every round stores, expires, and updates the current table.
+  return stats.misses < 20 and stats.hits > 2*rounds and 0 == stats.evictions;
+}
+
+//A full statement cache should drop the statement idle the longest rather
+//than the one being returned
+bool testStatementEviction() {
+  sqlite3* db = nullptr;
+  if (SQLITE_OK != sqlite3_open(":memory:", &db)) {
+    return false;
+  }
+  bool success = true;
+  {
+    StatementCache cache(db, 2);
+    for (std::string sql : {"SELECT 1;", "SELECT 2;", "SELECT 3;"}) {
+      success = cache.get(sql).get() != nullptr and success;
+    }
+    //SELECT 1 was evicted and the newer two are still cached
+    cache.get("SELECT 3;");
+    cache.get("SELECT 2;");
+    StatementCache::Statistics before = cache.statistics();
+    cache.get("SELECT 1;");
+    StatementCache::Statistics after = cache.statistics();
+    success = success and 2 == before.hits and 3 == before.misses and 1 == before.evictions and
+      4 == after.misses and 2 == after.cached;
+  }
+  sqlite3_close(db);
+  return success;
+}
+
+//Many small inserts should share transactions and be stored after a sync
+bool testGroupCommit(SQLite3WorldModel& wm) {
+  const size_t num_uris = 200;
+  for (size_t i = 0; i < num_uris; ++i) {
+    string num = to_string(i);
+    URI uri = u"group." + u16string(num.begin(), num.end());
+    vector<Attribute> entries{Attribute{u"att1", 100, 0, u"test_world_model", {1, 2, 3}}};
+    wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri, entries)}, true);
+  }
+  wm.sync();
+  WriteJournal::Statistics stats = wm.journalStatistics();
+  if (0 != stats.pending or num_uris != stats.operations or stats.transactions >= num_uris) {
+    return false;
+  }
+  vector<u16string> search_atts{u"att1"};
+  return num_uris == wm.historicSnapshot(u"group\\..*", search_atts, 0, 100).size();
+}
+
+//Historic queries from several threads should run on pooled read connections
+bool testReadConnections(SQLite3WorldModel& wm) {
+  wm.createURI(uri1, u"test_world_model", 0);
+  wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri1, attributes1)});
+  const size_t num_threads = 4;
+  vector<char> success(num_threads, true);
+  vector<thread> readers;
+  for (size_t i = 0; i < num_threads; ++i) {
+    readers.push_back(thread([&, i]() {
+          for (size_t cycle = 0; cycle < 20; ++cycle) {
+            if (not testHistoricSnapshot1(wm)) {
+              success[i] = false;
+            }
+          }}));
+  }
+  for_each(readers.begin(), readers.end(), [&](thread& t) { t.join();});
+  return all_of(success.begin(), success.end(), [](char c) { return c;}) and
+    0 < wm.readConnections() and num_threads >= wm.readConnections();
+}
+
+//Read a single integer from a database, or -1 on failure
+int queryInteger(const string& dbname, const string& sql) {
+  sqlite3* db = nullptr;
+  int value = -1;
+  sqlite3_stmt* statement_p = nullptr;
+  if (SQLITE_OK == sqlite3_open_v2(dbname.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) and
+      SQLITE_OK == sqlite3_prepare_v2(db, sql.c_str(), -1, &statement_p, nullptr) and
+      SQLITE_ROW == sqlite3_step(statement_p)) {
+    value = sqlite3_column_int(statement_p, 0);
+  }
+  sqlite3_finalize(statement_p);
+  sqlite3_close(db);
+  return value;
+}
+
+int schemaVersion(const string& dbname) {
+  return queryInteger(dbname, "PRAGMA user_version;");
+}
+
+//Historic snapshots should be the same before and after a checkpoint and
+//storing data from before a checkpoint should discard the checkpoint
+bool testCheckpoints(SQLite3WorldModel& wm, const string& dbname) {
+  wm.setCheckpointPolicy(0, SQLite3WorldModel::default_checkpoint_retention);
+  wm.createURI(uri1, u"test_world_model", 0);
+  for (grail_time t = 100; t <= 500; t += 100) {
+    vector<Attribute> entries{Attribute{u"att1", t, 0, u"test_world_model", {(uint8_t)(t/100)}}};
+    wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri1, entries)});
+  }
+  //Check which version is current at the given time
+  auto currentAt = [&](grail_time time, grail_time creation) {
+    vector<u16string> search_atts{u"att1"};
+    WorldModel::world_state state = wm.historicSnapshot(uri1, search_atts, 0, time);
+    return 1 == state[uri1].size() and creation == state[uri1][0].creation_date;
+  };
+  wm.checkpoint(300);
+  wm.sync();
+  if (1 != queryInteger(dbname, "SELECT COUNT(*) FROM checkpoints;") or
+      not (currentAt(250, 200) and currentAt(300, 300) and currentAt(450, 400))) {
+    return false;
+  }
+  vector<Attribute> late{Attribute{u"att1", 250, 0, u"test_world_model", {9}}};
+  wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri1, late)});
+  wm.sync();
+  return 0 == queryInteger(dbname, "SELECT COUNT(*) FROM checkpoints;") and
+    currentAt(260, 250) and currentAt(300, 300) and currentAt(450, 400);
+}
+
+//History is split into a partition per day. Retention rules drop whole
+//partitions or remove expired names from them and downsample older history,
+//always keeping current values.
+bool testPartitions(SQLite3WorldModel& wm, const string& dbname) {
+  const grail_time day = SQLite3WorldModel::partition_span;
+  wm.setCheckpointPolicy(0, SQLite3WorldModel::default_checkpoint_retention);
+  wm.createURI(uri1, u"test_world_model", 0);
+  auto insertValue = [&](const u16string& name, grail_time creation) {
+    vector<Attribute> entries{Attribute{name, creation, 0, u"test_world_model", {(uint8_t)(creation/1000)}}};
+    wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri1, entries)});
+  };
+  //Ten values a second apart at the start of each of four days
+  for (grail_time d = 0; d < 4; ++d) {
+    for (grail_time t = 1000; t <= 10000; t += 1000) {
+      insertValue(u"att1", d*day + t);
+    }
+  }
+  //A value on the first day that is kept
+  insertValue(u"att2", 500);
+  wm.sync();
+  auto rangeCount = [&](const u16string& name, grail_time start, grail_time stop) {
+    vector<u16string> search_atts{name};
+    return wm.historicDataInRange(uri1, search_atts, start, stop)[uri1].size();
+  };
+  auto currentAt = [&](grail_time time, grail_time creation) {
+    vector<u16string> search_atts{u"att1"};
+    WorldModel::world_state state = wm.historicSnapshot(uri1, search_atts, 0, time);
+    return 1 == state[uri1].size() and creation == state[uri1][0].creation_date;
+  };
+  if (4 != queryInteger(dbname, "SELECT COUNT(*) FROM partitions;") or
+      40 != rangeCount(u"att1", 0, 4*day) or not currentAt(day + 5500, day + 5000)) {
+    return false;
+  }
+  //Keep two days of att1. The first day still holds att2 so only att1 is
+  //removed from it while the second day is dropped.
+  wm.setRetentionPolicy(u"att1", 2*day);
+  wm.applyRetention(4*day);
+  wm.sync();
+  if (3 != queryInteger(dbname, "SELECT COUNT(*) FROM partitions;") or
+      0 != rangeCount(u"att1", 0, 2*day - 1) or 1 != rangeCount(u"att2", 0, day) or
+      20 != rangeCount(u"att1", 2*day, 4*day)) {
+    return false;
+  }
+  //Thin the third day to one value every five seconds
+  wm.setRetentionPolicy(u"att1", 0, day, 5000);
+  wm.applyRetention(4*day);
+  wm.sync();
+  //The values at 1000 to 4000 become one, as do 5000 to 9000, leaving 10000
+  vector<u16string> search_atts{u"att1"};
+  WorldModel::world_state current = wm.currentSnapshot(uri1, search_atts);
+  return 3 == rangeCount(u"att1", 2*day, 3*day - 1) and 10 == rangeCount(u"att1", 3*day, 4*day) and
+    currentAt(2*day + 4500, 2*day + 1000) and currentAt(2*day + 9500, 2*day + 5000) and
+    1 == current[uri1].size() and 3*day + 10000 == current[uri1][0].creation_date;
+}
+
+//A restart should load a saved image, but only if nothing was written after it
+bool testStateImage(const string& dbname) {
+  vector<u16string> search_atts{u"att1"};
+  auto currentData = [&](WorldModel& wm) {
+    WorldModel::world_state state = wm.currentSnapshot(uri1, search_atts);
+    return 1 == state[uri1].size() ? state[uri1][0].data : vector<uint8_t>();
+  };
+  auto insertValue = [&](WorldModel& wm, grail_time creation, uint8_t value) {
+    vector<Attribute> entries{Attribute{u"att1", creation, 0, u"test_world_model", {value}}};
+    wm.insertData(vector<pair<URI, vector<Attribute>>>{make_pair(uri1, entries)});
+  };
+  {
+    SQLite3WorldModel wm(dbname);
+    wm.createURI(uri1, u"test_world_model", 0);
+    insertValue(wm, 100, 1);
+    if (not wm.saveStateImage()) {
+      return false;
+    }
+  }
+  //Empty the current table so that only the image has the current value
+  sqlite3* db = nullptr;
+  sqlite3_open(dbname.c_str(), &db);
+  sqlite3_exec(db, "DELETE FROM current;", nullptr, nullptr, nullptr);
+  sqlite3_close(db);
+  {
+    SQLite3WorldModel wm(dbname);
+    if (vector<uint8_t>{1} != currentData(wm)) {
+      return false;
+    }
+    insertValue(wm, 200, 2);
+  }
+  //The write made the image out of date so the current table is used
+  SQLite3WorldModel wm(dbname);
+  return 0 == queryInteger(dbname, "SELECT COUNT(*) FROM state_image;") and
+    vector<uint8_t>{2} == currentData(wm);
+}
+
+//Check the contents of the database written by makeOldDatabase
+bool testMigratedData(WorldModel& wm) {
+  vector<uint8_t> old_data{0, 1, 2, 3};
+  vector<uint8_t> new_data{1, 2, 3};
+  vector<u16string> search_atts{u"att1"};
+  WorldModel::world_state current = wm.currentSnapshot(uri1, search_atts);
+  WorldModel::world_state historic = wm.historicSnapshot(uri1, search_atts, 0, 150);
+  if (current[uri1].size() != 1 or historic[uri1].size() != 1) {
+    return false;
+  }
+  Attribute& cur = current[uri1][0];
+  Attribute& old = historic[uri1][0];
+  return cur.creation_date == 200 and cur.data == new_data and
+    old.creation_date == 100 and old.expiration_date == 200 and old.data == old_data;
+}
+
 string makeFilename() {
   return string("testdb_") + to_string(random()) + string("_db");
 }
@@ -1099,6 +1548,19 @@ int main(int argc, char** argv) {
     delete wm;
   }
 
+  cerr<<"Testing literal and prefix URI search...\t";
+  {
+    WorldModel* wm = makeWM(makeFilename());
+    if (createAndSearchURIs(*wm) and
+        searchLiteralURI(*wm)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+    delete wm;
+  }
+
   cerr<<"Testing data insertion cannot create URIs...\t";
   {
     WorldModel* wm = makeWM(makeFilename());
@@ -1218,6 +1680,54 @@ int main(int argc, char** argv) {
     delete wm;
   }
 
+  cerr<<"Testing expiration dates of out of order data...\t";
+  {
+    WorldModel* wm = makeWM(makeFilename());
+    if (testOutOfOrderHistory(*wm)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+    delete wm;
+  }
+
+  cerr<<"Testing expiration dates of old data inserted by several threads...\t";
+  {
+    WorldModel* wm = makeWM(makeFilename());
+    if (testConcurrentOldHistory(*wm)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+    delete wm;
+  }
+
+  cerr<<"Testing range requests read through a cursor...\t";
+  {
+    WorldModel* wm = makeWM(makeFilename());
+    if (testRangeCursor(*wm)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+    delete wm;
+  }
+
+  cerr<<"Testing range cursors over bursts of rows...\t";
+  {
+    WorldModel* wm = makeWM(makeFilename());
+    if (testRangeCursorBursts(*wm)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+    delete wm;
+  }
+
   /*
   //Test noncontiguous expired attributes in a historic range requests
   cerr<<"Testing AND query in historic range...\t";
@@ -1470,6 +1980,77 @@ int main(int argc, char** argv) {
     delete wm;
   }
 
+  //Test that indexed standing queries only see data that they can match
+  cerr<<"Testing that standing queries with patterns and literals are indexed...\t";
+  {
+    WorldModel* wm = makeWM(makeFilename());
+    vector<u16string> pattern_atts{u"att[3]"};
+    vector<u16string> literal_atts{u"att3"};
+    {
+      StandingQuery pattern_sq = wm->requestStandingQuery(u"test.*", pattern_atts, true);
+      StandingQuery other_uri_sq = wm->requestStandingQuery(u"other.*", literal_atts, true);
+
+      if (createAndSearchURIs(*wm) and
+          insertAndRetrieveData(*wm) and
+          checkStandingQuery(pattern_sq) and
+          other_uri_sq.getData().empty()) {
+        cerr<<"Pass\n";
+      }
+      else {
+        cerr<<"Fail\n";
+      }
+    }
+    
+    delete wm;
+  }
+
+  //Test that a standing query with an invalid pattern is ignored
+  cerr<<"Testing that standing queries with invalid patterns receive nothing...\t";
+  {
+    WorldModel* wm = makeWM(makeFilename());
+    vector<u16string> bad_atts{u"att3", u"att["};
+    {
+      StandingQuery bad_sq = wm->requestStandingQuery(u"test.*", bad_atts, true);
+      bool success = createAndSearchURIs(*wm) and insertAndRetrieveData(*wm);
+      StandingQuery::flush();
+      if (success and bad_sq.getData().empty()) {
+        cerr<<"Pass\n";
+      }
+      else {
+        cerr<<"Fail\n";
+      }
+    }
+
+    delete wm;
+  }
+
+  //Test that one update is shared by standing queries instead of copied
+  cerr<<"Testing that standing queries share attribute data...\t";
+  {
+    WorldModel* wm = makeWM(makeFilename());
+    vector<u16string> search_atts{u"att3"};
+    {
+      StandingQuery first_sq = wm->requestStandingQuery(u"test.*", search_atts, true);
+      StandingQuery second_sq = wm->requestStandingQuery(uri1, search_atts, true);
+
+      bool success = createAndSearchURIs(*wm) and insertAndRetrieveData(*wm);
+      StandingQuery::flush();
+      SharedState first = first_sq.getSharedData();
+      SharedState second = second_sq.getSharedData();
+      if (success and
+          1 == first[uri1].size() and 1 == second[uri1].size() and
+          first[uri1][0].data == second[uri1][0].data and
+          *first[uri1][0].data == attributes1[2].data) {
+        cerr<<"Pass\n";
+      }
+      else {
+        cerr<<"Fail\n";
+      }
+    }
+    
+    delete wm;
+  }
+
   //Test that standing queries will get an update when a match is expired
   cerr<<"Testing that standing queries find updates when items are expired...\t";
   {
@@ -1477,12 +2058,10 @@ int main(int argc, char** argv) {
     vector<u16string> search_atts{u"att3"};
     {
       StandingQuery sq = wm->requestStandingQuery(uri1, search_atts, true);
-      //The threaded standing query sleeps for 5ms when there is no data, so sleep longer
       if (createAndSearchURIs(*wm) and
           insertAndRetrieveData(*wm) and
           checkStandingQuery(sq) and
           testExpireURI1(*wm) and
-					not usleep(6000) and
           checkExpiredStandingQuery(sq)) {
         cerr<<"Pass\n";
       }
@@ -1501,12 +2080,10 @@ int main(int argc, char** argv) {
     vector<u16string> search_atts{u"att3"};
     {
       StandingQuery sq = wm->requestStandingQuery(uri1, search_atts, true);
-      //The threaded standing query sleeps for 5ms when there is no data, so sleep longer
       if (createAndSearchURIs(*wm) and
           insertAndRetrieveData(*wm) and
           checkStandingQuery(sq) and
           testDeleteURI(*wm) and
-					not usleep(6000) and
           checkExpiredStandingQuery(sq)) {
         cerr<<"Pass\n";
       }
@@ -1604,6 +2181,109 @@ int main(int argc, char** argv) {
     delete wm;
   }
 
+  //The remaining tests examine the sqlite3 storage layout directly
+  cerr<<"Testing that sqlite3 historic queries search the attribute indexes...\t";
+  {
+    SQLite3WorldModel wm(makeFilename());
+    if (testQueryPlans(wm)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+  }
+
+  cerr<<"Testing that sqlite3 prepared statements are cached and reused...\t";
+  {
+    SQLite3WorldModel wm(makeFilename());
+    if (testStatementReuse(wm)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+  }
+
+  cerr<<"Testing that full statement caches evict the least recently used statement...\t";
+  if (testStatementEviction()) {
+    cerr<<"Pass\n";
+  }
+  else {
+    cerr<<"Fail\n";
+  }
+
+  cerr<<"Testing that sqlite3 writes are grouped into shared transactions...\t";
+  {
+    SQLite3WorldModel wm(makeFilename());
+    if (testGroupCommit(wm)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+  }
+
+  cerr<<"Testing sqlite3 historic queries from several threads on read connections...\t";
+  {
+    SQLite3WorldModel wm(makeFilename());
+    if (testReadConnections(wm)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+  }
+
+  cerr<<"Testing sqlite3 historic snapshots that start from a checkpoint...\t";
+  {
+    string dbname = makeFilename();
+    SQLite3WorldModel wm(dbname);
+    if (testCheckpoints(wm, dbname)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+  }
+
+  cerr<<"Testing sqlite3 restarts from a saved image of the current state...\t";
+  {
+    if (testStateImage(makeFilename())) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+  }
+
+  cerr<<"Testing sqlite3 history partitions, retention, and downsampling...\t";
+  {
+    string dbname = makeFilename();
+    SQLite3WorldModel wm(dbname);
+    if (testPartitions(wm, dbname)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+  }
+
+  cerr<<"Testing migration of an sqlite3 database from the old table layout...\t";
+  {
+    string dbname = makeFilename();
+    bool success = makeOldDatabase(dbname);
+    if (success) {
+      SQLite3WorldModel wm(dbname);
+      success = testMigratedData(wm) and testQueryPlans(wm);
+    }
+    if (success and SQLite3WorldModel::schema_version == schemaVersion(dbname)) {
+      cerr<<"Pass\n";
+    }
+    else {
+      cerr<<"Fail\n";
+    }
+  }
+
   return 0;
 }
 
@@ -0,0 +1,685 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+#include "reactor.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+#include <netdb.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+using namespace std::chrono;
+
+ReactorConnection::ReactorConnection(const std::vector<unsigned char>& handshake, time_t timeout) :
+  reactor(nullptr), fd(-1), port_num(0), handshake(handshake), out_offset(0),
+  inbox_bytes(0), tick_due(false), dispatched(false), output_blocked(false), peer_closed(false),
+  timeout(timeout) {
+  handshake_done = false;
+  input_paused = false;
+  closed = false;
+  tick_scheduled = false;
+  //Initialize activity timers to the current time
+  last_activity = time(NULL);
+  last_sent = time(NULL);
+}
+
+ReactorConnection::~ReactorConnection() {
+  if (-1 != fd) {
+    ::close(fd);
+  }
+}
+
+void ReactorConnection::flush() {
+  while (out_offset < out_buffer.size()) {
+    ssize_t sent = ::send(fd, &out_buffer[out_offset], out_buffer.size() - out_offset, MSG_NOSIGNAL);
+    if (0 < sent) {
+      out_offset += sent;
+      last_sent = time(NULL);
+    }
+    else if (-1 == sent and EINTR == errno) {
+      continue;
+    }
+    else {
+      //The socket is full or broken. Errors are seen again when reading.
+      break;
+    }
+  }
+  if (out_offset == out_buffer.size()) {
+    out_buffer.clear();
+    out_offset = 0;
+  }
+  //Don't let the sent part of the buffer grow without bound
+  else if (out_offset > out_buffer.size() / 2) {
+    out_buffer.erase(out_buffer.begin(), out_buffer.begin() + out_offset);
+    out_offset = 0;
+  }
+}
+
+void ReactorConnection::rearm() {
+  if (closed or nullptr == reactor) {
+    return;
+  }
+  epoll_event ev;
+  //Errors and hang ups are still reported while reading is paused
+  ev.events = EPOLLONESHOT;
+  if (not input_paused) {
+    ev.events |= EPOLLIN;
+  }
+  if (out_offset < out_buffer.size()) {
+    ev.events |= EPOLLOUT;
+  }
+  ev.data.fd = fd;
+  epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void ReactorConnection::send(const std::vector<unsigned char>& buff) {
+  if (closed) {
+    return;
+  }
+  std::unique_lock<std::mutex> lck(tx_mutex);
+  //If data is already waiting then the socket is already watched for writing
+  bool was_idle = out_offset == out_buffer.size();
+  out_buffer.insert(out_buffer.end(), buff.begin(), buff.end());
+  if (was_idle) {
+    flush();
+    if (out_offset < out_buffer.size()) {
+      rearm();
+    }
+  }
+}
+
+size_t ReactorConnection::queued() {
+  std::unique_lock<std::mutex> lck(tx_mutex);
+  return out_buffer.size() - out_offset;
+}
+
+void ReactorConnection::wakeAfter(milliseconds delay) {
+  steady_clock::time_point when = steady_clock::now() + delay;
+  {
+    std::unique_lock<std::mutex> lck(work_mutex);
+    if (tick_scheduled and next_tick <= when) {
+      return;
+    }
+    next_tick = when;
+    tick_scheduled = true;
+  }
+  reactor->schedule(shared_from_this(), when);
+}
+
+void ReactorConnection::close() {
+  if (closed.exchange(true)) {
+    return;
+  }
+  if (nullptr != reactor) {
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    ::shutdown(fd, SHUT_RDWR);
+    reactor->remove(this);
+  }
+}
+
+void ReactorConnection::setActive() {
+  last_activity = time(NULL);
+}
+
+time_t ReactorConnection::lastActive() {
+  return last_activity;
+}
+
+time_t ReactorConnection::lastSentTo() {
+  return last_sent;
+}
+
+Reactor::Reactor(size_t num_threads, size_t num_workers) :
+  num_threads(num_threads), workers_stopping(false), num_workers(num_workers) {
+  if (0 == this->num_threads) {
+    this->num_threads = std::max(4u, std::thread::hardware_concurrency());
+  }
+  //Handlers spend most of their time waiting on the database
+  if (0 == this->num_workers) {
+    this->num_workers = std::max(16u, 2 * std::thread::hardware_concurrency());
+  }
+  stopping = false;
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (-1 == epoll_fd) {
+    throw std::system_error(errno, std::system_category(), "Could not create epoll instance");
+  }
+  stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (-1 == stop_fd) {
+    ::close(epoll_fd);
+    throw std::system_error(errno, std::system_category(), "Could not create stop event");
+  }
+  //The stop event is never read so that it wakes every thread
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = stop_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &ev);
+  next_sweep = steady_clock::now() + seconds(1);
+}
+
+Reactor::~Reactor() {
+  stop();
+  for (auto& L : listeners) {
+    ::close(L.first);
+  }
+  ::close(stop_fd);
+  ::close(epoll_fd);
+}
+
+bool Reactor::listen(uint16_t port, ConnectionFactory factory) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* results;
+  if (0 != getaddrinfo(NULL, std::to_string(port).c_str(), &hints, &results)) {
+    return false;
+  }
+  //Use the first address that can be bound
+  int listen_fd = -1;
+  for (addrinfo* ai = results; ai != NULL and -1 == listen_fd; ai = ai->ai_next) {
+    listen_fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+    if (-1 == listen_fd) {
+      continue;
+    }
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (0 != bind(listen_fd, ai->ai_addr, ai->ai_addrlen) or
+        0 != ::listen(listen_fd, SOMAXCONN)) {
+      ::close(listen_fd);
+      listen_fd = -1;
+    }
+  }
+  freeaddrinfo(results);
+  if (-1 == listen_fd) {
+    return false;
+  }
+  listeners[listen_fd] = factory;
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = listen_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+  return true;
+}
+
+void Reactor::start() {
+  //Signals should be handled by the thread that started the reactor
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads.push_back(std::thread(std::mem_fn(&Reactor::ioLoop), this));
+  }
+  for (size_t i = 0; i < num_workers; ++i) {
+    workers.push_back(std::thread(std::mem_fn(&Reactor::workLoop), this));
+  }
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+}
+
+void Reactor::stop() {
+  if (threads.empty()) {
+    return;
+  }
+  stopping = true;
+  uint64_t one = 1;
+  if (sizeof(one) != write(stop_fd, &one, sizeof(one))) {
+    std::cerr<<"Error waking reactor threads.\n";
+  }
+  for (std::thread& t : threads) {
+    t.join();
+  }
+  threads.clear();
+  //Let running handlers finish and drop the rest of the work
+  {
+    std::unique_lock<std::mutex> lck(ready_mutex);
+    workers_stopping = true;
+  }
+  ready_cond.notify_all();
+  for (std::thread& t : workers) {
+    t.join();
+  }
+  workers.clear();
+  ready.clear();
+  //Close the connections outside of the lock since their destructors may
+  //take some time.
+  std::map<int, std::shared_ptr<ReactorConnection>> open;
+  {
+    std::unique_lock<std::mutex> lck(conn_mutex);
+    open.swap(connections);
+  }
+  for (auto& I : open) {
+    I.second->close();
+  }
+}
+
+size_t Reactor::size() {
+  std::unique_lock<std::mutex> lck(conn_mutex);
+  return connections.size();
+}
+
+void Reactor::ioLoop() {
+  std::vector<epoll_event> events(64);
+  while (not stopping) {
+    int wait = runTimers();
+    int num_events = epoll_wait(epoll_fd, events.data(), events.size(), wait);
+    if (-1 == num_events) {
+      if (EINTR != errno) {
+        std::cerr<<"Error waiting for socket events: "<<strerror(errno)<<'\n';
+      }
+      continue;
+    }
+    for (int i = 0; i < num_events and not stopping; ++i) {
+      int fd = events[i].data.fd;
+      if (stop_fd == fd) {
+        continue;
+      }
+      auto L = listeners.find(fd);
+      if (L != listeners.end()) {
+        acceptAll(fd, L->second);
+        continue;
+      }
+      std::shared_ptr<ReactorConnection> rc;
+      {
+        std::unique_lock<std::mutex> lck(conn_mutex);
+        auto C = connections.find(fd);
+        if (C != connections.end()) {
+          rc = C->second;
+        }
+      }
+      //The connection may have been closed by another thread
+      if (rc) {
+        handleEvents(rc, events[i].events);
+      }
+    }
+  }
+}
+
+void Reactor::acceptAll(int listen_fd, ConnectionFactory& factory) {
+  while (true) {
+    sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    int fd = accept4(listen_fd, (sockaddr*)&addr, &addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (-1 == fd) {
+      if (EINTR == errno) {
+        continue;
+      }
+      //Another thread may have taken the connection
+      if (EAGAIN != errno and EWOULDBLOCK != errno) {
+        std::cerr<<"Error accepting a connection: "<<strerror(errno)<<'\n';
+      }
+      return;
+    }
+    char host[NI_MAXHOST] = "";
+    char service[NI_MAXSERV] = "0";
+    getnameinfo((sockaddr*)&addr, addr_len, host, sizeof(host),
+        service, sizeof(service), NI_NUMERICHOST | NI_NUMERICSERV);
+    std::cerr<<"Got a connection from "<<host<<':'<<service<<".\n";
+
+    std::shared_ptr<ReactorConnection> rc;
+    try {
+      rc = factory();
+    } catch (std::exception& err) {
+      std::cerr<<"Error creating connection: "<<err.what()<<'\n';
+      ::close(fd);
+      continue;
+    }
+    rc->reactor = this;
+    rc->fd = fd;
+    rc->ip = host;
+    rc->port_num = atoi(service);
+    rc->setActive();
+    {
+      std::unique_lock<std::mutex> lck(conn_mutex);
+      connections[fd] = rc;
+    }
+    //Send the handshake and start watching the socket
+    std::unique_lock<std::mutex> lck(rc->tx_mutex);
+    rc->out_buffer = rc->handshake;
+    rc->flush();
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    if (rc->out_offset < rc->out_buffer.size()) {
+      ev.events |= EPOLLOUT;
+    }
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+  }
+}
+
+void Reactor::workLoop() {
+  while (true) {
+    std::shared_ptr<ReactorConnection> rc;
+    {
+      std::unique_lock<std::mutex> lck(ready_mutex);
+      ready_cond.wait(lck, [&]() { return workers_stopping or not ready.empty();});
+      if (workers_stopping) {
+        return;
+      }
+      rc = ready.front();
+      ready.pop_front();
+    }
+    work(rc);
+  }
+}
+
+void Reactor::work(std::shared_ptr<ReactorConnection> rc) {
+  for (size_t handled = 0; ; ++handled) {
+    std::vector<unsigned char> message;
+    bool tick = false;
+    bool resume_input = false;
+    {
+      std::unique_lock<std::mutex> lck(rc->work_mutex);
+      if (rc->closed) {
+        rc->inbox.clear();
+        rc->inbox_bytes = 0;
+        rc->dispatched = false;
+        return;
+      }
+      //Close the connection once the last messages from the other side are handled
+      if (rc->inbox.empty() and (not rc->tick_due or rc->peer_closed)) {
+        rc->dispatched = false;
+        if (rc->peer_closed) {
+          lck.unlock();
+          std::cerr<<"Connection to "<<rc->ip<<':'<<rc->port_num<<" closed.\n";
+          rc->close();
+        }
+        return;
+      }
+      //Wait for the socket rather than queueing more replies. The I/O
+      //thread dispatches this connection again once the data is sent.
+      if (not rc->peer_closed and rc->queued() > ReactorConnection::max_queued) {
+        rc->output_blocked = true;
+        rc->dispatched = false;
+        return;
+      }
+      //Give other connections a turn, keeping this one dispatched
+      if (handled == handled_per_dispatch) {
+        lck.unlock();
+        dispatch(rc);
+        return;
+      }
+      if (not rc->inbox.empty()) {
+        message.swap(rc->inbox.front());
+        rc->inbox.pop_front();
+        rc->inbox_bytes -= message.size();
+        if (rc->input_paused and rc->inbox_bytes < ReactorConnection::max_inbox / 2) {
+          rc->input_paused = false;
+          resume_input = true;
+        }
+      }
+      else {
+        rc->tick_due = false;
+        tick = true;
+      }
+    }
+    //Reading stopped when the inbox filled so start it again here
+    if (resume_input) {
+      std::unique_lock<std::mutex> lck(rc->tx_mutex);
+      rc->rearm();
+    }
+    try {
+      if (tick) {
+        rc->onTick();
+      }
+      else {
+        rc->onMessage(message);
+      }
+    } catch (std::exception& err) {
+      std::cerr<<"Closing connection to "<<rc->ip<<" after error: "<<err.what()<<'\n';
+      rc->close();
+    }
+  }
+}
+
+void Reactor::dispatch(std::shared_ptr<ReactorConnection> rc) {
+  {
+    std::unique_lock<std::mutex> lck(ready_mutex);
+    ready.push_back(rc);
+  }
+  ready_cond.notify_one();
+}
+
+void Reactor::deliver(std::shared_ptr<ReactorConnection> rc, std::vector<std::vector<unsigned char>>& messages) {
+  bool start = false;
+  {
+    std::unique_lock<std::mutex> lck(rc->work_mutex);
+    for (std::vector<unsigned char>& message : messages) {
+      rc->inbox_bytes += message.size();
+      rc->inbox.push_back(std::move(message));
+    }
+    //Stop reading until the handlers catch up
+    if (rc->inbox_bytes > ReactorConnection::max_inbox) {
+      rc->input_paused = true;
+    }
+    if (not rc->dispatched and not rc->output_blocked) {
+      rc->dispatched = true;
+      start = true;
+    }
+  }
+  if (start) {
+    dispatch(rc);
+  }
+}
+
+void Reactor::resumeOutput(std::shared_ptr<ReactorConnection> rc) {
+  bool start = false;
+  {
+    std::unique_lock<std::mutex> lck(rc->work_mutex);
+    if (rc->output_blocked and rc->queued() <= ReactorConnection::max_queued / 2) {
+      rc->output_blocked = false;
+      if (not rc->dispatched and (not rc->inbox.empty() or rc->tick_due)) {
+        rc->dispatched = true;
+        start = true;
+      }
+    }
+  }
+  if (start) {
+    dispatch(rc);
+  }
+}
+
+void Reactor::handleEvents(std::shared_ptr<ReactorConnection> rc, uint32_t events) {
+  if (events & EPOLLOUT) {
+    {
+      std::unique_lock<std::mutex> lck(rc->tx_mutex);
+      rc->flush();
+    }
+    resumeOutput(rc);
+  }
+  //A send from a handler can rearm the socket while another I/O thread is
+  //still reading it. That thread rearms the socket again when it finishes,
+  //so this one must not, or the threads would spin on the unread data.
+  std::unique_lock<std::mutex> read_lock(rc->read_mutex, std::try_to_lock);
+  if (not read_lock.owns_lock()) {
+    return;
+  }
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+    bool eof = false;
+    bool received = false;
+    unsigned char buff[65536];
+    while (true) {
+      ssize_t length = recv(rc->fd, buff, sizeof(buff), 0);
+      if (0 < length) {
+        rc->in_buffer.insert(rc->in_buffer.end(), buff, buff + length);
+        received = true;
+      }
+      else if (-1 == length and EINTR == errno) {
+        continue;
+      }
+      else {
+        eof = 0 == length or (EAGAIN != errno and EWOULDBLOCK != errno);
+        break;
+      }
+    }
+    if (received) {
+      rc->setActive();
+    }
+
+    std::vector<unsigned char>& in = rc->in_buffer;
+    size_t offset = 0;
+    if (not rc->handshake_done and in.size() >= rc->handshake.size()) {
+      if (not std::equal(rc->handshake.begin(), rc->handshake.end(), in.begin())) {
+        std::cerr<<"Failure during handshake with "<<rc->ip<<". Received bytes were:\n";
+        std::for_each(in.begin(), in.begin() + rc->handshake.size(),
+            [&](unsigned char c){ std::cerr<<'\t'<<(uint32_t)c;});
+        std::cerr<<'\n';
+        rc->close();
+        return;
+      }
+      offset = rc->handshake.size();
+      rc->handshake_done = true;
+    }
+    //Messages begin with their length as a 32 bit big endian number
+    std::vector<std::vector<unsigned char>> messages;
+    while (rc->handshake_done and in.size() - offset >= 4) {
+      uint32_t length = ((uint32_t)in[offset] << 24) | ((uint32_t)in[offset+1] << 16) |
+                        ((uint32_t)in[offset+2] << 8) | (uint32_t)in[offset+3];
+      if (in.size() - offset - 4 < length) {
+        break;
+      }
+      messages.push_back(std::vector<unsigned char>(in.begin() + offset, in.begin() + offset + 4 + length));
+      offset += 4 + length;
+    }
+    in.erase(in.begin(), in.begin() + offset);
+    if (not messages.empty()) {
+      deliver(rc, messages);
+    }
+    //The socket is not rearmed after the other side closes. A worker handles
+    //the messages that were already received and then closes the connection.
+    if (eof) {
+      bool start = false;
+      {
+        std::unique_lock<std::mutex> lck(rc->work_mutex);
+        rc->peer_closed = true;
+        rc->output_blocked = false;
+        if (not rc->dispatched) {
+          rc->dispatched = true;
+          start = true;
+        }
+      }
+      if (start) {
+        dispatch(rc);
+      }
+      return;
+    }
+  }
+  read_lock.unlock();
+  std::unique_lock<std::mutex> lck(rc->tx_mutex);
+  rc->rearm();
+}
+
+void Reactor::schedule(std::shared_ptr<ReactorConnection> rc, steady_clock::time_point when) {
+  std::unique_lock<std::mutex> lck(timer_mutex);
+  timers.insert(std::make_pair(when, std::weak_ptr<ReactorConnection>(rc)));
+}
+
+void Reactor::remove(ReactorConnection* rc) {
+  std::unique_lock<std::mutex> lck(conn_mutex);
+  auto C = connections.find(rc->fd);
+  if (C != connections.end() and C->second.get() == rc) {
+    connections.erase(C);
+  }
+}
+
+int Reactor::runTimers() {
+  steady_clock::time_point now = steady_clock::now();
+  std::vector<std::shared_ptr<ReactorConnection>> due;
+  bool do_sweep = false;
+  {
+    std::unique_lock<std::mutex> lck(timer_mutex);
+    while (not timers.empty() and timers.begin()->first <= now) {
+      std::shared_ptr<ReactorConnection> rc = timers.begin()->second.lock();
+      if (rc) {
+        due.push_back(rc);
+      }
+      timers.erase(timers.begin());
+    }
+    if (next_sweep <= now) {
+      do_sweep = true;
+      next_sweep = now + seconds(1);
+    }
+  }
+  for (std::shared_ptr<ReactorConnection>& rc : due) {
+    bool start = false;
+    {
+      std::unique_lock<std::mutex> lck(rc->work_mutex);
+      //Skip ticks that were replaced by an earlier one
+      if (not rc->closed and rc->tick_scheduled and rc->next_tick <= now) {
+        rc->tick_scheduled = false;
+        rc->tick_due = true;
+        if (not rc->dispatched and not rc->output_blocked) {
+          rc->dispatched = true;
+          start = true;
+        }
+      }
+    }
+    //onTick runs on a worker thread
+    if (start) {
+      dispatch(rc);
+    }
+  }
+  if (do_sweep) {
+    sweep();
+  }
+
+  std::unique_lock<std::mutex> lck(timer_mutex);
+  steady_clock::time_point next = next_sweep;
+  if (not timers.empty() and timers.begin()->first < next) {
+    next = timers.begin()->first;
+  }
+  now = steady_clock::now();
+  if (next <= now) {
+    return 0;
+  }
+  //Round up so that the timer has expired when the thread wakes
+  return duration_cast<milliseconds>(next - now + milliseconds(1) - nanoseconds(1)).count();
+}
+
+void Reactor::sweep() {
+  std::vector<std::shared_ptr<ReactorConnection>> open;
+  {
+    std::unique_lock<std::mutex> lck(conn_mutex);
+    for (auto& I : connections) {
+      open.push_back(I.second);
+    }
+  }
+  time_t now = time(NULL);
+  for (std::shared_ptr<ReactorConnection>& rc : open) {
+    if (now - std::max<time_t>(rc->last_activity, rc->last_sent) > rc->timeout) {
+      std::cerr<<"Timing out connection to "<<rc->ip<<'\n';
+      rc->close();
+    }
+    //Send a keep alive message if the connection has been idle
+    //for half of the time out time.
+    else if (rc->handshake_done and now - rc->last_sent > rc->timeout / 2.0) {
+      rc->send(rc->keepAlive());
+    }
+  }
+}
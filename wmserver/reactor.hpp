@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2012 Bernhard Firner and Rutgers University
+ * All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ * or visit http://www.gnu.org/licenses/gpl-2.0.html
+ */
+
+/*******************************************************************************
+ * An epoll based reactor that services every solver and client connection
+ * with a fixed pool of I/O threads rather than a thread per connection.
+ * The I/O threads accept connections, perform the handshake, split the
+ * incoming byte stream into length prefixed messages, send queued data,
+ * send keep alives, and time out idle connections. Messages and ticks are
+ * handed to a separate pool of worker threads that run the connection's
+ * handlers, so a handler that waits on the database does not stop other
+ * connections from being read or written.
+ * Handlers for a single connection are never run concurrently and see the
+ * connection's messages in the order they arrived.
+ *
+ * @author Bernhard Firner
+ ******************************************************************************/
+
+#ifndef __REACTOR_HPP__
+#define __REACTOR_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+class Reactor;
+
+/**
+ * A connection serviced by a Reactor. Inheriting classes handle messages
+ * in onMessage and any scheduled work in onTick.
+ */
+class ReactorConnection : public std::enable_shared_from_this<ReactorConnection> {
+  private:
+    friend class Reactor;
+
+    //Set by the reactor when the connection is accepted
+    Reactor* reactor;
+    int fd;
+    std::string ip;
+    uint16_t port_num;
+
+    //The handshake sent to and expected back from the other side
+    std::vector<unsigned char> handshake;
+    std::atomic_bool handshake_done;
+
+    //Received bytes that do not yet form a complete message
+    std::vector<unsigned char> in_buffer;
+    //Held by the I/O thread reading the socket. That thread rearms the
+    //socket when it finishes.
+    std::mutex read_mutex;
+
+    //Bytes waiting for the socket to become writable
+    std::vector<unsigned char> out_buffer;
+    size_t out_offset;
+    //Locked before touching out_buffer or rearming the socket
+    std::mutex tx_mutex;
+
+    //Locked before touching the work waiting for the handlers below.
+    //Lock this before tx_mutex if both are needed.
+    std::mutex work_mutex;
+    //Complete messages waiting for onMessage and their total size
+    std::deque<std::vector<unsigned char>> inbox;
+    size_t inbox_bytes;
+    //Set when a tick is due and onTick has not run yet
+    bool tick_due;
+    //Set while a worker thread has this connection queued or is running its
+    //handlers, so that only one worker handles it at a time
+    bool dispatched;
+    //Set while handlers wait for the out buffer to drain
+    bool output_blocked;
+    //Set when the other side closes. The connection closes once the inbox is handled.
+    bool peer_closed;
+    //Set while reading waits for the handlers to empty the inbox
+    std::atomic_bool input_paused;
+
+    std::atomic_bool closed;
+
+    //Time of the next tick requested with wakeAfter, if any. Lock work_mutex first.
+    std::chrono::steady_clock::time_point next_tick;
+    bool tick_scheduled;
+
+    //Time of last received socket activity.
+    std::atomic<time_t> last_activity;
+    //Time of last transmitted socket activity.
+    std::atomic<time_t> last_sent;
+
+    ///Write as much of the out buffer as the socket accepts. Lock tx_mutex first.
+    void flush();
+
+    ///Rearm the one-shot epoll registration. Lock tx_mutex first.
+    void rearm();
+
+    //Private copy semantics to retain control over sockets
+    //(only one connection per socket)
+    ReactorConnection& operator=(const ReactorConnection&) = delete;
+    ReactorConnection(const ReactorConnection&) = delete;
+
+  public:
+    ///Handlers are not run while more than this many bytes wait for the
+    ///socket. They resume once half of the bytes are sent.
+    static const size_t max_queued = 64 * 1024 * 1024;
+    ///Reading stops while this many received bytes wait for the handlers
+    static const size_t max_inbox = 16 * 1024 * 1024;
+
+    //Maximum duration of socket inactivity before the connection is closed.
+    time_t timeout;
+
+    /**
+     * Create a connection that exchanges the given handshake before any
+     * other messages. Timeout defaults to 60 seconds.
+     */
+    ReactorConnection(const std::vector<unsigned char>& handshake, time_t timeout = 60);
+
+    ///Closes the socket
+    virtual ~ReactorConnection();
+
+    /**
+     * Handle a complete message, including its length prefix.
+     * Throwing an exception closes the connection.
+     */
+    virtual void onMessage(std::vector<unsigned char>& raw_message) = 0;
+
+    ///Handle a tick requested with wakeAfter
+    virtual void onTick() {};
+
+    ///The keep alive message for this protocol
+    virtual std::vector<unsigned char> keepAlive() = 0;
+
+    /**
+     * Queue a message for sending. This does not block; the reactor sends
+     * whatever the socket cannot accept immediately once it is writable.
+     * Handlers that send a lot of data should check queued() and continue
+     * in a later tick once the data is sent.
+     * This function is thread safe.
+     */
+    void send(const std::vector<unsigned char>& buff);
+
+    ///Number of bytes waiting for the socket. This function is thread safe.
+    size_t queued();
+
+    /**
+     * Ask for onTick to be called after the given delay. An earlier request
+     * that has not fired yet takes precedence. This function is thread safe.
+     */
+    void wakeAfter(std::chrono::milliseconds delay);
+
+    ///Close the connection. Pending handlers finish first.
+    void close();
+
+    /**
+     * Set the connection active status to avoid timing out.
+     * This is automatically called when socket activity occurs.
+     */
+    void setActive();
+
+    ///Return the time this connection was last active.
+    time_t lastActive();
+
+    ///Return the time this connection last sent data.
+    time_t lastSentTo();
+
+    const std::string& ipAddress() const { return ip; }
+    uint16_t port() const { return port_num; }
+};
+
+class Reactor {
+  public:
+    typedef std::function<std::shared_ptr<ReactorConnection>()> ConnectionFactory;
+
+  private:
+    friend class ReactorConnection;
+
+    int epoll_fd;
+    //Written once to wake every I/O thread when stopping
+    int stop_fd;
+    std::atomic_bool stopping;
+    std::vector<std::thread> threads;
+    size_t num_threads;
+
+    //Connections with messages or ticks for the worker threads, in order
+    std::deque<std::shared_ptr<ReactorConnection>> ready;
+    std::mutex ready_mutex;
+    std::condition_variable ready_cond;
+    bool workers_stopping;
+    std::vector<std::thread> workers;
+    size_t num_workers;
+
+    //Listening sockets and the factories for their connections
+    std::map<int, ConnectionFactory> listeners;
+
+    //Every open connection by socket
+    std::map<int, std::shared_ptr<ReactorConnection>> connections;
+    std::mutex conn_mutex;
+
+    //Connections waiting for onTick, in time order
+    std::multimap<std::chrono::steady_clock::time_point, std::weak_ptr<ReactorConnection>> timers;
+    //Time of the next keep alive and timeout sweep
+    std::chrono::steady_clock::time_point next_sweep;
+    std::mutex timer_mutex;
+
+    ///Loop of each I/O thread
+    void ioLoop();
+
+    ///Loop of each worker thread
+    void workLoop();
+
+    ///Run a connection's waiting messages and ticks on a worker thread
+    void work(std::shared_ptr<ReactorConnection> rc);
+
+    ///Queue a connection for the worker threads. Set its dispatched flag first.
+    void dispatch(std::shared_ptr<ReactorConnection> rc);
+
+    ///Give the handlers a connection's new messages
+    void deliver(std::shared_ptr<ReactorConnection> rc, std::vector<std::vector<unsigned char>>& messages);
+
+    ///Let the handlers run again if they were waiting for the out buffer to drain
+    void resumeOutput(std::shared_ptr<ReactorConnection> rc);
+
+    ///Accept every waiting connection on a listening socket
+    void acceptAll(int listen_fd, ConnectionFactory& factory);
+
+    ///Read from and write to a connection and dispatch any complete messages
+    void handleEvents(std::shared_ptr<ReactorConnection> rc, uint32_t events);
+
+    ///Run due ticks and the sweep. Returns milliseconds until the next one.
+    int runTimers();
+
+    ///Send keep alives and time out idle connections
+    void sweep();
+
+    void schedule(std::shared_ptr<ReactorConnection> rc, std::chrono::steady_clock::time_point when);
+    void remove(ReactorConnection* rc);
+
+    Reactor& operator=(const Reactor&) = delete;
+    Reactor(const Reactor&) = delete;
+
+  public:
+    ///Most messages and ticks of one connection handled before others get a turn
+    static const size_t handled_per_dispatch = 16;
+
+    /**
+     * Use num_threads I/O threads and num_workers threads to run handlers,
+     * or defaults based on the number of cores.
+     */
+    Reactor(size_t num_threads = 0, size_t num_workers = 0);
+
+    ///Stops the threads and closes all connections
+    ~Reactor();
+
+    /**
+     * Listen for connections on the given port, creating a connection object
+     * for each with the factory. Returns false if the port could not be opened.
+     * Call this before start.
+     */
+    bool listen(uint16_t port, ConnectionFactory factory);
+
+    ///Start the I/O and worker threads
+    void start();
+
+    ///Stop the I/O and worker threads and close all connections
+    void stop();
+
+    ///Number of open connections
+    size_t size();
+};
+
+#endif //ifndef __REACTOR_HPP__